@@ -0,0 +1,40 @@
+QT       = core network
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = chatbench
+
+INCLUDEPATH += ../ChatServer ../ChatClient
+
+include(../Common/common.pri)
+
+SOURCES += \
+    codecbench.cpp \
+    fanoutbench.cpp \
+    indexbench.cpp \
+    latencyhistogram.cpp \
+    loadbench.cpp \
+    main.cpp \
+    ../ChatClient/chatclient.cpp \
+    ../ChatServer/metrics.cpp \
+    ../ChatServer/serverlog.cpp \
+    ../ChatServer/serverworker.cpp \
+    ../ChatServer/tracer.cpp \
+    ../ChatServer/userindex.cpp
+
+HEADERS += \
+    benchmarks.h \
+    latencyhistogram.h \
+    ../ChatClient/chatclient.h \
+    ../ChatServer/metrics.h \
+    ../ChatServer/ringbuffer.h \
+    ../ChatServer/serverlog.h \
+    ../ChatServer/serverworker.h \
+    ../ChatServer/tracer.h \
+    ../ChatServer/userindex.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
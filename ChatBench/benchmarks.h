@@ -0,0 +1,35 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+
+// 广播扇出：逐个接收者编码 vs 编码一次共享帧
+// totalDeliveries 为每个接收者规模下的目标投递次数，迭代次数据此换算
+QJsonObject runFanoutBenchmark(const QList<int> &recipientCounts, qint64 totalDeliveries);
+
+// 私聊路由查找：线性扫描 m_clients vs UserIndex，lookups 为索引查找次数
+QJsonObject runIndexBenchmark(const QList<int> &userCounts, int lookups);
+
+// 线协议编解码：JSON 与二进制协议的帧大小和每条消息的编解码耗时
+QJsonObject runCodecBenchmark(int iterations);
+
+// 端到端压测：在回环地址上模拟大量客户端登录并按设定速率收发消息
+struct LoadOptions {
+    QString host = "127.0.0.1";
+    quint16 port = 1967;
+    int clients = 1000;
+    int durationSec = 10;
+    int messagesPerSec = 1000;     // 所有客户端合计
+    double privateRatio = 0.2;
+    int messageBytes = 64;
+    int connectConcurrency = 200;
+    bool binaryWire = true;
+    quint32 seed = 42;
+    qint64 serverPid = 0;          // 已运行的服务器，用于读取内存占用
+    QString serverBinary;          // 非空时由 chatbench 启动 chatserverd
+};
+QJsonObject runLoadBenchmark(const LoadOptions &options);
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,116 @@
+#include "benchmarks.h"
+#include "wireprotocol.h"
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QElapsedTimer>
+
+namespace {
+
+struct Sample {
+    const char *name;
+    QJsonObject message;
+};
+
+QList<Sample> samples()
+{
+    QJsonObject message;
+    message["type"] = "message";
+    message["text"] = QString("大家好，今天的实验课改到下午三点，请提前到实验室");
+    message["sender"] = "bench_user";
+    message["timestamp"] = "14:05:32";
+
+    QJsonObject privateMessage;
+    privateMessage["type"] = "private";
+    privateMessage["text"] = QString("收到，下午见");
+    privateMessage["sender"] = "bench_user";
+    privateMessage["receiver"] = "another_user";
+    privateMessage["timestamp"] = "14:05:40";
+
+    QJsonObject presence;
+    presence["type"] = "newuser";
+    presence["username"] = "bench_user";
+
+    QJsonArray names;
+    for (int i = 0; i < 100; ++i)
+        names.append(QString("user_%1").arg(i));
+    QJsonObject userList;
+    userList["type"] = "userlist";
+    userList["userlist"] = names;
+
+    return {{"message", message}, {"private", privateMessage}, {"newuser", presence}, {"userlist", userList}};
+}
+
+QJsonObject timing(qint64 nsecs, int operations)
+{
+    QJsonObject result;
+    result["operations"] = operations;
+    result["ns_per_op"] = operations > 0 ? double(nsecs) / operations : 0.0;
+    return result;
+}
+
+// 帧字节数都包含 4 字节长度前缀
+QJsonObject runSample(const Sample &sample, int iterations)
+{
+    const QByteArray indented = QJsonDocument(sample.message).toJson();
+    const QByteArray compact = QJsonDocument(sample.message).toJson(QJsonDocument::Compact);
+    const QByteArray binary = WireProtocol::encode(sample.message);
+
+    qint64 sink = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+        sink += QJsonDocument(sample.message).toJson(QJsonDocument::Compact).size();
+    const QJsonObject jsonEncode = timing(timer.nsecsElapsed(), iterations);
+
+    timer.restart();
+    for (int i = 0; i < iterations; ++i)
+        sink += WireProtocol::encode(sample.message).size();
+    const QJsonObject binaryEncode = timing(timer.nsecsElapsed(), iterations);
+
+    // 解码的终点一致：得到可交给路由阶段的 QJsonObject
+    timer.restart();
+    for (int i = 0; i < iterations; ++i)
+        sink += QJsonDocument::fromJson(compact).object().size();
+    const QJsonObject jsonDecode = timing(timer.nsecsElapsed(), iterations);
+
+    timer.restart();
+    for (int i = 0; i < iterations; ++i) {
+        QJsonObject decoded;
+        if (WireProtocol::decode(binary, &decoded))
+            sink += decoded.size();
+    }
+    const QJsonObject binaryDecode = timing(timer.nsecsElapsed(), iterations);
+
+    QJsonObject decoded;
+    const bool roundTrip = WireProtocol::decode(binary, &decoded) && decoded == sample.message;
+
+    QJsonObject bytes;
+    bytes["json_indented"] = indented.size() + 4;
+    bytes["json_compact"] = compact.size() + 4;
+    bytes["binary"] = binary.size() + 4;
+
+    QJsonObject result;
+    result["message"] = sample.name;
+    result["bytes"] = bytes;
+    result["json_encode"] = jsonEncode;
+    result["binary_encode"] = binaryEncode;
+    result["json_decode"] = jsonDecode;
+    result["binary_decode"] = binaryDecode;
+    result["round_trip_ok"] = roundTrip;
+    result["checksum"] = sink;
+    return result;
+}
+
+} // namespace
+
+QJsonObject runCodecBenchmark(int iterations)
+{
+    QJsonArray runs;
+    for (const Sample &sample : samples())
+        runs.append(runSample(sample, qMax(1, iterations)));
+
+    QJsonObject result;
+    result["scenario"] = "codec";
+    result["runs"] = runs;
+    return result;
+}
@@ -0,0 +1,104 @@
+#include "benchmarks.h"
+#include "serverworker.h"
+#include <QIODevice>
+#include <QDataStream>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QDateTime>
+
+namespace {
+
+// 丢弃所有写入数据的设备，用来隔离出编码本身的开销
+class NullDevice : public QIODevice
+{
+public:
+    NullDevice() { open(QIODevice::WriteOnly); }
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+    qint64 writeData(const char *, qint64 len) override { return len; }
+};
+
+QJsonObject sampleMessage()
+{
+    QJsonObject message;
+    message["type"] = "message";
+    message["text"] = QString("大家好，这是一条用于压测广播路径的公共消息");
+    message["sender"] = "bench_user";
+    message["timestamp"] = QDateTime::currentDateTime().toString("hh:mm:ss");
+    return message;
+}
+
+QJsonObject makeResult(qint64 nsecs, qint64 deliveries, qint64 bytes)
+{
+    const double seconds = nsecs / 1e9;
+    QJsonObject result;
+    result["seconds"] = seconds;
+    result["deliveries"] = deliveries;
+    result["bytes"] = bytes;
+    result["messages_per_sec"] = seconds > 0 ? deliveries / seconds : 0.0;
+    result["bytes_per_sec"] = seconds > 0 ? bytes / seconds : 0.0;
+    return result;
+}
+
+// 旧路径：每个接收者各自 toJson + fromUtf8 + 新建 QDataStream
+QJsonObject runPerRecipient(const QJsonObject &message, int recipients, int iterations)
+{
+    NullDevice sink;
+    qint64 bytes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        for (int r = 0; r < recipients; ++r) {
+            const QByteArray jsonData = QJsonDocument(message).toJson(QJsonDocument::Compact);
+            const QString jsonStr = QString::fromUtf8(jsonData);
+            QDataStream socketStream(&sink);
+            socketStream.setVersion(QDataStream::Qt_5_7);
+            socketStream << jsonData;
+            Q_UNUSED(jsonStr);
+            bytes += jsonData.size() + 4;
+        }
+    }
+    return makeResult(timer.nsecsElapsed(), qint64(iterations) * recipients, bytes);
+}
+
+// 新路径：编码一次，所有接收者写入同一份帧
+QJsonObject runSharedFrame(const QJsonObject &message, int recipients, int iterations)
+{
+    NullDevice sink;
+    qint64 bytes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        const QByteArray frame = ServerWorker::encodeFrame(message);
+        for (int r = 0; r < recipients; ++r) {
+            bytes += sink.write(frame);
+        }
+    }
+    return makeResult(timer.nsecsElapsed(), qint64(iterations) * recipients, bytes);
+}
+
+} // namespace
+
+QJsonObject runFanoutBenchmark(const QList<int> &recipientCounts, qint64 totalDeliveries)
+{
+    const QJsonObject message = sampleMessage();
+    QJsonArray runs;
+
+    for (int recipients : recipientCounts) {
+        const int iterations = int(qMax<qint64>(1, totalDeliveries / qMax(1, recipients)));
+
+        QJsonObject run;
+        run["recipients"] = recipients;
+        run["iterations"] = iterations;
+        run["per_recipient_encode"] = runPerRecipient(message, recipients, iterations);
+        run["shared_frame"] = runSharedFrame(message, recipients, iterations);
+        runs.append(run);
+    }
+
+    QJsonObject result;
+    result["scenario"] = "fanout";
+    result["runs"] = runs;
+    return result;
+}
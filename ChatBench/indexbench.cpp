@@ -0,0 +1,106 @@
+#include "benchmarks.h"
+#include "serverworker.h"
+#include "userindex.h"
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QVector>
+
+namespace {
+
+QJsonObject timing(qint64 nsecs, qint64 operations)
+{
+    QJsonObject result;
+    result["operations"] = operations;
+    result["seconds"] = nsecs / 1e9;
+    result["ns_per_op"] = operations > 0 ? double(nsecs) / operations : 0.0;
+    return result;
+}
+
+QJsonObject runForUserCount(int users, int scanLookups, int indexLookups)
+{
+    QVector<ServerWorker*> clients;
+    clients.reserve(users);
+    UserIndex index;
+    for (int i = 0; i < users; ++i) {
+        ServerWorker *worker = new ServerWorker;
+        worker->setUserName(QString("user_%1").arg(i));
+        clients.append(worker);
+        index.insert(worker->userName(), worker);
+    }
+
+    QRandomGenerator rng(42);
+    QVector<QString> targets;
+    targets.reserve(indexLookups);
+    for (int i = 0; i < indexLookups; ++i)
+        targets.append(QString("user_%1").arg(rng.bounded(users)));
+
+    // 旧实现：线性扫描 m_clients 比较 userName()
+    qint64 found = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < scanLookups; ++i) {
+        const QString &receiver = targets.at(i % targets.size());
+        for (ServerWorker *worker : std::as_const(clients)) {
+            if (worker->userName() == receiver) {
+                ++found;
+                break;
+            }
+        }
+    }
+    const QJsonObject scan = timing(timer.nsecsElapsed(), scanLookups);
+
+    // 新实现：分片哈希索引
+    timer.restart();
+    for (int i = 0; i < indexLookups; ++i) {
+        if (index.find(targets.at(i)))
+            ++found;
+    }
+    const QJsonObject indexed = timing(timer.nsecsElapsed(), indexLookups);
+
+    // 断开：QVector::removeAll 与 QSet + 索引删除，各删除相同的一批用户
+    const int removals = qMin(users, 1000);
+    QVector<ServerWorker*> vectorClients = clients;
+    timer.restart();
+    for (int i = 0; i < removals; ++i)
+        vectorClients.removeAll(clients.at(i));
+    const QJsonObject scanRemove = timing(timer.nsecsElapsed(), removals);
+
+    QSet<ServerWorker*> setClients(clients.begin(), clients.end());
+    timer.restart();
+    for (int i = 0; i < removals; ++i) {
+        ServerWorker *worker = clients.at(i);
+        setClients.remove(worker);
+        index.remove(worker->userName(), worker);
+    }
+    const QJsonObject indexRemove = timing(timer.nsecsElapsed(), removals);
+
+    qDeleteAll(clients);
+
+    QJsonObject run;
+    run["users"] = users;
+    run["found"] = found;
+    run["scan_lookup"] = scan;
+    run["index_lookup"] = indexed;
+    run["scan_remove"] = scanRemove;
+    run["index_remove"] = indexRemove;
+    return run;
+}
+
+} // namespace
+
+QJsonObject runIndexBenchmark(const QList<int> &userCounts, int lookups)
+{
+    QJsonArray runs;
+    for (int users : userCounts) {
+        // 线性扫描太慢，按用户数缩减查找次数，结果以 ns/op 对比
+        const int scanLookups = qMax(10, int(qint64(lookups) * 1000 / qMax(1000, users)));
+        runs.append(runForUserCount(users, qMin(scanLookups, lookups), lookups));
+    }
+
+    QJsonObject result;
+    result["scenario"] = "index";
+    result["runs"] = runs;
+    return result;
+}
@@ -0,0 +1,90 @@
+#include "latencyhistogram.h"
+#include <QtAlgorithms>
+#include <cmath>
+
+namespace {
+
+constexpr int LinearBuckets = 32;
+constexpr int SubBuckets = 16;
+constexpr int BucketCount = LinearBuckets + (64 - 5) * SubBuckets;
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram()
+    : m_counts(BucketCount, 0)
+{
+}
+
+int LatencyHistogram::bucketOf(quint64 value)
+{
+    if (value < quint64(LinearBuckets))
+        return int(value);
+    // value >= 32 时最高位 msb >= 5，取最高 5 位（范围 16..31）决定子桶
+    const int msb = 63 - qCountLeadingZeroBits(value);
+    const int shift = msb - 4;
+    const int top = int(value >> shift);
+    return LinearBuckets + (msb - 5) * SubBuckets + (top - SubBuckets);
+}
+
+qint64 LatencyHistogram::upperBoundOf(int bucket)
+{
+    if (bucket < LinearBuckets)
+        return bucket;
+    const int msb = (bucket - LinearBuckets) / SubBuckets + 5;
+    const int top = (bucket - LinearBuckets) % SubBuckets + SubBuckets;
+    const int shift = msb - 4;
+    return ((qint64(top) + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(qint64 micros)
+{
+    if (micros < 0)
+        micros = 0;
+    ++m_counts[bucketOf(quint64(micros))];
+    if (m_count == 0 || micros < m_min)
+        m_min = micros;
+    m_max = qMax(m_max, micros);
+    m_sum += micros;
+    ++m_count;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    if (other.m_count == 0)
+        return;
+    for (int i = 0; i < BucketCount; ++i)
+        m_counts[i] += other.m_counts.at(i);
+    m_min = m_count == 0 ? other.m_min : qMin(m_min, other.m_min);
+    m_max = qMax(m_max, other.m_max);
+    m_sum += other.m_sum;
+    m_count += other.m_count;
+}
+
+qint64 LatencyHistogram::percentile(double percent) const
+{
+    if (m_count == 0)
+        return 0;
+
+    const qint64 target = qMax<qint64>(1, qint64(std::ceil(percent / 100.0 * m_count)));
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += m_counts.at(i);
+        if (seen >= target)
+            return qMin(upperBoundOf(i), m_max);
+    }
+    return m_max;
+}
+
+QJsonObject LatencyHistogram::toJson() const
+{
+    QJsonObject result;
+    result["count"] = m_count;
+    result["min_us"] = min();
+    result["mean_us"] = mean();
+    result["p50_us"] = percentile(50);
+    result["p90_us"] = percentile(90);
+    result["p99_us"] = percentile(99);
+    result["p999_us"] = percentile(99.9);
+    result["max_us"] = m_max;
+    return result;
+}
@@ -0,0 +1,39 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QJsonObject>
+#include <QVector>
+
+// 对数-线性分桶的延迟直方图（微秒），思路同 HdrHistogram：
+// 小于 32 的值逐一计数，更大的值按最高 5 个有效位分桶，相对误差不超过 1/16。
+// 记录是 O(1) 的，可以对每一次投递计数而不必采样。
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 micros);
+    void merge(const LatencyHistogram &other);
+
+    qint64 count() const { return m_count; }
+    qint64 min() const { return m_count > 0 ? m_min : 0; }
+    qint64 max() const { return m_max; }
+    double mean() const { return m_count > 0 ? double(m_sum) / m_count : 0.0; }
+    // 返回所在桶的上界，结果偏保守
+    qint64 percentile(double percent) const;
+
+    // count/min/mean/p50/p90/p99/p999/max，单位微秒
+    QJsonObject toJson() const;
+
+private:
+    static int bucketOf(quint64 value);
+    static qint64 upperBoundOf(int bucket);
+
+    QVector<qint64> m_counts;
+    qint64 m_count = 0;
+    qint64 m_sum = 0;
+    qint64 m_min = 0;
+    qint64 m_max = 0;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,418 @@
+#include "benchmarks.h"
+#include "latencyhistogram.h"
+#include "chatclient.h"
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QLoggingCategory>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+constexpr int TickMs = 10;
+constexpr int DrainMs = 2000;
+constexpr int ConnectTimeoutMs = 60000;
+constexpr qint64 MemorySampleIntervalNs = 1000000000LL;
+const QString TextPrefix = QStringLiteral("bench:");
+
+// 所有模拟客户端在同一进程内，共用一个单调时钟计算端到端延迟
+qint64 nowNs()
+{
+    static QElapsedTimer clock = []() {
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+    return clock.nsecsElapsed();
+}
+
+// 从 /proc/<pid>/status 读取 VmRSS 和 VmHWM（KiB），其他平台返回空
+QJsonObject readServerMemory(qint64 pid)
+{
+    QJsonObject memory;
+    if (pid <= 0)
+        return memory;
+
+    QFile status(QString("/proc/%1/status").arg(pid));
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return memory;
+
+    for (const QByteArray &line : status.readAll().split('\n')) {
+        if (line.startsWith("VmRSS:") || line.startsWith("VmHWM:")) {
+            const QList<QByteArray> parts = line.simplified().split(' ');
+            if (parts.size() >= 2)
+                memory[line.startsWith("VmRSS:") ? "rss_kib" : "peak_rss_kib"] = parts.at(1).toLongLong();
+        }
+    }
+    return memory;
+}
+
+void raiseFileLimit()
+{
+#ifdef Q_OS_UNIX
+    // 每个模拟客户端占一个文件描述符，默认的 1024 上限不够
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+class LoadRunner
+{
+public:
+    explicit LoadRunner(const LoadOptions &options)
+        : m_options(options)
+        , m_rng(options.seed)
+    {
+    }
+
+    ~LoadRunner()
+    {
+        for (const SimClient &sim : std::as_const(m_sims))
+            delete sim.client;
+        if (m_server.state() != QProcess::NotRunning) {
+            m_server.terminate();
+            if (!m_server.waitForFinished(5000))
+                m_server.kill();
+        }
+    }
+
+    QJsonObject run();
+
+private:
+    struct SimClient {
+        ChatClient *client = nullptr;
+        QString name;
+        qint64 connectStartNs = 0;
+        bool loggedIn = false;
+    };
+
+    bool startServer(QString *error);
+    bool waitForServer();
+    void connectMore();
+    void onJson(int index, const QJsonObject &message);
+    void tick();
+    void sendOne();
+    QString makeText();
+
+    LoadOptions m_options;
+    QRandomGenerator m_rng;
+    QProcess m_server;
+    QTemporaryDir m_storageDir;
+    qint64 m_serverPid = 0;
+    QEventLoop m_loop;
+
+    QVector<SimClient> m_sims;
+    QVector<int> m_loggedInIndexes;
+    int m_nextToConnect = 0;
+    int m_inFlight = 0;
+    int m_loggedIn = 0;
+    int m_disconnected = 0;
+
+    LatencyHistogram m_connectLatency;   // 建立 TCP 连接
+    LatencyHistogram m_loginLatency;     // 连接到收到用户列表或在线状态快照
+    LatencyHistogram m_publicLatency;
+    LatencyHistogram m_privateLatency;
+
+    bool m_driving = false;
+    qint64 m_driveStartNs = 0;
+    qint64 m_lastTickNs = 0;
+    double m_sendCredit = 0;
+    qint64 m_seq = 0;
+    qint64 m_publicSent = 0;
+    qint64 m_privateSent = 0;
+    qint64 m_expectedDeliveries = 0;
+    qint64 m_deliveries = 0;
+    qint64 m_lastDeliveryNs = 0;
+    qint64 m_lastMemorySampleNs = 0;
+    qint64 m_peakRssKib = 0;
+};
+
+bool LoadRunner::startServer(QString *error)
+{
+    if (m_options.serverBinary.isEmpty()) {
+        m_serverPid = m_options.serverPid;
+        return true;
+    }
+
+    // 由 chatbench 启动的服务器使用临时存储目录，不影响已有日志
+    m_server.setProgram(m_options.serverBinary);
+    m_server.setArguments({"--port", QString::number(m_options.port),
+                           "--storage", m_storageDir.path(),
+                           "--log-level", "warning"});
+    m_server.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    m_server.start();
+    if (!m_server.waitForStarted(5000)) {
+        *error = QString("无法启动服务器: %1").arg(m_server.errorString());
+        return false;
+    }
+    m_serverPid = m_server.processId();
+    if (!waitForServer()) {
+        *error = "服务器未在 10 秒内开始监听";
+        return false;
+    }
+    return true;
+}
+
+bool LoadRunner::waitForServer()
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 10000) {
+        QTcpSocket probe;
+        probe.connectToHost(m_options.host, m_options.port);
+        if (probe.waitForConnected(200)) {
+            probe.disconnectFromHost();
+            return true;
+        }
+        QThread::msleep(100);
+    }
+    return false;
+}
+
+void LoadRunner::connectMore()
+{
+    // 控制同时握手的连接数，避免监听队列溢出
+    while (m_inFlight < m_options.connectConcurrency && m_nextToConnect < m_sims.size()) {
+        SimClient &sim = m_sims[m_nextToConnect++];
+        ++m_inFlight;
+        sim.connectStartNs = nowNs();
+        sim.client->connectToServer(QHostAddress(m_options.host), m_options.port);
+    }
+}
+
+QString LoadRunner::makeText()
+{
+    // 正文携带发送时刻，接收端据此计算端到端延迟
+    QString text = TextPrefix + QString::number(nowNs()) + ':' + QString::number(++m_seq) + ':';
+    if (text.size() < m_options.messageBytes)
+        text.append(QString(m_options.messageBytes - text.size(), QLatin1Char('x')));
+    return text;
+}
+
+void LoadRunner::sendOne()
+{
+    const int senderIndex = m_loggedInIndexes.at(m_rng.bounded(m_loggedInIndexes.size()));
+    SimClient &sender = m_sims[senderIndex];
+
+    const bool isPrivate = m_loggedInIndexes.size() > 1 && m_rng.generateDouble() < m_options.privateRatio;
+    if (!isPrivate) {
+        sender.client->sendMessage(makeText());
+        ++m_publicSent;
+        m_expectedDeliveries += m_loggedIn;
+        return;
+    }
+
+    int receiverIndex = senderIndex;
+    while (receiverIndex == senderIndex)
+        receiverIndex = m_loggedInIndexes.at(m_rng.bounded(m_loggedInIndexes.size()));
+
+    QJsonObject message;
+    message["type"] = "private";
+    message["text"] = makeText();
+    message["sender"] = sender.name;
+    message["receiver"] = m_sims.at(receiverIndex).name;
+    message["timestamp"] = "00:00:00";
+    sender.client->sendJson(message);
+    ++m_privateSent;
+    // 接收者和发送者各收到一份
+    m_expectedDeliveries += 2;
+}
+
+void LoadRunner::tick()
+{
+    const qint64 now = nowNs();
+    if (now - m_lastMemorySampleNs >= MemorySampleIntervalNs) {
+        m_lastMemorySampleNs = now;
+        const QJsonObject memory = readServerMemory(m_serverPid);
+        m_peakRssKib = qMax(m_peakRssKib, memory.value("rss_kib").toInteger());
+    }
+
+    if (!m_driving)
+        return;
+
+    if (now - m_driveStartNs >= qint64(m_options.durationSec) * 1000000000LL) {
+        m_driving = false;
+        // 停止发送后留出时间接收在途消息
+        QTimer::singleShot(DrainMs, &m_loop, &QEventLoop::quit);
+        return;
+    }
+
+    // 按实际流逝的时间累积发送额度，定时器抖动不会改变平均速率
+    m_sendCredit += double(now - m_lastTickNs) / 1e9 * m_options.messagesPerSec;
+    m_lastTickNs = now;
+    while (m_sendCredit >= 1.0 && !m_loggedInIndexes.isEmpty()) {
+        sendOne();
+        m_sendCredit -= 1.0;
+    }
+}
+
+void LoadRunner::onJson(int index, const QJsonObject &message)
+{
+    SimClient &sim = m_sims[index];
+    const QString type = message.value("type").toString();
+
+    // 新服务器以在线状态快照确认登录，旧服务器发送 userlist
+    const bool loginReply = type == QLatin1String("presence_snapshot") || type == QLatin1String("userlist");
+    if (loginReply && !sim.loggedIn) {
+        sim.loggedIn = true;
+        ++m_loggedIn;
+        m_loggedInIndexes.append(index);
+        m_loginLatency.record((nowNs() - sim.connectStartNs) / 1000);
+        if (m_loggedIn + m_disconnected == m_sims.size())
+            m_loop.quit();
+        return;
+    }
+
+    const bool isPublic = type == QLatin1String("message");
+    if (!isPublic && type != QLatin1String("private"))
+        return;
+
+    const QString text = message.value("text").toString();
+    if (!text.startsWith(TextPrefix))
+        return;
+    const qint64 sentNs = QStringView(text).mid(TextPrefix.size()).split(QLatin1Char(':')).first().toLongLong();
+    const qint64 now = nowNs();
+    (isPublic ? m_publicLatency : m_privateLatency).record((now - sentNs) / 1000);
+    ++m_deliveries;
+    m_lastDeliveryNs = now;
+}
+
+QJsonObject LoadRunner::run()
+{
+    QJsonObject result;
+    result["scenario"] = "load";
+
+    QString error;
+    if (!startServer(&error)) {
+        result["error"] = error;
+        return result;
+    }
+
+    m_sims.resize(m_options.clients);
+    for (int i = 0; i < m_options.clients; ++i) {
+        SimClient &sim = m_sims[i];
+        sim.client = new ChatClient;
+        sim.client->setWireNegotiation(m_options.binaryWire);
+        sim.name = QString("bench_%1").arg(i);
+
+        QObject::connect(sim.client, &ChatClient::connected, [this, i]() {
+            SimClient &connectedSim = m_sims[i];
+            --m_inFlight;
+            m_connectLatency.record((nowNs() - connectedSim.connectStartNs) / 1000);
+            connectedSim.client->sendMessage(connectedSim.name, "login");
+            connectMore();
+        });
+        QObject::connect(sim.client, &ChatClient::disconnected, [this, i]() {
+            ++m_disconnected;
+            if (m_sims.at(i).loggedIn) {
+                m_sims[i].loggedIn = false;
+                --m_loggedIn;
+                m_loggedInIndexes.removeOne(i);
+            }
+            if (!m_driving && m_loggedIn + m_disconnected >= m_sims.size())
+                m_loop.quit();
+        });
+        QObject::connect(sim.client, &ChatClient::jsonReceived, [this, i](const QJsonObject &message) {
+            onJson(i, message);
+        });
+    }
+
+    QTimer ticker;
+    QObject::connect(&ticker, &QTimer::timeout, [this]() { tick(); });
+    ticker.setTimerType(Qt::PreciseTimer);
+    ticker.start(TickMs);
+
+    // 阶段一：建立连接并登录
+    const qint64 connectStart = nowNs();
+    QTimer connectTimeout;
+    connectTimeout.setSingleShot(true);
+    QObject::connect(&connectTimeout, &QTimer::timeout, &m_loop, &QEventLoop::quit);
+    connectTimeout.start(ConnectTimeoutMs);
+    connectMore();
+    if (m_loggedIn < m_sims.size())
+        m_loop.exec();
+    connectTimeout.stop();
+    const double connectSeconds = (nowNs() - connectStart) / 1e9;
+    const QJsonObject memoryAfterLogin = readServerMemory(m_serverPid);
+
+    // 阶段二：按设定速率发送公共/私聊消息，结束后等待在途消息
+    m_driving = !m_loggedInIndexes.isEmpty();
+    m_driveStartNs = nowNs();
+    m_lastTickNs = m_driveStartNs;
+    if (m_driving)
+        m_loop.exec();
+    ticker.stop();
+    const double driveSeconds = qMax<qint64>(1, m_lastDeliveryNs - m_driveStartNs) / 1e9;
+
+    QJsonObject config;
+    config["clients"] = m_options.clients;
+    config["duration_sec"] = m_options.durationSec;
+    config["messages_per_sec"] = m_options.messagesPerSec;
+    config["private_ratio"] = m_options.privateRatio;
+    config["message_bytes"] = m_options.messageBytes;
+    config["wire"] = m_options.binaryWire ? "binary" : "json";
+    config["spawned_server"] = !m_options.serverBinary.isEmpty();
+    result["config"] = config;
+
+    QJsonObject connect;
+    connect["logged_in"] = m_loggedIn;
+    connect["failed"] = m_options.clients - m_loggedIn;
+    connect["seconds"] = connectSeconds;
+    connect["tcp_connect"] = m_connectLatency.toJson();
+    connect["login"] = m_loginLatency.toJson();
+    result["connect"] = connect;
+
+    QJsonObject throughput;
+    throughput["public_sent"] = m_publicSent;
+    throughput["private_sent"] = m_privateSent;
+    throughput["expected_deliveries"] = m_expectedDeliveries;
+    throughput["deliveries"] = m_deliveries;
+    throughput["delivery_ratio"] = m_expectedDeliveries > 0 ? double(m_deliveries) / m_expectedDeliveries : 0.0;
+    throughput["messages_per_sec"] = (m_publicSent + m_privateSent) / driveSeconds;
+    throughput["deliveries_per_sec"] = m_deliveries / driveSeconds;
+    result["throughput"] = throughput;
+
+    QJsonObject latency;
+    LatencyHistogram all = m_publicLatency;
+    all.merge(m_privateLatency);
+    latency["all"] = all.toJson();
+    latency["public"] = m_publicLatency.toJson();
+    latency["private"] = m_privateLatency.toJson();
+    result["latency"] = latency;
+
+    QJsonObject server;
+    server["pid"] = m_serverPid;
+    server["after_login"] = memoryAfterLogin;
+    server["at_end"] = readServerMemory(m_serverPid);
+    server["peak_sampled_rss_kib"] = m_peakRssKib;
+    result["server"] = server;
+    return result;
+}
+
+} // namespace
+
+QJsonObject runLoadBenchmark(const LoadOptions &options)
+{
+    // 每条发送都会打调试日志，压测时关掉
+    QLoggingCategory::setFilterRules("*.debug=false");
+    raiseFileLimit();
+
+    LoadRunner runner(options);
+    return runner.run();
+}
@@ -0,0 +1,74 @@
+#include "benchmarks.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QFile>
+#include <QTextStream>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("chatbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("聊天服务器性能测试工具");
+    parser.addHelpOption();
+    parser.addOption({"scenario", "测试场景: fanout, index, codec, load", "name", "fanout"});
+    parser.addOption({"deliveries", "fanout: 每种规模下的目标投递次数", "count", "1000000"});
+    parser.addOption({"lookups", "index: 每种规模下的索引查找次数", "count", "100000"});
+    parser.addOption({"iterations", "codec: 每种消息的编解码次数", "count", "200000"});
+    parser.addOption({"host", "load: 服务器地址", "address", "127.0.0.1"});
+    parser.addOption({"port", "load: 服务器端口", "port", "1967"});
+    parser.addOption({"clients", "load: 模拟客户端数", "count", "1000"});
+    parser.addOption({"duration", "load: 发送阶段时长（秒）", "seconds", "10"});
+    parser.addOption({"rate", "load: 所有客户端合计每秒发送的消息数", "count", "1000"});
+    parser.addOption({"private-ratio", "load: 私聊消息占比 0..1", "ratio", "0.2"});
+    parser.addOption({"message-bytes", "load: 消息正文长度", "bytes", "64"});
+    parser.addOption({"connect-concurrency", "load: 同时握手的连接数", "count", "200"});
+    parser.addOption({"wire", "load: 线协议 json 或 binary", "format", "binary"});
+    parser.addOption({"server-pid", "load: 已运行服务器的进程号，用于读取内存占用", "pid"});
+    parser.addOption({"spawn-server", "load: 由 chatbench 启动的 chatserverd 路径", "path"});
+    parser.addOption({"output", "结果JSON输出文件（默认标准输出）", "file"});
+    parser.process(a);
+
+    const QString scenario = parser.value("scenario");
+    QJsonObject result;
+    if (scenario == "fanout") {
+        result = runFanoutBenchmark({10, 100, 1000, 10000}, parser.value("deliveries").toLongLong());
+    } else if (scenario == "index") {
+        result = runIndexBenchmark({10000, 100000}, parser.value("lookups").toInt());
+    } else if (scenario == "load") {
+        LoadOptions options;
+        options.host = parser.value("host");
+        options.port = parser.value("port").toUShort();
+        options.clients = parser.value("clients").toInt();
+        options.durationSec = parser.value("duration").toInt();
+        options.messagesPerSec = parser.value("rate").toInt();
+        options.privateRatio = parser.value("private-ratio").toDouble();
+        options.messageBytes = parser.value("message-bytes").toInt();
+        options.connectConcurrency = qMax(1, parser.value("connect-concurrency").toInt());
+        options.binaryWire = parser.value("wire") != "json";
+        options.serverPid = parser.value("server-pid").toLongLong();
+        options.serverBinary = parser.value("spawn-server");
+        result = runLoadBenchmark(options);
+    } else if (scenario == "codec") {
+        result = runCodecBenchmark(parser.value("iterations").toInt());
+    } else {
+        QTextStream(stderr) << "未知的测试场景: " << scenario << "\n";
+        return 1;
+    }
+
+    const QByteArray json = QJsonDocument(result).toJson();
+    if (parser.isSet("output")) {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            QTextStream(stderr) << "无法写入结果文件: " << file.fileName() << "\n";
+            return 1;
+        }
+        file.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <QDataStream>
 #include <QJsonObject>
 #include <QJsonDocument>
+#include "wireprotocol.h"
 
 
 ChatClient::ChatClient(QObject *parent)
@@ -9,35 +10,58 @@ ChatClient::ChatClient(QObject *parent)
 {
     m_clientSocket = new QTcpSocket(this);
 
-    connect(m_clientSocket, &QTcpSocket::connected, this, &ChatClient::connected);
+    connect(m_clientSocket, &QTcpSocket::connected, this, [this]() {
+        // 聊天消息都是小帧，关闭 Nagle 避免等待合并
+        m_clientSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        emit connected();
+    });
     connect(m_clientSocket, &QTcpSocket::readyRead, this, &ChatClient::onReadyRead);
+    connect(m_clientSocket, &QTcpSocket::disconnected, this, &ChatClient::disconnected);
+}
+
+void ChatClient::setWireNegotiation(bool enabled)
+{
+    m_wireNegotiation = enabled;
 }
 
 void ChatClient::onReadyRead()
 {
-    QByteArray jsonData;
-    QDataStream socketStream(m_clientSocket);
-    socketStream.setVersion(QDataStream::Qt_5_12);
-    // start an infinite loop
-    for (;;) {
-        socketStream.startTransaction();
-        socketStream >> jsonData;
-        if (socketStream.commitTransaction()) {
-            // emit messageReceived(QString::fromUtf8(jsonData));
+    do {
+        if (m_decoder.readFrom(m_clientSocket) < 0)
+            break;
+
+        QByteArrayView frame;
+        while (m_decoder.nextFrame(&frame)) {
+            // 帧在同一线程里同步解析，直接引用解码缓冲区，不再拷贝
+            const QByteArray jsonData = QByteArray::fromRawData(frame.data(), frame.size());
+
+            if (WireProtocol::isBinary(jsonData)) {
+                QJsonObject message;
+                if (WireProtocol::decode(jsonData, &message)) {
+                    m_binaryWire = true;
+                    if (!answerPing(message))
+                        emit jsonReceived(message);
+                }
+                continue;
+            }
 
             QJsonParseError parseError;
             const QJsonDocument jsonDoc = QJsonDocument::fromJson(jsonData, &parseError);
             if (parseError.error == QJsonParseError::NoError) {
                 if (jsonDoc.isObject()) { // and is a JSON object
                     // emit logMessage(QJsonDocument(jsonDoc).toJson(QJsonDocument::Compact));
-                    emit jsonReceived(jsonDoc.object()); // parse the JSON
+                    if (!answerPing(jsonDoc.object()))
+                        emit jsonReceived(jsonDoc.object()); // parse the JSON
                 }
             }
+        }
 
-        } else {
-            break;
+        if (m_decoder.hasError()) {
+            qDebug() << "帧长度超过上限，断开连接";
+            m_clientSocket->abort();
+            return;
         }
-    }
+    } while (m_clientSocket->bytesAvailable() > 0);
 }
 
 void ChatClient::sendMessage(const QString &text, const QString &type)
@@ -48,30 +72,70 @@ void ChatClient::sendMessage(const QString &text, const QString &type)
     }
 
     if (!text.isEmpty()) {
-        QDataStream serverStream(m_clientSocket);
-        serverStream.setVersion(QDataStream::Qt_5_12);
-
         qDebug() << "发送消息，类型:" << type << "内容:" << text;
 
         if (type == "json") {
             // 直接发送JSON字符串
-            QByteArray data = text.toUtf8();
-            serverStream << data;
-            qDebug() << "发送JSON数据长度:" << data.length();
+            const QJsonDocument doc = QJsonDocument::fromJson(text.toUtf8());
+            if (doc.isObject())
+                sendJson(doc.object());
+            else
+                writePayload(text.toUtf8());
         } else {
             // 否则创建JSON对象
             QJsonObject message;
             message["type"] = type;
             message["text"] = text;
-            QByteArray data = QJsonDocument(message).toJson();
-            serverStream << data;
-            qDebug() << "发送普通消息数据长度:" << data.length();
+            // 登录时声明支持的二进制协议版本，旧服务器会忽略这个字段
+            if (type == "login" && m_wireNegotiation)
+                message["wire"] = WireProtocol::Version;
+            // 声明支持在线状态快照和增量、会回应心跳，旧服务器会忽略这两个字段
+            if (type == "login") {
+                message["presence"] = 1;
+                message["heartbeat"] = 1;
+            }
+            sendJson(message);
         }
     }
 }
 
+bool ChatClient::answerPing(const QJsonObject &message)
+{
+    if (message.value("type").toString() != QLatin1String("ping"))
+        return false;
+    // 服务器只在连接空闲时发送 ping，在这一层直接回应，界面不需要知道
+    sendJson(QJsonObject{{"type", "pong"}});
+    return true;
+}
+
+void ChatClient::sendJson(const QJsonObject &message)
+{
+    if (m_clientSocket->state() != QAbstractSocket::ConnectedState) {
+        qDebug() << "发送失败：客户端未连接";
+        return;
+    }
+
+    // 登录请求总是用 JSON，协商完成之前服务器可能还不认识二进制帧
+    QByteArray data;
+    if (m_binaryWire)
+        data = WireProtocol::encode(message);
+    if (data.isEmpty())
+        data = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    writePayload(data);
+    qDebug() << "发送数据长度:" << data.length();
+}
+
+void ChatClient::writePayload(const QByteArray &payload)
+{
+    QDataStream serverStream(m_clientSocket);
+    serverStream.setVersion(QDataStream::Qt_5_12);
+    serverStream << payload;
+}
+
 void ChatClient::connectToServer(const QHostAddress &address, quint16 port)
 {
+    m_binaryWire = false;
+    m_decoder.reset();
     m_clientSocket->connectToHost(address, port);
 }
 
@@ -4,6 +4,8 @@
 
 #include <QObject>
 #include <QTcpSocket>
+#include <QJsonObject>
+#include "framedecoder.h"
 
 class ChatClient : public QObject
 {
@@ -11,17 +13,30 @@ class ChatClient : public QObject
 public:
     explicit ChatClient(QObject *parent = nullptr);
 
+    // 关闭后登录时不声明二进制协议，始终使用 JSON（用于对比测试）
+    void setWireNegotiation(bool enabled);
+
 signals:
     void connected();
+    void disconnected();
     void messageReceived(const QString &text);
     void jsonReceived(const QJsonObject &docObj);
 
 private:
     QTcpSocket *m_clientSocket;
+    FrameDecoder m_decoder;
+    // 服务器发来过二进制帧后，本端也改用二进制协议发送
+    bool m_binaryWire = false;
+    bool m_wireNegotiation = true;
+
+    void writePayload(const QByteArray &payload);
+    // 收到 ping 时回应 pong 并返回 true
+    bool answerPing(const QJsonObject &message);
 
 public slots:
     void onReadyRead();
     void sendMessage(const QString &text, const QString &type = "message");
+    void sendJson(const QJsonObject &message);
     void connectToServer(const QHostAddress &address, quint16 port);
     void disconnectFromHost();
 };
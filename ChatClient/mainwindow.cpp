@@ -35,11 +35,77 @@ void MainWindow::on_loginButton_clicked()
 void MainWindow::on_sayButton_clicked()
 {
     if (!ui->sayLineEdit->text().isEmpty()) {
-        m_chatClient->sendMessage(ui->sayLineEdit->text());
+        if (!handleRoomCommand(ui->sayLineEdit->text()))
+            m_chatClient->sendMessage(ui->sayLineEdit->text());
         ui->sayLineEdit->clear();
     }
 }
 
+bool MainWindow::handleRoomCommand(const QString &input)
+{
+    // /join 房间、/leave 房间、/rooms、/room 房间 内容、/history 房间
+    // /log [用户] 查看公共或私聊历史，/more 继续往前翻一页
+    // /search 内容 全文搜索，不带内容时继续显示上次搜索更早的结果
+    if (!input.startsWith('/'))
+        return false;
+
+    const QString command = input.section(' ', 0, 0, QString::SectionSkipEmpty).toLower();
+    const QString room = input.section(' ', 1, 1, QString::SectionSkipEmpty);
+    const QString text = input.section(' ', 2, -1, QString::SectionSkipEmpty);
+
+    QJsonObject request;
+    if (command == "/rooms") {
+        request["type"] = "list_rooms";
+    } else if (command == "/join" && !room.isEmpty()) {
+        request["type"] = "join_room";
+        request["room"] = room;
+    } else if (command == "/leave" && !room.isEmpty()) {
+        request["type"] = "leave_room";
+        request["room"] = room;
+    } else if (command == "/room" && !room.isEmpty() && !text.isEmpty()) {
+        request["type"] = "room_message";
+        request["room"] = room;
+        request["text"] = text;
+    } else if (command == "/history" && !room.isEmpty()) {
+        request["type"] = "room_history";
+        request["room"] = room;
+    } else if (command == "/log") {
+        request["type"] = "history";
+        if (!room.isEmpty())
+            request["with"] = room;
+        m_historyRequest = request;
+    } else if (command == "/search") {
+        const QString query = input.section(' ', 1, -1, QString::SectionSkipEmpty);
+        if (query.isEmpty()) {
+            if (!m_searchRequest.contains("before")) {
+                appendNotice("没有更多搜索结果");
+                return true;
+            }
+            request = m_searchRequest;
+        } else {
+            request["type"] = "search";
+            request["query"] = query;
+            m_searchRequest = request;
+        }
+    } else if (command == "/more") {
+        if (m_historyRequest.value("cursor").toString().isEmpty()) {
+            appendNotice("没有更早的历史记录");
+            return true;
+        }
+        request = m_historyRequest;
+    } else {
+        return false;
+    }
+
+    m_chatClient->sendJson(request);
+    return true;
+}
+
+void MainWindow::appendNotice(const QString &text)
+{
+    ui->roomTextEdit->append(QDateTime::currentDateTime().toString("hh:mm:ss") + " - " + text);
+}
+
 void MainWindow::on_logoutButton_clicked()
 {
     m_chatClient->disconnectFromHost();
@@ -157,14 +223,8 @@ void MainWindow::on_privateSendButton_clicked()
     privateMessage["receiver"] = m_privateChatTarget;
     privateMessage["timestamp"] = timestamp;
 
-    // 将JSON对象转换为字符串发送
-    QJsonDocument doc(privateMessage);
-    QString jsonString = QString::fromUtf8(doc.toJson(QJsonDocument::Compact));
-
-    qDebug() << "发送的JSON:" << jsonString;
-
-    // 发送私聊消息
-    m_chatClient->sendMessage(jsonString, "json");
+    // 发送私聊消息，由 ChatClient 按协商结果选择 JSON 或二进制
+    m_chatClient->sendJson(privateMessage);
 
     // 清空输入框
     ui->privateSayLineEdit->clear();
@@ -172,6 +232,7 @@ void MainWindow::on_privateSendButton_clicked()
 
 void MainWindow::connectedToServer()
 {
+    m_presenceSeq = -1;
     m_currentUserName = ui->usernameEdit->text();  // 保存当前用户名
     ui->stackedWidget->setCurrentWidget(ui->chatPage);
     m_chatClient->sendMessage(ui->usernameEdit->text(), "login");
@@ -255,6 +316,39 @@ void MainWindow::jsonReceived(const QJsonObject &docObj)
                 }
             }
         }
+    } else if (typeVal.toString().compare("presence_snapshot", Qt::CaseInsensitive) == 0) {
+        presenceSnapshotReceived(docObj);
+    } else if (typeVal.toString().compare("presence", Qt::CaseInsensitive) == 0) {
+        presenceDeltaReceived(docObj);
+    } else if (typeVal.toString().compare("offline_messages", Qt::CaseInsensitive) == 0) {
+        // 离线期间收到的私聊，登录后整批送达，只提示一次
+        const QJsonArray messages = docObj.value("messages").toArray();
+        for (const QJsonValue &value : messages) {
+            const QJsonObject message = value.toObject();
+            ui->roomTextEdit->append(QString("🔔 [%1] 离线私聊 %2 对我说: %3")
+                                         .arg(message.value("timestamp").toString(),
+                                              message.value("sender").toString(),
+                                              message.value("text").toString()));
+        }
+        if (!messages.isEmpty() && docObj.value("remaining").toInteger() == 0)
+            appendNotice("以上为离线期间收到的私聊消息");
+    } else if (typeVal.toString().compare("history", Qt::CaseInsensitive) == 0) {
+        historyReceived(docObj);
+    } else if (typeVal.toString().compare("search_results", Qt::CaseInsensitive) == 0) {
+        searchResultsReceived(docObj);
+    } else if (typeVal.toString().startsWith("room_", Qt::CaseInsensitive)) {
+        roomReplyReceived(typeVal.toString().toLower(), docObj);
+    } else if (typeVal.toString().compare("error", Qt::CaseInsensitive) == 0) {
+        // 服务器返回的错误提示，例如用户名被占用、对方不在线
+        const QJsonValue textVal = docObj.value("text");
+        if (textVal.isNull() || !textVal.isString())
+            return;
+
+        const QString notice = QDateTime::currentDateTime().toString("hh:mm:ss") + " - " + textVal.toString();
+        if (ui->stackedWidget->currentWidget() == ui->privateChatPage)
+            ui->privateTextEdit->append(notice);
+        else
+            ui->roomTextEdit->append(notice);
     } else if (typeVal.toString().compare("private", Qt::CaseInsensitive) == 0) {
         // 处理私聊消息
         const QJsonValue textVal = docObj.value("text");
@@ -298,7 +392,15 @@ void MainWindow::jsonReceived(const QJsonObject &docObj)
 
 void MainWindow::userJoined(const QString &user)
 {
+    // 增量可能与快照重叠，已存在的用户不重复添加
+    if (!ui->userListWidget->findItems(user, Qt::MatchExactly).isEmpty())
+        return;
     ui->userListWidget->addItem(user);
+
+    if (ui->stackedWidget->currentWidget() == ui->privateChatPage && user != m_currentUserName
+        && ui->privateUserListWidget->findItems(user, Qt::MatchExactly).isEmpty()) {
+        ui->privateUserListWidget->addItem(user);
+    }
 }
 
 void MainWindow::userLeft(const QString &user)
@@ -307,6 +409,132 @@ void MainWindow::userLeft(const QString &user)
         ui->userListWidget->removeItemWidget(aItem);
         delete aItem;
     }
+    for (auto aItem : ui->privateUserListWidget->findItems(user, Qt::MatchExactly))
+        delete aItem;
+
+    if (!m_privateChatTarget.isEmpty() && user == m_privateChatTarget) {
+        ui->privateTextEdit->append(QDateTime::currentDateTime().toString("hh:mm:ss") +
+                                    QString(" - [%1] 已离线").arg(m_privateChatTarget));
+        m_privateChatTarget = "";
+        ui->privateChatLabel->setText("私聊界面 - 请双击右侧用户开始私聊");
+    }
+}
+
+void MainWindow::presenceSnapshotReceived(const QJsonObject &docObj)
+{
+    const QJsonValue seqVal = docObj.value("seq");
+    const QJsonValue usersVal = docObj.value("users");
+    if (!seqVal.isDouble() || !usersVal.isArray())
+        return;
+
+    // 只有快照才整体重建列表
+    m_presenceSeq = seqVal.toInteger();
+    userlistReceived(usersVal.toVariant().toStringList());
+}
+
+void MainWindow::presenceDeltaReceived(const QJsonObject &docObj)
+{
+    const qint64 seq = docObj.value("seq").toInteger(-1);
+    if (seq < 0 || m_presenceSeq < 0 || seq <= m_presenceSeq)
+        return;   // 还没有快照，或已包含在快照中
+    if (seq != m_presenceSeq + 1) {
+        // 漏掉了增量（例如发送队列积压时被合并），重新请求快照
+        m_presenceSeq = -1;
+        QJsonObject request;
+        request["type"] = "presence_sync";
+        m_chatClient->sendJson(request);
+        return;
+    }
+    m_presenceSeq = seq;
+
+    // 一批增量只触发一次重绘
+    ui->userListWidget->setUpdatesEnabled(false);
+    ui->privateUserListWidget->setUpdatesEnabled(false);
+    for (const QJsonValue &user : docObj.value("left").toArray())
+        userLeft(user.toString());
+    for (const QJsonValue &user : docObj.value("joined").toArray())
+        userJoined(user.toString());
+    ui->userListWidget->setUpdatesEnabled(true);
+    ui->privateUserListWidget->setUpdatesEnabled(true);
+}
+
+void MainWindow::roomReplyReceived(const QString &type, const QJsonObject &docObj)
+{
+    const QString room = docObj.value("room").toString();
+
+    if (type == "room_message") {
+        const QString timestamp = docObj.value("timestamp").toString();
+        ui->roomTextEdit->append(QString("[%1] #%2 %3 : %4")
+                                     .arg(timestamp, room, docObj.value("sender").toString(),
+                                          docObj.value("text").toString()));
+    } else if (type == "room_joined") {
+        const QStringList members = docObj.value("members").toVariant().toStringList();
+        appendNotice(QString("已加入聊天室 #%1，成员: %2").arg(room, members.join(", ")));
+    } else if (type == "room_left") {
+        appendNotice(QString("已离开聊天室 #%1").arg(room));
+    } else if (type == "room_member") {
+        const QString user = docObj.value("username").toString();
+        appendNotice(docObj.value("joined").toBool()
+                         ? QString("%1 加入了聊天室 #%2").arg(user, room)
+                         : QString("%1 离开了聊天室 #%2").arg(user, room));
+    } else if (type == "room_list") {
+        QStringList rooms;
+        for (const QJsonValue &value : docObj.value("rooms").toArray()) {
+            const QJsonObject info = value.toObject();
+            rooms.append(QString("#%1(%2)").arg(info.value("name").toString()).arg(info.value("members").toInt()));
+        }
+        appendNotice(rooms.isEmpty() ? QString("当前没有聊天室") : "聊天室: " + rooms.join(" "));
+    } else if (type == "room_history") {
+        appendNotice(QString("#%1 的历史消息:").arg(room));
+        for (const QJsonValue &line : docObj.value("messages").toArray())
+            ui->roomTextEdit->append(line.toString());
+    }
+}
+
+void MainWindow::historyReceived(const QJsonObject &docObj)
+{
+    // 一页可能分成多块，块内旧的在前
+    if (docObj.value("chunk").toInt() == 0) {
+        const QString with = docObj.value("with").toString();
+        appendNotice(with.isEmpty() ? QString("公共聊天历史:") : QString("与 %1 的私聊历史:").arg(with));
+    }
+    for (const QJsonValue &line : docObj.value("messages").toArray())
+        ui->roomTextEdit->append(line.toString());
+
+    if (docObj.value("last").toBool()) {
+        const QString cursor = docObj.value("cursor").toString();
+        m_historyRequest["cursor"] = cursor;
+        if (!cursor.isEmpty())
+            appendNotice("输入 /more 查看更早的记录");
+    }
+}
+
+void MainWindow::searchResultsReceived(const QJsonObject &docObj)
+{
+    // 结果最新的在前
+    const QJsonArray results = docObj.value("results").toArray();
+    appendNotice(QString("“%1”的搜索结果 %2 条:").arg(docObj.value("query").toString()).arg(results.size()));
+    for (const QJsonValue &value : results) {
+        const QJsonObject result = value.toObject();
+        const QString time = QDateTime::fromMSecsSinceEpoch(result.value("timestamp").toInteger())
+                                 .toString("yyyy-MM-dd hh:mm:ss");
+        const QString kind = result.value("kind").toString();
+        QString where;
+        if (kind == "private")
+            where = QString("%1->%2").arg(result.value("sender").toString(), result.value("target").toString());
+        else if (kind == "room")
+            where = QString("#%1 %2").arg(result.value("target").toString(), result.value("sender").toString());
+        else
+            where = QString("公共 %1").arg(result.value("sender").toString());
+        ui->roomTextEdit->append(QString("[%1][%2] %3").arg(time, where, result.value("text").toString()));
+    }
+
+    if (docObj.contains("next")) {
+        m_searchRequest["before"] = docObj.value("next");
+        appendNotice("输入 /search 查看更早的结果");
+    } else {
+        m_searchRequest.remove("before");
+    }
 }
 
 void MainWindow::userlistReceived(const QStringList &list)
@@ -39,11 +39,23 @@ private slots:
     void userJoined(const QString &user);
     void userLeft(const QString &user);
     void userlistReceived(const QStringList &list);
+    void presenceSnapshotReceived(const QJsonObject &docObj);
+    void presenceDeltaReceived(const QJsonObject &docObj);
+    void roomReplyReceived(const QString &type, const QJsonObject &docObj);
+    void historyReceived(const QJsonObject &docObj);
+    void searchResultsReceived(const QJsonObject &docObj);
 
 private:
+    // 公共聊天框中以 / 开头的聊天室命令，识别后返回 true
+    bool handleRoomCommand(const QString &input);
+    void appendNotice(const QString &text);
+
     Ui::MainWindow *ui;
     ChatClient *m_chatClient;
     QString m_currentUserName;        // 当前登录用户名
     QString m_privateChatTarget;      // 私聊对象
+    qint64 m_presenceSeq = -1;        // 已应用的在线状态序号，-1 表示还没有快照
+    QJsonObject m_historyRequest;     // 最近一次历史查询，/more 时带上游标再发一次
+    QJsonObject m_searchRequest;      // 最近一次搜索，不带内容的 /search 时带上 before 再发一次
 };
 #endif // MAINWINDOW_H
@@ -8,20 +8,14 @@ CONFIG += c++17
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(chatcore.pri)
+
 SOURCES += \
-    chatserver.cpp \
     main.cpp \
-    mainwindow.cpp \
-    messagestorage.cpp \
-    serverworker.cpp \
-    threadpool.cpp
+    mainwindow.cpp
 
 HEADERS += \
-    chatserver.h \
-    mainwindow.h \
-    messagestorage.h \
-    serverworker.h \
-    threadpool.h
+    mainwindow.h
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,136 @@
+#include "admissioncontrol.h"
+
+#if defined(Q_OS_WIN)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// 清理空闲令牌桶的间隔
+const qint64 kPruneIntervalMs = 10000;
+
+} // namespace
+
+void AdmissionControl::setLimits(const Limits &limits)
+{
+    m_limits = limits;
+    m_limits.maxConnections = qMax(0, m_limits.maxConnections);
+    m_limits.perIpRate = qMax(0.0, m_limits.perIpRate);
+    m_limits.perIpBurst = qMax(1, m_limits.perIpBurst);
+    m_limits.maxPerIp = qMax(0, m_limits.maxPerIp);
+    m_limits.handshakeTimeoutMs = qMax(0, m_limits.handshakeTimeoutMs);
+    m_limits.acceptBatch = qMax(1, m_limits.acceptBatch);
+}
+
+AdmissionControl::Decision AdmissionControl::admit(const QString &ip, int connections, qint64 nowMs)
+{
+    if (m_limits.maxConnections > 0 && connections >= m_limits.maxConnections)
+        return RejectedFull;
+
+    if (nowMs - m_lastPruneMs >= kPruneIntervalMs)
+        prune(nowMs);
+
+    auto it = m_buckets.find(ip);
+    if (it == m_buckets.end())
+        it = m_buckets.insert(ip, Bucket{double(m_limits.perIpBurst), nowMs, 0});
+    Bucket &bucket = it.value();
+
+    if (m_limits.maxPerIp > 0 && bucket.connections >= m_limits.maxPerIp)
+        return RejectedPerIp;
+
+    if (m_limits.perIpRate > 0) {
+        const double refill = double(nowMs - bucket.updatedMs) / 1000.0 * m_limits.perIpRate;
+        bucket.tokens = qMin(double(m_limits.perIpBurst), bucket.tokens + qMax(0.0, refill));
+        bucket.updatedMs = nowMs;
+        if (bucket.tokens < 1.0)
+            return RejectedRate;
+        bucket.tokens -= 1.0;
+    }
+
+    ++bucket.connections;
+    return Admitted;
+}
+
+void AdmissionControl::release(const QString &ip)
+{
+    auto it = m_buckets.find(ip);
+    if (it != m_buckets.end() && it.value().connections > 0)
+        --it.value().connections;
+}
+
+void AdmissionControl::prune(qint64 nowMs)
+{
+    m_lastPruneMs = nowMs;
+    for (auto it = m_buckets.begin(); it != m_buckets.end();) {
+        const Bucket &bucket = it.value();
+        const double refilled = m_limits.perIpRate > 0
+                                    ? bucket.tokens + double(nowMs - bucket.updatedMs) / 1000.0 * m_limits.perIpRate
+                                    : double(m_limits.perIpBurst);
+        // 没有连接且桶已补满，与没有记录等价
+        if (bucket.connections == 0 && refilled >= m_limits.perIpBurst)
+            it = m_buckets.erase(it);
+        else
+            ++it;
+    }
+}
+
+void AdmissionControl::trackHandshake(ServerWorker *worker, quint64 connectionId, qint64 nowMs)
+{
+    if (m_limits.handshakeTimeoutMs <= 0)
+        return;
+    m_handshakes.push_back(Handshake{nowMs + m_limits.handshakeTimeoutMs, worker, connectionId});
+}
+
+QVector<AdmissionControl::Handshake> AdmissionControl::expiredHandshakes(qint64 nowMs)
+{
+    QVector<Handshake> expired;
+    while (!m_handshakes.empty() && m_handshakes.front().deadlineMs <= nowMs) {
+        expired.append(m_handshakes.front());
+        m_handshakes.pop_front();
+    }
+    return expired;
+}
+
+QString AdmissionControl::peerIp(qintptr socketDescriptor)
+{
+    sockaddr_storage address = {};
+    socklen_t length = sizeof(address);
+#if defined(Q_OS_WIN)
+    const SOCKET handle = SOCKET(socketDescriptor);
+#else
+    const int handle = int(socketDescriptor);
+#endif
+    if (::getpeername(handle, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+        return QString();
+
+    QHostAddress host(reinterpret_cast<const sockaddr *>(&address));
+    bool isV4 = false;
+    const quint32 v4 = host.toIPv4Address(&isV4);
+    if (isV4)
+        host = QHostAddress(v4);
+    return host.toString();
+}
+
+void AdmissionControl::closeDescriptor(qintptr socketDescriptor)
+{
+#if defined(Q_OS_WIN)
+    ::closesocket(SOCKET(socketDescriptor));
+#else
+    ::close(int(socketDescriptor));
+#endif
+}
+
+const char *AdmissionControl::decisionName(Decision decision)
+{
+    switch (decision) {
+    case Admitted:      return "admitted";
+    case RejectedFull:  return "full";
+    case RejectedRate:  return "rate";
+    case RejectedPerIp: return "per_ip";
+    }
+    return "unknown";
+}
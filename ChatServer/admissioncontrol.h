@@ -0,0 +1,77 @@
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QString>
+#include <QVector>
+#include <deque>
+
+class ServerWorker;
+
+// 连接准入：总连接数上限、每个 IP 的令牌桶和并发上限，以及登录握手超时。
+// 只在 ChatServer 所在线程访问。
+//
+// 令牌桶按需补充，不需要定时器；桶满的 IP 与从未出现过的 IP 等价，清理时直接删除，
+// 所以表的大小只与最近一段时间内活跃的 IP 数有关。
+// 握手超时对所有连接都相同，按接入顺序排成一个队列，截止时间天然有序，
+// 每个连接只入队一次，检查时只看队头。
+class AdmissionControl
+{
+public:
+    struct Limits {
+        int maxConnections = 10000;     // 0 表示不限
+        double perIpRate = 20.0;        // 每个 IP 每秒允许的新连接数，0 表示不限
+        int perIpBurst = 40;
+        int maxPerIp = 0;               // 每个 IP 同时保持的连接数，0 表示不限
+        int handshakeTimeoutMs = 10000; // 接入后多久未登录即断开，0 表示不检查
+        int acceptBatch = 64;           // 每轮事件循环最多接入的连接数
+    };
+
+    enum Decision {
+        Admitted,
+        RejectedFull,       // 总连接数已满
+        RejectedRate,       // 该 IP 新建连接过快
+        RejectedPerIp       // 该 IP 的连接数已满
+    };
+
+    struct Handshake {
+        qint64 deadlineMs = 0;
+        ServerWorker *worker = nullptr;
+        quint64 connectionId = 0;
+    };
+
+    void setLimits(const Limits &limits);
+    const Limits &limits() const { return m_limits; }
+
+    // 通过时计入该 IP 的连接数，连接断开后调用 release
+    Decision admit(const QString &ip, int connections, qint64 nowMs);
+    void release(const QString &ip);
+
+    void trackHandshake(ServerWorker *worker, quint64 connectionId, qint64 nowMs);
+    // 取出截止时间已到的握手，调用方确认连接仍然存在且未登录后再断开
+    QVector<Handshake> expiredHandshakes(qint64 nowMs);
+    bool hasPendingHandshakes() const { return !m_handshakes.empty(); }
+
+    // 从套接字描述符取对端 IP；IPv4 映射地址转换为 IPv4
+    static QString peerIp(qintptr socketDescriptor);
+    // 拒绝时直接关闭描述符，不创建任何 Qt 对象
+    static void closeDescriptor(qintptr socketDescriptor);
+    static const char *decisionName(Decision decision);
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        qint64 updatedMs = 0;
+        int connections = 0;
+    };
+
+    void prune(qint64 nowMs);
+
+    Limits m_limits;
+    QHash<QString, Bucket> m_buckets;
+    qint64 m_lastPruneMs = 0;
+    std::deque<Handshake> m_handshakes;
+};
+
+#endif // ADMISSIONCONTROL_H
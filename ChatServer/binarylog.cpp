@@ -0,0 +1,332 @@
+#include "binarylog.h"
+#include "logwriter.h"
+#include "serverlog.h"
+#include <QDir>
+#include <QDateTime>
+#include <QStringList>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+const char kSegmentMagic[] = "CHATSEG1";
+const char kDictMagic[] = "CHATDICT";
+const int kMagicSize = 8;
+
+// 负载中正文之前的固定部分：时间戳 + 类型 + 发送者 + 接收者
+const int kFixedPayload = 8 + 1 + 4 + 4;
+// 记录头（长度 + CRC）与尾部长度
+const int kRecordHeader = 8;
+const int kRecordTrailer = 4;
+
+const quint32 *crcTable()
+{
+    static quint32 table[256];
+    static const bool initialized = [] {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    Q_UNUSED(initialized);
+    return table;
+}
+
+quint32 readU32(const uchar *p)
+{
+    return qFromLittleEndian<quint32>(p);
+}
+
+// 检查 [start, start + 记录长度) 是否是一条完整有效的记录，返回记录总长度，无效返回 0
+qint64 recordSizeAt(const uchar *base, qint64 start, qint64 end)
+{
+    if (end - start < kRecordHeader + kFixedPayload + kRecordTrailer)
+        return 0;
+    const quint32 payloadSize = readU32(base + start);
+    const qint64 total = kRecordHeader + qint64(payloadSize) + kRecordTrailer;
+    if (payloadSize < quint32(kFixedPayload) || total > end - start)
+        return 0;
+    if (readU32(base + start + kRecordHeader + payloadSize) != payloadSize)
+        return 0;
+    return total;
+}
+
+// 段文件中完整记录的结束位置。末尾的尾部长度对得上时直接返回 size，
+// 否则说明有写了一半的记录，从头找到最后一条完整记录
+qint64 completeLength(const uchar *base, qint64 size)
+{
+    const quint32 tailLength = readU32(base + size - kRecordTrailer);
+    const qint64 tailStart = size - kRecordTrailer - qint64(tailLength) - kRecordHeader;
+    if (tailStart >= kMagicSize && recordSizeAt(base, tailStart, size) == size - tailStart)
+        return size;
+
+    qint64 pos = kMagicSize;
+    while (qint64 recordSize = recordSizeAt(base, pos, size))
+        pos += recordSize;
+    return pos;
+}
+
+} // namespace
+
+QByteArray BinaryLog::segmentHeader()
+{
+    return QByteArray(kSegmentMagic, kMagicSize);
+}
+
+quint32 BinaryLog::crc32(const char *data, qsizetype size)
+{
+    const quint32 *table = crcTable();
+    quint32 crc = 0xFFFFFFFFu;
+    for (qsizetype i = 0; i < size; ++i)
+        crc = table[(crc ^ uchar(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+bool BinaryLog::open(const QString &directory)
+{
+    QWriteLocker locker(&m_lock);
+
+    if (m_dictFile.isOpen())
+        m_dictFile.close();
+    m_ids.clear();
+    m_names.clear();
+    m_names.append(QString());   // ID 0 表示“无”
+
+    m_dictFile.setFileName(QDir(directory).filePath("names.dict"));
+    if (!m_dictFile.open(QIODevice::ReadWrite)) {
+        ServerLog::warning("storage", QString("无法打开名字字典: %1").arg(m_dictFile.fileName()));
+        return false;
+    }
+
+    const QByteArray data = m_dictFile.readAll();
+    qint64 validEnd = kMagicSize;
+    if (data.size() < kMagicSize || !data.startsWith(QByteArray(kDictMagic, kMagicSize))) {
+        m_dictFile.resize(0);
+        m_dictFile.write(kDictMagic, kMagicSize);
+    } else {
+        // 条目格式：u32 ID | u16 长度 | UTF-8 名字
+        const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+        qint64 pos = kMagicSize;
+        while (pos + 6 <= data.size()) {
+            const quint32 id = readU32(p + pos);
+            const quint16 length = qFromLittleEndian<quint16>(p + pos + 4);
+            if (pos + 6 + length > data.size() || id != quint32(m_names.size()))
+                break;
+            const QString name = QString::fromUtf8(data.constData() + pos + 6, length);
+            m_ids.insert(name, id);
+            m_names.append(name);
+            pos += 6 + length;
+        }
+        validEnd = pos;
+        // 截掉崩溃时写了一半的条目
+        if (validEnd < data.size())
+            m_dictFile.resize(validEnd);
+    }
+    m_dictFile.seek(m_dictFile.size());
+    return true;
+}
+
+void BinaryLog::setSyncDictionary(bool sync)
+{
+    m_syncDictionary.store(sync, std::memory_order_relaxed);
+}
+
+quint32 BinaryLog::internLocked(const QString &name)
+{
+    auto it = m_ids.constFind(name);
+    if (it != m_ids.constEnd())
+        return it.value();
+
+    const quint32 id = quint32(m_names.size());
+    const QByteArray utf8 = name.toUtf8().left(0xFFFF);
+
+    QByteArray entry(6, Qt::Uninitialized);
+    qToLittleEndian<quint32>(id, entry.data());
+    qToLittleEndian<quint16>(quint16(utf8.size()), entry.data() + 4);
+    entry.append(utf8);
+
+    // 字典条目先于引用它的记录落盘，读取方总能解析出名字。
+    // 记录此时还没有入队，这里同步完成后段文件的 fdatasync 一定在它之后
+    if (m_dictFile.isOpen()) {
+        m_dictFile.write(entry);
+        m_dictFile.flush();
+        if (m_syncDictionary.load(std::memory_order_relaxed))
+            LogWriter::syncFileData(m_dictFile);
+    }
+
+    m_ids.insert(name, id);
+    m_names.append(name);
+    return id;
+}
+
+QByteArray BinaryLog::encode(Kind kind, const QString &sender, const QString &receiver,
+                             const QString &text, qint64 timestampMs)
+{
+    quint32 senderId = 0;
+    quint32 receiverId = 0;
+    {
+        // 绝大多数名字已驻留，只需读锁
+        QReadLocker locker(&m_lock);
+        senderId = m_ids.value(sender, 0);
+        receiverId = receiver.isEmpty() ? 0 : m_ids.value(receiver, 0);
+    }
+    if (senderId == 0 || (receiverId == 0 && !receiver.isEmpty())) {
+        QWriteLocker locker(&m_lock);
+        senderId = internLocked(sender);
+        if (!receiver.isEmpty())
+            receiverId = internLocked(receiver);
+    }
+
+    const QByteArray utf8 = text.toUtf8();
+    const quint32 payloadSize = quint32(kFixedPayload + utf8.size());
+
+    QByteArray record(kRecordHeader + int(payloadSize) + kRecordTrailer, Qt::Uninitialized);
+    char *p = record.data();
+    char *payload = p + kRecordHeader;
+    qToLittleEndian<qint64>(timestampMs, payload);
+    payload[8] = char(kind);
+    qToLittleEndian<quint32>(senderId, payload + 9);
+    qToLittleEndian<quint32>(receiverId, payload + 13);
+    std::memcpy(payload + kFixedPayload, utf8.constData(), size_t(utf8.size()));
+
+    qToLittleEndian<quint32>(payloadSize, p);
+    qToLittleEndian<quint32>(crc32(payload, payloadSize), p + 4);
+    qToLittleEndian<quint32>(payloadSize, payload + payloadSize);
+    return record;
+}
+
+quint32 BinaryLog::idOf(const QString &name) const
+{
+    QReadLocker locker(&m_lock);
+    return m_ids.value(name, 0);
+}
+
+QString BinaryLog::nameOf(quint32 id) const
+{
+    QReadLocker locker(&m_lock);
+    return id < quint32(m_names.size()) ? m_names.at(int(id)) : QString("#%1").arg(id);
+}
+
+bool BinaryLog::scanBackward(const QString &segmentPath, const std::function<bool(const Entry &)> &visitor,
+                             qint64 endOffset) const
+{
+    QFile file(segmentPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    if (size <= kMagicSize)
+        return true;
+
+    uchar *base = file.map(0, size);
+    if (!base) {
+        ServerLog::warning("storage", QString("无法映射段文件: %1").arg(segmentPath));
+        return false;
+    }
+    if (std::memcmp(base, kSegmentMagic, kMagicSize) != 0) {
+        file.unmap(base);
+        return false;
+    }
+
+    // 末尾可能有写了一半的记录
+    const qint64 end = completeLength(base, size);
+
+    qint64 pos = end;
+    if (endOffset >= 0)
+        pos = qBound<qint64>(kMagicSize, endOffset, end);
+    while (pos > kMagicSize) {
+        const quint32 payloadSize = readU32(base + pos - kRecordTrailer);
+        const qint64 start = pos - kRecordTrailer - qint64(payloadSize) - kRecordHeader;
+        if (start < kMagicSize || payloadSize < quint32(kFixedPayload))
+            break;
+
+        const uchar *payload = base + start + kRecordHeader;
+        pos = start;
+
+        Entry entry;
+        entry.payload = reinterpret_cast<const char *>(payload);
+        entry.payloadSize = payloadSize;
+        entry.storedCrc = readU32(base + start + 4);
+        entry.offset = start;
+        entry.timestampMs = qFromLittleEndian<qint64>(payload);
+        entry.kind = payload[8];
+        entry.senderId = readU32(payload + 9);
+        entry.receiverId = readU32(payload + 13);
+        entry.text = reinterpret_cast<const char *>(payload + kFixedPayload);
+        entry.textSize = int(payloadSize) - kFixedPayload;
+
+        if (!visitor(entry))
+            break;
+    }
+
+    file.unmap(base);
+    return true;
+}
+
+qint64 BinaryLog::validSegmentSize(const QString &segmentPath)
+{
+    QFile file(segmentPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    const qint64 size = file.size();
+    if (size < kMagicSize)
+        return 0;
+    if (size == kMagicSize)
+        return size;
+
+    uchar *base = file.map(0, size);
+    if (!base)
+        return -1;
+    qint64 end = -1;
+    if (std::memcmp(base, kSegmentMagic, kMagicSize) == 0)
+        end = completeLength(base, size);
+    file.unmap(base);
+    return end;
+}
+
+QString BinaryLog::formatEntry(const Entry &entry) const
+{
+    const QString timestamp = QDateTime::fromMSecsSinceEpoch(entry.timestampMs).toString("yyyy-MM-dd hh:mm:ss");
+    const QString text = QString::fromUtf8(entry.text, entry.textSize);
+
+    if (entry.kind == PublicRecord) {
+        return QString("[%1][PUBLIC][%2] %3").arg(timestamp, nameOf(entry.senderId), text);
+    }
+    if (entry.kind == RoomRecord) {
+        return QString("[%1][ROOM][%2][%3] %4")
+            .arg(timestamp, nameOf(entry.receiverId), nameOf(entry.senderId), text);
+    }
+    return QString("[%1][PRIVATE][%2->%3] %4")
+        .arg(timestamp, nameOf(entry.senderId), nameOf(entry.receiverId), text);
+}
+
+bool BinaryLog::exportToText(const QString &segmentPath, const QString &textPath) const
+{
+    // 倒序扫描后再反转，输出顺序与原文本日志一致（旧的在前）
+    QStringList lines;
+    const bool scanned = scanBackward(segmentPath, [this, &lines, &segmentPath](const Entry &entry) {
+        if (entry.checksumOk())
+            lines.append(formatEntry(entry));
+        else
+            ServerLog::warning("storage", QString("段文件记录校验失败，已跳过: %1 %2")
+                                              .arg(segmentPath).arg(entry.timestampMs));
+        return true;
+    });
+    if (!scanned)
+        return false;
+
+    QFile out(textPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        ServerLog::warning("storage", QString("无法写入导出文件: %1").arg(textPath));
+        return false;
+    }
+    for (auto it = lines.crbegin(); it != lines.crend(); ++it) {
+        out.write(it->toUtf8());
+        out.write("\n");
+    }
+    return true;
+}
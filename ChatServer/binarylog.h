@@ -0,0 +1,91 @@
+#ifndef BINARYLOG_H
+#define BINARYLOG_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+#include <QFile>
+#include <QReadWriteLock>
+#include <atomic>
+#include <functional>
+
+// 二进制追加式消息段格式。
+//
+// 段文件：8 字节魔数 "CHATSEG1" 后接若干记录，每条记录为
+//   u32 负载长度 | u32 CRC32(负载) | 负载 | u32 负载长度（尾部，用于倒序扫描）
+// 负载为
+//   i64 毫秒时间戳 | u8 类型 | u32 发送者ID | u32 接收者ID | UTF-8 正文
+// 聊天室记录的接收者ID是房间名的 ID，与用户名共用同一个字典。
+// 所有整数均为小端序。用户名在同目录的 names.dict 中驻留为整数 ID。
+class BinaryLog
+{
+public:
+    enum Kind : quint8 {
+        PublicRecord = 1,
+        PrivateRecord = 2,
+        RoomRecord = 3
+    };
+
+    // 指向映射内存的记录视图，只在扫描回调期间有效。
+    // 扫描时不做 CRC 校验，调用方只对命中的记录调用 checksumOk()。
+    struct Entry {
+        qint64 timestampMs = 0;
+        quint8 kind = 0;
+        quint32 senderId = 0;
+        quint32 receiverId = 0;
+        const char *text = nullptr;
+        int textSize = 0;
+        const char *payload = nullptr;
+        quint32 payloadSize = 0;
+        quint32 storedCrc = 0;
+        qint64 offset = 0;          // 记录在段文件中的起始位置，可作为分页游标
+
+        bool checksumOk() const { return BinaryLog::crc32(payload, payloadSize) == storedCrc; }
+    };
+
+    BinaryLog() = default;
+    BinaryLog(const BinaryLog &) = delete;
+    BinaryLog &operator=(const BinaryLog &) = delete;
+
+    // 打开（或创建）目录下的 names.dict 并载入已有的名字
+    bool open(const QString &directory);
+
+    // 为 true 时新名字写入字典后立即 fdatasync，与段文件每批 fdatasync 的模式配合，
+    // 保证落盘的记录引用的名字也已落盘
+    void setSyncDictionary(bool sync);
+
+    // 编码一条完整记录，首次出现的名字会先写入字典文件
+    QByteArray encode(Kind kind, const QString &sender, const QString &receiver,
+                      const QString &text, qint64 timestampMs);
+
+    quint32 idOf(const QString &name) const;   // 未知名字返回 0
+    QString nameOf(quint32 id) const;
+
+    // 通过 mmap 从段尾向前扫描，visitor 返回 false 时停止。
+    // endOffset >= 0 时从该位置（某条记录的 offset）之前开始扫描
+    bool scanBackward(const QString &segmentPath, const std::function<bool(const Entry &)> &visitor,
+                      qint64 endOffset = -1) const;
+    // 按现有文本格式输出一条记录
+    QString formatEntry(const Entry &entry) const;
+    // 把段文件导出为原有的 [时间][类型][发送者] 文本格式
+    bool exportToText(const QString &segmentPath, const QString &textPath) const;
+
+    // 段文件中最后一条完整记录的结束位置，供重新打开段追加前截掉崩溃留下的半条记录。
+    // 不足一个魔数时返回 0；无法读取或魔数不符时返回 -1
+    static qint64 validSegmentSize(const QString &segmentPath);
+
+    static QByteArray segmentHeader();
+    static quint32 crc32(const char *data, qsizetype size);
+
+private:
+    quint32 internLocked(const QString &name);
+
+    mutable QReadWriteLock m_lock;
+    QHash<QString, quint32> m_ids;
+    QVector<QString> m_names;      // 下标即 ID，0 号保留
+    QFile m_dictFile;
+    std::atomic<bool> m_syncDictionary{false};
+};
+
+#endif // BINARYLOG_H
@@ -0,0 +1,46 @@
+# ChatServer 核心代码（不依赖 widgets），GUI 服务器和 chatserverd 共用
+
+INCLUDEPATH += $$PWD
+
+include($$PWD/../Common/common.pri)
+
+SOURCES += \
+    $$PWD/admissioncontrol.cpp \
+    $$PWD/binarylog.cpp \
+    $$PWD/chatserver.cpp \
+    $$PWD/iothreadpool.cpp \
+    $$PWD/logwriter.cpp \
+    $$PWD/messagestorage.cpp \
+    $$PWD/metrics.cpp \
+    $$PWD/metricsserver.cpp \
+    $$PWD/offlinestore.cpp \
+    $$PWD/recentcache.cpp \
+    $$PWD/roomregistry.cpp \
+    $$PWD/searchindex.cpp \
+    $$PWD/serverlog.cpp \
+    $$PWD/serverworker.cpp \
+    $$PWD/threadpool.cpp \
+    $$PWD/tracer.cpp \
+    $$PWD/userindex.cpp
+
+HEADERS += \
+    $$PWD/admissioncontrol.h \
+    $$PWD/binarylog.h \
+    $$PWD/chatserver.h \
+    $$PWD/iothreadpool.h \
+    $$PWD/logwriter.h \
+    $$PWD/messagestorage.h \
+    $$PWD/metrics.h \
+    $$PWD/metricsserver.h \
+    $$PWD/mpscqueue.h \
+    $$PWD/offlinestore.h \
+    $$PWD/recentcache.h \
+    $$PWD/ringbuffer.h \
+    $$PWD/roomregistry.h \
+    $$PWD/searchindex.h \
+    $$PWD/serverlog.h \
+    $$PWD/serverworker.h \
+    $$PWD/threadpool.h \
+    $$PWD/timerwheel.h \
+    $$PWD/tracer.h \
+    $$PWD/userindex.h
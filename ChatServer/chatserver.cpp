@@ -1,8 +1,13 @@
 #include "chatserver.h"
 #include "serverworker.h"
+#include "serverlog.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "wireprotocol.h"
 #include <QJsonValue>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QJsonDocument>
 #include <QDateTime>
 #include <QHostAddress>
 
@@ -10,74 +15,953 @@ ChatServer::ChatServer(QObject *parent)
     : QTcpServer{parent}
 {
     m_threadPool = new ThreadPoolManager(this);
+    m_ioThreads = new IoThreadPool(0, this);
     m_messageStorage = new MessageStorage(this);
 
-    // 连接线程池相关的信号槽
-    connect(this, &ChatServer::broadcastMessage, this, &ChatServer::onBroadcastMessage);
-    connect(this, &ChatServer::handleNewConnection, this, &ChatServer::onHandleNewConnection);
+    // 路由阶段访问 m_clients 等状态，必须在本线程中执行
+    m_threadPool->setStageContext(ThreadPoolManager::RouteStage, this);
+
+    m_presenceTimer = new QTimer(this);
+    m_presenceTimer->setSingleShot(true);
+    m_presenceTimer->setInterval(50);
+    connect(m_presenceTimer, &QTimer::timeout, this, &ChatServer::flushPresence);
+
+    m_handshakeTimer = new QTimer(this);
+    m_handshakeTimer->setInterval(1000);
+    connect(m_handshakeTimer, &QTimer::timeout, this, &ChatServer::checkHandshakes);
+
+    m_acceptResumeTimer = new QTimer(this);
+    m_acceptResumeTimer->setSingleShot(true);
+    connect(m_acceptResumeTimer, &QTimer::timeout, this, [this]() {
+        m_acceptPaused = false;
+        resumeAccepting();
+        ServerLog::info("server", "恢复接入新连接");
+    });
+    connect(this, &QTcpServer::acceptError, this, &ChatServer::onAcceptError);
 }
 
 ChatServer::~ChatServer()
 {
-    // 清理所有客户端连接
-    for (ServerWorker *worker : m_clients) {
-        worker->deleteLater();
-    }
-    m_clients.clear();
+    close();
+    // I/O 线程在直接连接中调用 onFrameReceived/onWorkerDisconnected 提交任务，
+    // 先在各线程中断开这些连接，之后不会再有任务提交到即将销毁的线程池
+    m_ioThreads->disconnectReceiver(this);
 
+    // 再等待流水线中的任务结束，扇出和持久化阶段会用到 I/O 线程和存储
     if (m_threadPool) {
         delete m_threadPool;
     }
 
+    // 清理所有客户端连接，worker 在各自的 I/O 线程中销毁
+    m_clients.clear();
+    if (m_ioThreads) {
+        delete m_ioThreads;
+    }
+
     if (m_messageStorage) {
         delete m_messageStorage;
     }
 }
 
-void ChatServer::incomingConnection(qintptr socketDescriptor)
+bool ChatServer::setIoThreadCount(int count)
+{
+    if (!m_clients.isEmpty())
+        return false;
+
+    const IoThreadPool::Heartbeat heartbeat = m_ioThreads->heartbeat();
+    delete m_ioThreads;
+    m_ioThreads = new IoThreadPool(count, this);
+    m_ioThreads->setHeartbeat(heartbeat);
+    return true;
+}
+
+int ChatServer::ioThreadCount() const
 {
-    // 使用线程池处理新连接
-    m_threadPool->startConnectionTask(this, socketDescriptor);
-    emit logMessage("新的连接请求已放入线程池处理");
+    return m_ioThreads->threadCount();
 }
 
-void ChatServer::onHandleNewConnection(qintptr socketDescriptor)
+MessageStorage *ChatServer::messageStorage() const
 {
-    ServerWorker *worker = new ServerWorker(this);
-    if (!worker->setSocketDescriptor(socketDescriptor)) {
-        worker->deleteLater();
-        emit logMessage("设置套接字描述符失败");
+    return m_messageStorage;
+}
+
+QVector<ThreadPoolManager::StageStats> ChatServer::pipelineStats() const
+{
+    return m_threadPool->stats();
+}
+
+void ChatServer::setPresenceWindow(int ms)
+{
+    m_presenceTimer->setInterval(qMax(0, ms));
+}
+
+void ChatServer::presenceChanged(const QString &userName, bool online)
+{
+    // 窗口内同一用户先上线后下线（或相反）相互抵消
+    const auto it = m_pendingPresence.find(userName);
+    if (it != m_pendingPresence.end() && it.value() != online)
+        m_pendingPresence.erase(it);
+    else
+        m_pendingPresence.insert(userName, online);
+
+    if (!m_presenceTimer->isActive())
+        m_presenceTimer->start();
+}
+
+void ChatServer::flushPresence()
+{
+    if (m_pendingPresence.isEmpty())
         return;
+
+    QJsonArray joined;
+    QJsonArray left;
+    for (auto it = m_pendingPresence.constBegin(); it != m_pendingPresence.constEnd(); ++it)
+        (it.value() ? joined : left).append(it.key());
+    m_pendingPresence.clear();
+
+    QJsonObject delta;
+    delta["type"] = "presence";
+    delta["seq"] = qint64(++m_presenceSeq);
+    delta["joined"] = joined;
+    delta["left"] = left;
+    broadcast(delta, nullptr, EncodedFrames::PresenceDeltaClients);
+}
+
+void ChatServer::sendPresenceSnapshot(ServerWorker *worker)
+{
+    // 快照反映当前状态，包括尚未发出的增量；客户端按用户名幂等地应用之后的增量
+    QJsonArray users;
+    for (ServerWorker *client : std::as_const(m_clients)) {
+        const QString name = client->userName();
+        if (!name.isEmpty())
+            users.append(name);
     }
 
-    connect(worker, &ServerWorker::logMessage, this, &ChatServer::logMessage);
-    connect(worker, &ServerWorker::jsonReceived, this, &ChatServer::jsonReceived);
-    connect(worker, &ServerWorker::disconnectedFromClient, this, std::bind(&ChatServer::userDisconnected, this, worker));
-    m_clients.append(worker);
+    QJsonObject snapshot;
+    snapshot["type"] = "presence_snapshot";
+    snapshot["seq"] = qint64(m_presenceSeq);
+    snapshot["users"] = users;
+    sendTo(worker, snapshot);
+}
 
-    QString logMsg = QString("新的用户连接上了 (线程池活动线程: %1)").arg(m_threadPool->activeThreadCount());
-    emit logMessage(logMsg);
+void ChatServer::setOutboundLimits(const ServerWorker::OutboundLimits &limits)
+{
+    m_outboundLimits = limits;
 }
 
-void ChatServer::broadcast(const QJsonObject &message, ServerWorker *exclude)
+ServerWorker::OutboundLimits ChatServer::outboundLimits() const
 {
-    // 使用线程池处理广播
-    m_threadPool->startMessageTask(this, message, exclude);
+    return m_outboundLimits;
 }
 
-void ChatServer::onBroadcastMessage(const QJsonObject &message, ServerWorker *exclude)
+ChatServer::OutboundStats ChatServer::outboundStats() const
 {
-    // 在线程中执行实际的广播操作
+    OutboundStats stats;
+    stats.totalBytes = ServerWorker::totalOutboundBytes();
+    stats.droppedFrames = ServerWorker::totalDroppedFrames();
+    stats.evictions = ServerWorker::totalEvictions();
+    stats.clients.reserve(m_clients.size());
     for (ServerWorker *worker : m_clients) {
-        if (worker != exclude) {
-            worker->sendJson(message);
+        ClientOutbound client;
+        client.userName = worker->userName();
+        client.peerAddress = worker->peerAddress();
+        client.queuedBytes = worker->outboundBytes();
+        client.droppedFrames = worker->droppedFrames();
+        stats.clients.append(client);
+    }
+    return stats;
+}
+
+QString ChatServer::outboundSummary() const
+{
+    const OutboundStats stats = outboundStats();
+    qint64 largest = 0;
+    for (const ClientOutbound &client : stats.clients)
+        largest = qMax(largest, client.queuedBytes);
+    return QString("发送积压: 共 %1 字节, 单连接最大 %2 字节, 丢弃 %3 帧, 断开慢客户端 %4 个")
+        .arg(stats.totalBytes)
+        .arg(largest)
+        .arg(stats.droppedFrames)
+        .arg(stats.evictions);
+}
+
+bool ChatServer::startMetrics(const QHostAddress &address, quint16 port)
+{
+    delete m_metricsServer;
+    m_metricsServer = nullptr;
+    if (port == 0)
+        return true;
+
+    m_metricsServer = new MetricsServer([this]() { return metricsText(); }, this);
+    // 运行时开关追踪，/trace 导出各线程缓冲中的区间，可直接在 Perfetto 中打开
+    m_metricsServer->addRoute("/trace/start", "text/plain", []() {
+        Tracer::setEnabled(true);
+        return QByteArray("tracing on\n");
+    });
+    m_metricsServer->addRoute("/trace/stop", "text/plain", []() {
+        Tracer::setEnabled(false);
+        return QByteArray("tracing off\n");
+    });
+    m_metricsServer->addRoute("/trace", "application/json", []() { return Tracer::toJson(); });
+    if (!m_metricsServer->listen(address, port)) {
+        ServerLog::error("server", QString("指标端口 %1:%2 监听失败: %3")
+                                       .arg(address.toString())
+                                       .arg(port)
+                                       .arg(m_metricsServer->errorString()));
+        delete m_metricsServer;
+        m_metricsServer = nullptr;
+        return false;
+    }
+    return true;
+}
+
+QByteArray ChatServer::metricsText() const
+{
+    QByteArray out;
+    out.reserve(16 * 1024);
+    Metrics::render(out);
+
+    Metrics::writeHeader(out, "chat_connections", "gauge", "Open client connections");
+    Metrics::writeSample(out, "chat_connections", double(m_clients.size()));
+    Metrics::writeHeader(out, "chat_logged_in_users", "gauge", "Connections with a registered user name");
+    Metrics::writeSample(out, "chat_logged_in_users", m_userIndex.size());
+    Metrics::writeHeader(out, "chat_accept_queue", "gauge", "Accepted descriptors waiting for admission");
+    Metrics::writeSample(out, "chat_accept_queue", double(m_pendingDescriptors.size()));
+    Metrics::writeHeader(out, "chat_connections_limit", "gauge", "Maximum open client connections, 0 means unlimited");
+    Metrics::writeSample(out, "chat_connections_limit", double(m_admission.limits().maxConnections));
+    Metrics::writeHeader(out, "chat_rooms", "gauge", "Chat rooms with at least one member");
+    Metrics::writeSample(out, "chat_rooms", double(m_rooms.roomCount()));
+
+    // 流水线：深度是采样值，处理数和拒绝数是累计值
+    const QVector<ThreadPoolManager::StageStats> stages = m_threadPool->stats();
+    Metrics::writeHeader(out, "chat_pipeline_queue_depth", "gauge", "Jobs submitted but not finished, by stage");
+    for (const ThreadPoolManager::StageStats &stage : stages)
+        Metrics::writeSample(out, "chat_pipeline_queue_depth", stage.queueDepth, QByteArray("stage=\"") + stage.name.toUtf8() + '"');
+    Metrics::writeHeader(out, "chat_pipeline_queue_capacity", "gauge", "Queue capacity, by stage");
+    for (const ThreadPoolManager::StageStats &stage : stages)
+        Metrics::writeSample(out, "chat_pipeline_queue_capacity", stage.capacity, QByteArray("stage=\"") + stage.name.toUtf8() + '"');
+    Metrics::writeHeader(out, "chat_pipeline_processed_total", "counter", "Jobs finished, by stage");
+    for (const ThreadPoolManager::StageStats &stage : stages)
+        Metrics::writeSample(out, "chat_pipeline_processed_total", double(stage.processed), QByteArray("stage=\"") + stage.name.toUtf8() + '"');
+    Metrics::writeHeader(out, "chat_pipeline_rejected_total", "counter", "Jobs rejected because the queue was full, by stage");
+    for (const ThreadPoolManager::StageStats &stage : stages)
+        Metrics::writeSample(out, "chat_pipeline_rejected_total", double(stage.rejected), QByteArray("stage=\"") + stage.name.toUtf8() + '"');
+    Metrics::writeHeader(out, "chat_pipeline_active_threads", "gauge", "Busy worker threads in the pipeline pool");
+    Metrics::writeSample(out, "chat_pipeline_active_threads", m_threadPool->activeThreadCount());
+
+    const OutboundStats outbound = outboundStats();
+    qint64 largest = 0;
+    for (const ClientOutbound &client : outbound.clients)
+        largest = qMax(largest, client.queuedBytes);
+    Metrics::writeHeader(out, "chat_outbound_queued_bytes", "gauge", "Bytes waiting to be sent to all clients");
+    Metrics::writeSample(out, "chat_outbound_queued_bytes", double(outbound.totalBytes));
+    Metrics::writeHeader(out, "chat_outbound_queued_bytes_max", "gauge", "Largest per-connection send backlog");
+    Metrics::writeSample(out, "chat_outbound_queued_bytes_max", double(largest));
+    Metrics::writeHeader(out, "chat_outbound_dropped_frames_total", "counter", "Frames dropped or coalesced under backpressure");
+    Metrics::writeSample(out, "chat_outbound_dropped_frames_total", double(outbound.droppedFrames));
+    Metrics::writeHeader(out, "chat_slow_consumer_evictions_total", "counter", "Connections closed for falling behind");
+    Metrics::writeSample(out, "chat_slow_consumer_evictions_total", double(outbound.evictions));
+
+    const QVector<int> loads = m_ioThreads->loads();
+    Metrics::writeHeader(out, "chat_io_thread_connections", "gauge", "Connections owned by each I/O thread");
+    for (int i = 0; i < loads.size(); ++i)
+        Metrics::writeSample(out, "chat_io_thread_connections", loads.at(i), QByteArray("thread=\"") + QByteArray::number(i) + '"');
+
+    if (m_messageStorage) {
+        Metrics::writeHeader(out, "chat_storage_pending_records", "gauge", "Log records queued for the writer thread");
+        Metrics::writeSample(out, "chat_storage_pending_records", m_messageStorage->pendingWrites());
+
+        const RecentMessageCache::Stats recent = m_messageStorage->recentCacheStats();
+        Metrics::writeHeader(out, "chat_recent_cache_hits_total", "counter", "History first pages served from memory");
+        Metrics::writeSample(out, "chat_recent_cache_hits_total", double(recent.hits));
+        Metrics::writeHeader(out, "chat_recent_cache_misses_total", "counter", "History first pages read from disk");
+        Metrics::writeSample(out, "chat_recent_cache_misses_total", double(recent.misses));
+        Metrics::writeHeader(out, "chat_recent_cache_bytes", "gauge", "Memory held by the recent message cache");
+        Metrics::writeSample(out, "chat_recent_cache_bytes", double(recent.bytes));
+
+        SearchIndex &index = m_messageStorage->searchIndex();
+        Metrics::writeHeader(out, "chat_search_documents", "gauge", "Messages in the full-text index");
+        Metrics::writeSample(out, "chat_search_documents", double(index.documentCount()));
+        Metrics::writeHeader(out, "chat_search_segments", "gauge", "Immutable full-text index segments");
+        Metrics::writeSample(out, "chat_search_segments", index.segmentCount());
+    }
+    return out;
+}
+
+void ChatServer::setAdmissionLimits(const AdmissionControl::Limits &limits)
+{
+    m_admission.setLimits(limits);
+}
+
+AdmissionControl::Limits ChatServer::admissionLimits() const
+{
+    return m_admission.limits();
+}
+
+void ChatServer::setHeartbeat(int intervalMs, int maxMissed)
+{
+    IoThreadPool::Heartbeat heartbeat;
+    heartbeat.intervalMs = qMax(0, intervalMs);
+    heartbeat.maxMissed = maxMissed;
+    m_ioThreads->setHeartbeat(heartbeat);
+}
+
+void ChatServer::incomingConnection(qintptr socketDescriptor)
+{
+    // QTcpServer 在一次可读通知里会连续 accept 多个连接，这里只排队，
+    // 准入判断和创建 worker 放到下一轮事件循环分批进行
+    m_pendingDescriptors.append(socketDescriptor);
+    if (!m_drainScheduled) {
+        m_drainScheduled = true;
+        QMetaObject::invokeMethod(this, &ChatServer::drainAccepted, Qt::QueuedConnection);
+    }
+    // 积压过多时暂时不再 accept，剩下的连接留在内核的监听队列里
+    if (!m_acceptPaused && m_pendingDescriptors.size() >= 4 * m_admission.limits().acceptBatch) {
+        m_acceptPaused = true;
+        pauseAccepting();
+        Metrics::add(Metrics::AcceptPauses);
+    }
+}
+
+void ChatServer::drainAccepted()
+{
+    m_drainScheduled = false;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const int batch = qMin(m_pendingDescriptors.size(), m_admission.limits().acceptBatch);
+
+    for (int i = 0; i < batch; ++i) {
+        const qintptr descriptor = m_pendingDescriptors.at(i);
+        const QString ip = AdmissionControl::peerIp(descriptor);
+        const AdmissionControl::Decision decision = m_admission.admit(ip, m_clients.size(), now);
+        if (decision != AdmissionControl::Admitted) {
+            // 还没有创建任何对象，直接关闭描述符
+            AdmissionControl::closeDescriptor(descriptor);
+            Metrics::add(decision == AdmissionControl::RejectedFull ? Metrics::RejectedFull
+                         : decision == AdmissionControl::RejectedRate ? Metrics::RejectedRate
+                                                                      : Metrics::RejectedPerIp);
+            if (ServerLog::enabled(ServerLog::Debug))
+                ServerLog::debug("server", QString("拒绝连接 %1: %2").arg(ip, AdmissionControl::decisionName(decision)));
+            continue;
         }
+
+        ServerWorker *worker = onHandleNewConnection(descriptor);
+        m_clientIps.insert(worker, ip);
+        m_admission.trackHandshake(worker, worker->connectionId(), now);
+    }
+    m_pendingDescriptors.remove(0, batch);
+
+    if (m_admission.hasPendingHandshakes() && !m_handshakeTimer->isActive())
+        m_handshakeTimer->start();
+
+    if (!m_pendingDescriptors.isEmpty()) {
+        m_drainScheduled = true;
+        QMetaObject::invokeMethod(this, &ChatServer::drainAccepted, Qt::QueuedConnection);
+    } else if (m_acceptPaused && !m_acceptResumeTimer->isActive()) {
+        m_acceptPaused = false;
+        resumeAccepting();
     }
 }
 
+void ChatServer::checkHandshakes()
+{
+    for (const AdmissionControl::Handshake &handshake :
+         m_admission.expiredHandshakes(QDateTime::currentMSecsSinceEpoch())) {
+        // 连接可能早已断开，地址被新连接复用时编号不同
+        if (!m_clients.contains(handshake.worker) || handshake.worker->connectionId() != handshake.connectionId)
+            continue;
+        if (!handshake.worker->userName().isEmpty())
+            continue;
+        Metrics::add(Metrics::HandshakeTimeouts);
+        ServerLog::info("server", QString("%1 超时未登录，断开连接").arg(handshake.worker->peerAddress()));
+        IoThreadPool::disconnectWorker(handshake.worker);
+    }
+    if (!m_admission.hasPendingHandshakes())
+        m_handshakeTimer->stop();
+}
+
+void ChatServer::onAcceptError(QAbstractSocket::SocketError error)
+{
+    // 描述符耗尽时监听套接字会一直可读，继续 accept 只会空转，停一会再试
+    if (error != QAbstractSocket::SocketResourceError)
+        return;
+    if (!m_acceptPaused) {
+        m_acceptPaused = true;
+        pauseAccepting();
+        Metrics::add(Metrics::AcceptPauses);
+        ServerLog::warning("server", QString("接入失败 (%1)，暂停接入新连接").arg(errorString()));
+    }
+    m_acceptResumeTimer->start(200);
+}
+
+ServerWorker *ChatServer::onHandleNewConnection(qintptr socketDescriptor)
+{
+    // worker 没有父对象，迁移到 I/O 线程后由 IoThreadPool 负责销毁
+    ServerWorker *worker = new ServerWorker;
+    worker->setOutboundLimits(m_outboundLimits);
+
+    // 先建立连接再迁移，避免 I/O 线程中发出的信号丢失。
+    // 收到的帧和断开通知在 I/O 线程中直接送入流水线，由流水线保证顺序。
+    connect(worker, &ServerWorker::frameReceived, this, &ChatServer::onFrameReceived, Qt::DirectConnection);
+    connect(worker, &ServerWorker::disconnectedFromClient, this,
+            std::bind(&ChatServer::onWorkerDisconnected, this, worker), Qt::DirectConnection);
+    m_clients.insert(worker);
+    Metrics::add(Metrics::ConnectionsAccepted);
+
+    m_ioThreads->attach(worker, socketDescriptor);
+
+    ServerLog::info("server", QString("新的用户连接上了 (线程池活动线程: %1)").arg(m_threadPool->activeThreadCount()));
+    return worker;
+}
+
+void ChatServer::onFrameReceived(ServerWorker *sender, const QByteArray &frame)
+{
+    // 以 worker 为 key，保证同一连接的消息在各阶段按接收顺序处理
+    const quintptr key = quintptr(sender);
+    // 追踪开启时每帧一个编号，各阶段的区间都带上它
+    const quint64 traceId = Tracer::newId();
+    Tracer::Span span("receive", traceId);
+
+    const bool accepted = m_threadPool->submit(ThreadPoolManager::DecodeStage, key, [this, sender, key, frame, traceId]() {
+        Tracer::Span span("decode", traceId);
+        QJsonObject docObj;
+        if (WireProtocol::isBinary(frame)) {
+            if (!WireProtocol::decode(frame, &docObj)) {
+                Metrics::add(Metrics::ParseErrors);
+                ServerLog::warning("pipeline", "无法解析的二进制消息");
+                return;
+            }
+        } else {
+            QJsonParseError parseError;
+            const QJsonDocument jsonDoc = QJsonDocument::fromJson(frame, &parseError);
+            if (parseError.error != QJsonParseError::NoError || !jsonDoc.isObject()) {
+                Metrics::add(Metrics::ParseErrors);
+                ServerLog::warning("pipeline", QString("无法解析的消息: %1").arg(parseError.errorString()));
+                return;
+            }
+            docObj = jsonDoc.object();
+        }
+        // 每帧一条，只在调试级别下才转换
+        if (ServerLog::enabled(ServerLog::Debug))
+            ServerLog::debug("pipeline", QString::fromUtf8(QJsonDocument(docObj).toJson(QJsonDocument::Compact)));
+
+        const bool validating = m_threadPool->submit(ThreadPoolManager::ValidateStage, key,
+                                                     [this, sender, key, docObj, traceId]() {
+            Tracer::Span span("validate", traceId);
+            if (!validateMessage(docObj)) {
+                Metrics::add(Metrics::InvalidMessages);
+                ServerLog::warning("pipeline", "丢弃格式不正确的消息");
+                return;
+            }
+            const QString type = docObj.value("type").toString();
+            Metrics::messageIn(Metrics::messageType(type));
+            // 心跳回应只用来刷新 I/O 线程里的接收时间，收到时已经生效，不必再路由
+            if (type == QLatin1String("pong"))
+                return;
+            if (!m_threadPool->submit(ThreadPoolManager::RouteStage, key, [this, sender, docObj, traceId]() {
+                    Tracer::Span span("route", traceId);
+                    jsonReceived(sender, docObj);
+                })) {
+                Metrics::add(Metrics::DroppedRoute);
+                ServerLog::warning("pipeline", "路由队列已满，丢弃消息");
+            }
+        });
+        if (!validating) {
+            Metrics::add(Metrics::DroppedValidate);
+            ServerLog::warning("pipeline", "校验队列已满，丢弃消息");
+        }
+    });
+
+    if (!accepted) {
+        Metrics::add(Metrics::DroppedDecode);
+        ServerLog::warning("pipeline", "解码队列已满，丢弃消息");
+    }
+}
+
+void ChatServer::onWorkerDisconnected(ServerWorker *sender)
+{
+    // 断开通知与消息走同一条通道，确保该连接已提交的消息都路由完之后才移除
+    const quintptr key = quintptr(sender);
+    m_threadPool->submit(ThreadPoolManager::DecodeStage, key, [this, sender, key]() {
+        m_threadPool->submit(ThreadPoolManager::ValidateStage, key, [this, sender, key]() {
+            m_threadPool->submit(ThreadPoolManager::RouteStage, key, [this, sender]() {
+                userDisconnected(sender);
+            }, true);
+        }, true);
+    }, true);
+}
+
+bool ChatServer::validateMessage(const QJsonObject &docObj)
+{
+    const QJsonValue typeVal = docObj.value("type");
+    if (!typeVal.isString())
+        return false;
+
+    const QString type = typeVal.toString();
+    if (type.compare("message", Qt::CaseInsensitive) == 0
+        || type.compare("login", Qt::CaseInsensitive) == 0) {
+        return docObj.value("text").isString();
+    }
+    if (type.compare("private", Qt::CaseInsensitive) == 0) {
+        return docObj.value("text").isString()
+               && docObj.value("receiver").isString()
+               && docObj.value("sender").isString();
+    }
+    if (type.compare("search", Qt::CaseInsensitive) == 0)
+        return docObj.value("query").isString();
+    if (type.compare("room_message", Qt::CaseInsensitive) == 0)
+        return docObj.value("room").isString() && docObj.value("text").isString();
+    if (type.compare("join_room", Qt::CaseInsensitive) == 0
+        || type.compare("leave_room", Qt::CaseInsensitive) == 0
+        || type.compare("room_history", Qt::CaseInsensitive) == 0) {
+        return docObj.value("room").isString();
+    }
+    // 未知类型交给路由阶段忽略
+    return true;
+}
+
+void ChatServer::persist(std::function<void(MessageStorage*)> job)
+{
+    if (!m_messageStorage)
+        return;
+
+    // 持久化只有一个通道，保证日志文件中的顺序与路由顺序一致
+    MessageStorage *storage = m_messageStorage;
+    const quint64 traceId = Tracer::currentId();
+    if (!m_threadPool->submit(ThreadPoolManager::PersistStage, 0, [storage, job, traceId]() {
+            Tracer::Span span("persist", traceId);
+            job(storage);
+        })) {
+        Metrics::add(Metrics::DroppedPersist);
+        ServerLog::warning("pipeline", "持久化队列已满，消息未写入日志");
+    }
+}
+
+void ChatServer::broadcast(const QJsonObject &message, ServerWorker *exclude,
+                           EncodedFrames::Audience audience)
+{
+    // 扇出只有一个通道，所有客户端看到的广播顺序一致
+    const quint64 traceId = Tracer::currentId();
+    if (!m_threadPool->submit(ThreadPoolManager::FanOutStage, 0, [this, message, exclude, audience, traceId]() {
+            Tracer::Span span("fanout", traceId);
+            onBroadcastMessage(message, exclude, audience);
+        })) {
+        Metrics::add(Metrics::DroppedFanOut);
+        ServerLog::warning("pipeline", "扇出队列已满，丢弃广播");
+    }
+}
+
+void ChatServer::onBroadcastMessage(const QJsonObject &message, ServerWorker *exclude,
+                                    EncodedFrames::Audience audience)
+{
+    // 每种协议只序列化一次，所有接收者共享帧数据，由各 I/O 线程各自完成扇出
+    EncodedFrames frames = ServerWorker::encodeFrames(message);
+    frames.audience = audience;
+    m_ioThreads->broadcastFrame(frames, exclude);
+
+    if (ServerLog::enabled(ServerLog::Debug)) {
+        ServerLog::debug("fanout", QString("广播 %1 (%2 字节)")
+                                       .arg(message.value("type").toString())
+                                       .arg(frames.json.size()));
+    }
+}
+
+void ChatServer::sendTo(ServerWorker *worker, const QJsonObject &message)
+{
+    IoThreadPool::sendFrameTo(worker, ServerWorker::encodeFrames(message));
+}
+
+void ChatServer::sendError(ServerWorker *worker, const QString &text)
+{
+    QJsonObject errorMsg;
+    errorMsg["type"] = "error";
+    errorMsg["text"] = text;
+    sendTo(worker, errorMsg);
+}
+
+void ChatServer::multicast(const QString &room, const QJsonObject &message, const RoomRegistry::Members &members)
+{
+    if (members.isEmpty())
+        return;
+
+    // 同一房间走同一个扇出通道，不同房间可以并行，也不排在全局广播后面
+    const quintptr key = quintptr(qHash(room));
+    const quint64 traceId = Tracer::currentId();
+    if (!m_threadPool->submit(ThreadPoolManager::FanOutStage, key, [this, message, members, traceId]() {
+            Tracer::Span span("multicast", traceId);
+            m_ioThreads->multicastFrame(ServerWorker::encodeFrames(message), members);
+        })) {
+        Metrics::add(Metrics::DroppedFanOut);
+        ServerLog::warning("pipeline", QString("扇出队列已满，丢弃聊天室 %1 的消息").arg(room));
+    }
+}
+
+void ChatServer::roomMemberChanged(const QString &room, const QString &userName, bool joined)
+{
+    QJsonObject notice;
+    notice["type"] = "room_member";
+    notice["room"] = room;
+    notice["username"] = userName;
+    notice["joined"] = joined;
+    multicast(room, notice, m_rooms.members(room));
+}
+
+void ChatServer::roomRequestReceived(ServerWorker *sender, const QString &type, const QJsonObject &docObj)
+{
+    const QString userName = sender->userName();
+    if (userName.isEmpty()) {
+        sendError(sender, "请先登录");
+        return;
+    }
+
+    if (type == "list_rooms") {
+        QJsonArray rooms;
+        for (const RoomRegistry::RoomInfo &info : m_rooms.rooms()) {
+            QJsonObject room;
+            room["name"] = info.name;
+            room["members"] = info.members;
+            rooms.append(room);
+        }
+        QJsonObject reply;
+        reply["type"] = "room_list";
+        reply["rooms"] = rooms;
+        reply["joined"] = QJsonArray::fromStringList(m_rooms.roomsOf(sender));
+        sendTo(sender, reply);
+        return;
+    }
+
+    const QString room = docObj.value("room").toString().trimmed();
+    if (!RoomRegistry::isValidName(room)) {
+        sendError(sender, QString("无效的聊天室名称: %1").arg(room));
+        return;
+    }
+
+    if (type == "join_room") {
+        if (m_rooms.isMember(room, sender))
+            return;
+        if (m_rooms.roomsOf(sender).size() >= RoomRegistry::kMaxRoomsPerUser) {
+            sendError(sender, QString("最多同时加入 %1 个聊天室").arg(RoomRegistry::kMaxRoomsPerUser));
+            return;
+        }
+
+        // 先通知已有成员，再把新成员加入；回复中的成员列表包含自己
+        roomMemberChanged(room, userName, true);
+        m_rooms.join(room, m_ioThreads->recipientFor(sender));
+
+        QJsonArray members;
+        for (const IoThreadPool::Recipient &member : m_rooms.members(room))
+            members.append(member.worker->userName());
+        QJsonObject reply;
+        reply["type"] = "room_joined";
+        reply["room"] = room;
+        reply["members"] = members;
+        sendTo(sender, reply);
+        ServerLog::info("chat", QString("%1 加入聊天室 %2 (成员: %3)").arg(userName, room).arg(members.size()));
+
+    } else if (type == "leave_room") {
+        if (!m_rooms.leave(room, sender))
+            return;
+
+        QJsonObject reply;
+        reply["type"] = "room_left";
+        reply["room"] = room;
+        sendTo(sender, reply);
+        roomMemberChanged(room, userName, false);
+        ServerLog::info("chat", QString("%1 离开聊天室 %2").arg(userName, room));
+
+    } else if (type == "room_message") {
+        if (!m_rooms.isMember(room, sender)) {
+            sendError(sender, QString("请先加入聊天室 %1").arg(room));
+            return;
+        }
+        const QString text = docObj.value("text").toString().trimmed();
+        if (text.isEmpty())
+            return;
+
+        QJsonObject message;
+        message["type"] = "room_message";
+        message["room"] = room;
+        message["text"] = text;
+        message["sender"] = userName;
+        message["timestamp"] = QDateTime::currentDateTime().toString("hh:mm:ss");
+        multicast(room, message, m_rooms.members(room));
+
+        persist([room, userName, text](MessageStorage *storage) {
+            storage->saveRoomMessage(room, userName, text);
+        });
+        if (ServerLog::enabled(ServerLog::Debug))
+            ServerLog::debug("chat", QString("聊天室消息: [%1] %2 -> %3").arg(room, userName, text));
+
+    } else if (type == "room_history") {
+        if (!m_rooms.isMember(room, sender)) {
+            sendError(sender, QString("请先加入聊天室 %1").arg(room));
+            return;
+        }
+        const int limit = qBound(1, docObj.value("limit").toInt(50), 200);
+
+        // 与 history 请求一样走查询阶段，不占用持久化阶段的写入通道；发送时 worker 可能已断开，按接收者发送
+        const QVector<IoThreadPool::Recipient> recipient{m_ioThreads->recipientFor(sender)};
+        IoThreadPool *ioThreads = m_ioThreads;
+        MessageStorage *storage = m_messageStorage;
+        const quint64 traceId = Tracer::currentId();
+        const bool accepted = m_threadPool->submit(ThreadPoolManager::QueryStage, quintptr(sender),
+                                                   [storage, room, limit, recipient, ioThreads, traceId]() {
+            Tracer::Span span("history", traceId);
+            const QStringList history = storage->getRoomHistory(room, limit);
+            QJsonArray messages;
+            for (auto it = history.crbegin(); it != history.crend(); ++it)
+                messages.append(*it);   // 旧的在前，方便客户端按顺序显示
+
+            QJsonObject reply;
+            reply["type"] = "room_history";
+            reply["room"] = room;
+            reply["messages"] = messages;
+            ioThreads->multicastFrame(ServerWorker::encodeFrames(reply), recipient);
+        });
+        if (!accepted)
+            sendError(sender, "服务器繁忙，请稍后再查询历史记录");
+    }
+}
+
+void ChatServer::storeOffline(ServerWorker *sender, const QString &senderName,
+                              const QString &receiver, const QString &text)
+{
+    const QVector<IoThreadPool::Recipient> recipient{m_ioThreads->recipientFor(sender)};
+    IoThreadPool *ioThreads = m_ioThreads;
+    persist([senderName, receiver, text, recipient, ioThreads](MessageStorage *storage) {
+        storage->savePrivateMessage(senderName, receiver, text);
+        const OfflineStore::EnqueueResult result = storage->saveOfflineMessage(receiver, senderName, text);
+
+        QJsonObject notice;
+        notice["type"] = "error";
+        switch (result) {
+        case OfflineStore::UnknownRecipient:
+            notice["text"] = QString("用户 %1 不存在").arg(receiver);
+            break;
+        case OfflineStore::Rejected:
+            notice["text"] = QString("用户 %1 不在线").arg(receiver);
+            break;
+        default:
+            notice["text"] = QString("用户 %1 不在线，消息将在其上线后送达").arg(receiver);
+            break;
+        }
+        ioThreads->multicastFrame(ServerWorker::encodeFrames(notice), recipient);
+    });
+    ServerLog::info("chat", QString("离线私聊: %1 -> %2").arg(senderName, receiver));
+}
+
+void ChatServer::deliverOffline(ServerWorker *worker)
+{
+    // 排在持久化通道中，之前写入的离线消息一定已经入队；读文件不占用路由线程
+    const QString userName = worker->userName();
+    const IoThreadPool::Recipient recipient = m_ioThreads->recipientFor(worker);
+    IoThreadPool *ioThreads = m_ioThreads;
+    ChatServer *server = this;
+    persist([userName, recipient, ioThreads, server](MessageStorage *storage) {
+        storage->addOfflineUser(userName);
+        int records = 0;
+        const QVector<OfflineStore::Message> pending = storage->pendingOfflineMessages(userName, &records);
+        if (pending.isEmpty()) {
+            // 只剩过期的记录
+            storage->acknowledgeOfflineMessages(userName, records);
+            return;
+        }
+
+        // 通常整批只有一帧；积压很多时按大小切成若干帧，单帧不超过客户端的帧长上限
+        const qsizetype maxChunkBytes = 256 * 1024;
+        QVector<EncodedFrames> batches;
+        QJsonArray messages;
+        qsizetype chunkBytes = 0;
+        for (qsizetype i = 0; i < pending.size(); ++i) {
+            const OfflineStore::Message &message = pending.at(i);
+            QJsonObject item;
+            item["sender"] = message.sender;
+            item["text"] = message.text;
+            item["timestamp"] = QDateTime::fromMSecsSinceEpoch(message.timestampMs).toString("yyyy-MM-dd hh:mm:ss");
+            messages.append(item);
+            chunkBytes += message.sender.size() + message.text.size() * 3 + 48;
+
+            const bool last = i + 1 == pending.size();
+            if (!last && chunkBytes < maxChunkBytes)
+                continue;
+
+            QJsonObject batch;
+            batch["type"] = "offline_messages";
+            batch["messages"] = messages;
+            batch["remaining"] = qint64(pending.size() - i - 1);
+            batches.append(ServerWorker::encodeFrames(batch));
+            messages = QJsonArray();
+            chunkBytes = 0;
+        }
+
+        // 进入接收者的发送队列后才删除，连接已断开或发送时被积压策略丢弃的留到下次登录。
+        // 不等待 I/O 线程：投递结果经 ChatServer 线程放回持久化通道，与之后的入队按顺序执行。
+        // ChatServer 析构函数先停止 I/O 线程，之后才销毁 QObject 部分，done 中向 server 投递是安全的
+        const int count = int(pending.size());
+        ioThreads->deliverFrames(recipient, batches, [server, userName, records, count](bool delivered) {
+            QMetaObject::invokeMethod(server, [server, userName, records, count, delivered]() {
+                server->persist([userName, records, count, delivered](MessageStorage *storage) {
+                    if (!delivered) {
+                        storage->releaseOfflineMessages(userName);
+                        ServerLog::warning("chat", QString("%1 的 %2 条离线消息未能送出，下次登录重发")
+                                                       .arg(userName).arg(count));
+                        return;
+                    }
+                    storage->acknowledgeOfflineMessages(userName, records);
+                    ServerLog::info("chat", QString("已向 %1 投递 %2 条离线消息").arg(userName).arg(count));
+                });
+            }, Qt::QueuedConnection);
+        });
+    });
+}
+
+void ChatServer::historyRequested(ServerWorker *sender, const QJsonObject &docObj)
+{
+    const QString userName = sender->userName();
+    if (userName.isEmpty()) {
+        sendError(sender, "请先登录");
+        return;
+    }
+
+    // with 为私聊对象，room 为聊天室，都没有时查询公共聊天
+    MessageStorage::HistoryQuery query;
+    QJsonObject header;
+    header["type"] = "history";
+    if (docObj.contains("id"))
+        header["id"] = docObj.value("id");
+
+    const QString with = docObj.value("with").toString();
+    const QString room = docObj.value("room").toString();
+    if (!with.isEmpty()) {
+        query.conversation = MessageStorage::HistoryQuery::Private;
+        query.user1 = userName;
+        query.user2 = with;
+        header["with"] = with;
+    } else if (!room.isEmpty()) {
+        if (!m_rooms.isMember(room, sender)) {
+            sendError(sender, QString("请先加入聊天室 %1").arg(room));
+            return;
+        }
+        query.conversation = MessageStorage::HistoryQuery::Room;
+        query.room = room;
+        header["room"] = room;
+    }
+    query.cursor = docObj.value("cursor").toString();
+    query.beforeMs = docObj.value("before").toInteger();
+    query.limit = qBound(1, docObj.value("limit").toInt(50), int(MessageStorage::MaxHistoryPageSize));
+
+    // 查询阶段按连接分通道：同一客户端的翻页按顺序返回，不同客户端的查询并行，
+    // 与持久化阶段的写入通道完全分开，不会排在日志写入后面
+    const QVector<IoThreadPool::Recipient> recipient{m_ioThreads->recipientFor(sender)};
+    IoThreadPool *ioThreads = m_ioThreads;
+    MessageStorage *storage = m_messageStorage;
+    const quint64 traceId = Tracer::currentId();
+    const bool accepted = m_threadPool->submit(ThreadPoolManager::QueryStage, quintptr(sender),
+                                               [storage, query, header, recipient, ioThreads, traceId]() {
+        Tracer::Span span("history", traceId);
+        const MessageStorage::HistoryPage page = storage->getHistoryPage(query);
+
+        // 每块单独投递，I/O 线程可以在块之间处理其他连接的读写
+        const int chunkSize = 100;
+        const int total = int(page.lines.size());
+        int chunk = 0;
+        int end = total;   // 旧的在前发送：从列表尾部往前取
+        do {
+            const int begin = qMax(0, end - chunkSize);
+            QJsonArray messages;
+            for (int i = end - 1; i >= begin; --i)
+                messages.append(page.lines.at(i));
+
+            QJsonObject reply = header;
+            reply["messages"] = messages;
+            reply["chunk"] = chunk++;
+            reply["last"] = begin == 0;
+            reply["cursor"] = page.nextCursor;
+            ioThreads->multicastFrame(ServerWorker::encodeFrames(reply), recipient);
+            end = begin;
+        } while (end > 0);
+    });
+    if (!accepted)
+        sendError(sender, "服务器繁忙，请稍后再查询历史记录");
+}
+
+void ChatServer::searchRequested(ServerWorker *sender, const QJsonObject &docObj)
+{
+    const QString userName = sender->userName();
+    if (userName.isEmpty()) {
+        sendError(sender, "请先登录");
+        return;
+    }
+
+    const QString text = docObj.value("query").toString().trimmed();
+    if (SearchIndex::tokenize(text).isEmpty()) {
+        sendError(sender, "搜索内容不能为空");
+        return;
+    }
+    const int limit = qBound(1, docObj.value("limit").toInt(50), 200);
+    // before 为上一页最后一条结果的编号
+    const quint64 before = quint64(qMax<qint64>(0, docObj.value("before").toInteger()));
+
+    QJsonObject header;
+    header["type"] = "search_results";
+    header["query"] = text;
+    if (docObj.contains("id"))
+        header["id"] = docObj.value("id");
+
+    // 聊天室成员关系只在路由线程访问，这里取快照：只能搜到当前所在聊天室的消息
+    const QStringList joined = m_rooms.roomsOf(sender);
+    const QSet<QString> rooms(joined.cbegin(), joined.cend());
+
+    const QVector<IoThreadPool::Recipient> recipient{m_ioThreads->recipientFor(sender)};
+    IoThreadPool *ioThreads = m_ioThreads;
+    MessageStorage *storage = m_messageStorage;
+    const quint64 traceId = Tracer::currentId();
+    const bool accepted = m_threadPool->submit(ThreadPoolManager::QueryStage, quintptr(sender),
+                                               [storage, text, limit, before, userName, rooms,
+                                                header, recipient, ioThreads, traceId]() {
+        Tracer::Span span("search", traceId);
+        quint64 next = 0;
+        const QVector<SearchIndex::Hit> hits = storage->searchMessages(text, limit, before,
+            [&userName, &rooms](const SearchIndex::Document &document) {
+                switch (document.kind) {
+                case BinaryLog::PublicRecord:
+                    return true;
+                case BinaryLog::PrivateRecord:
+                    return document.sender == userName || document.target == userName;
+                case BinaryLog::RoomRecord:
+                    return rooms.contains(document.target);
+                default:
+                    return false;
+                }
+            }, &next);
+
+        static const char *const kinds[] = {"", "public", "private", "room"};
+        QJsonArray results;
+        for (const SearchIndex::Hit &hit : hits) {
+            QJsonObject result;
+            result["id"] = qint64(hit.docId);
+            result["timestamp"] = hit.document.timestampMs;
+            result["kind"] = hit.document.kind <= BinaryLog::RoomRecord ? kinds[hit.document.kind] : "";
+            result["sender"] = hit.document.sender;
+            if (!hit.document.target.isEmpty())
+                result["target"] = hit.document.target;
+            result["text"] = hit.document.text;
+            results.append(result);
+        }
+
+        QJsonObject reply = header;
+        reply["results"] = results;
+        // 凑满一页或单次扫描达到上限时还有更早的结果，此时本页可能不满
+        if (next > 0)
+            reply["next"] = qint64(next);
+        ioThreads->multicastFrame(ServerWorker::encodeFrames(reply), recipient);
+    });
+    if (!accepted)
+        sendError(sender, "服务器繁忙，请稍后再搜索");
+}
+
 void ChatServer::stopServer()
 {
-    emit logMessage("正在停止服务器...");
+    ServerLog::info("server", "正在停止服务器...");
 
     // 通知所有客户端服务器即将关闭
     QJsonObject shutdownMessage;
@@ -85,13 +969,29 @@ void ChatServer::stopServer()
     shutdownMessage["text"] = "服务器正在关闭";
     broadcast(shutdownMessage, nullptr);
 
-    // 关闭所有客户端连接
-    for (ServerWorker *worker : m_clients) {
-        worker->disconnectFromClient();
-    }
+    // 关闭所有客户端连接，排在关闭通知之后，保证客户端先收到通知
+    m_threadPool->submit(ThreadPoolManager::FanOutStage, 0, [this]() {
+        m_ioThreads->disconnectAll();
+    }, true);
 
     close();
-    emit logMessage("服务器已停止");
+    // 已 accept 但还没处理的连接直接关闭
+    for (qintptr descriptor : std::as_const(m_pendingDescriptors))
+        AdmissionControl::closeDescriptor(descriptor);
+    m_pendingDescriptors.clear();
+    m_acceptResumeTimer->stop();
+    m_acceptPaused = false;
+    ServerLog::info("server", "服务器已停止");
+    ServerLog::info("pipeline", m_threadPool->statsSummary());
+    ServerLog::info("io", outboundSummary());
+    if (m_messageStorage) {
+        const RecentMessageCache::Stats recent = m_messageStorage->recentCacheStats();
+        ServerLog::info("storage", QString("最近消息缓存: 命中 %1, 未命中 %2, 会话 %3 个, 占用 %4 字节")
+                                       .arg(recent.hits)
+                                       .arg(recent.misses)
+                                       .arg(recent.conversations)
+                                       .arg(recent.bytes));
+    }
 }
 
 // 在 jsonReceived 函数中添加私聊消息处理
@@ -120,46 +1020,37 @@ void ChatServer::jsonReceived(ServerWorker *sender, const QJsonObject &docObj)
         broadcast(message, nullptr);
 
         // 保存到本地存储
-        if (m_messageStorage) {
-            m_messageStorage->savePublicMessage(sender->userName(), text);
-        }
+        const QString senderName = sender->userName();
+        persist([senderName, text](MessageStorage *storage) {
+            storage->savePublicMessage(senderName, text);
+        });
 
         // 记录消息到日志
-        emit logMessage(QString("公共消息: %1 -> %2").arg(sender->userName()).arg(text));
+        ServerLog::info("chat", QString("公共消息: %1 -> %2").arg(senderName).arg(text));
 
     } else if (typeVal.toString().compare("private", Qt::CaseInsensitive) == 0) {
         // 私聊消息处理
         const QJsonValue textVal = docObj.value("text");
         const QJsonValue receiverVal = docObj.value("receiver");
-        const QJsonValue senderVal = docObj.value("sender");  // 添加sender字段检查
 
         if (textVal.isNull() || !textVal.isString() ||
-            receiverVal.isNull() || !receiverVal.isString() ||
-            senderVal.isNull() || !senderVal.isString())
+            receiverVal.isNull() || !receiverVal.isString())
             return;
 
         const QString text = textVal.toString().trimmed();
         const QString receiver = receiverVal.toString();
-        const QString senderName = senderVal.toString();  // 获取发送者名称
+        // 发送者以连接登录的用户名为准，不信任消息里的 sender 字段；未登录的连接不能发私聊
+        const QString senderName = sender->userName();
 
         if (text.isEmpty() || receiver.isEmpty() || senderName.isEmpty())
             return;
 
         // 查找接收者
-        ServerWorker *receiverWorker = nullptr;
-        for (ServerWorker *worker : m_clients) {
-            if (worker->userName() == receiver) {
-                receiverWorker = worker;
-                break;
-            }
-        }
+        ServerWorker *receiverWorker = m_userIndex.find(receiver);
 
         if (!receiverWorker) {
-            // 接收者不在线
-            QJsonObject errorMsg;
-            errorMsg["type"] = "error";
-            errorMsg["text"] = QString("用户 %1 不在线").arg(receiver);
-            sender->sendJson(errorMsg);
+            // 接收者不在线，存入离线队列，上线时再送达
+            storeOffline(sender, senderName, receiver, text);
             return;
         }
 
@@ -168,7 +1059,7 @@ void ChatServer::jsonReceived(ServerWorker *sender, const QJsonObject &docObj)
             QJsonObject errorMsg;
             errorMsg["type"] = "error";
             errorMsg["text"] = "不能给自己发私聊消息";
-            sender->sendJson(errorMsg);
+            sendTo(sender, errorMsg);
             return;
         }
 
@@ -176,26 +1067,25 @@ void ChatServer::jsonReceived(ServerWorker *sender, const QJsonObject &docObj)
         QJsonObject privateMessage;
         privateMessage["type"] = "private";
         privateMessage["text"] = text;
-        privateMessage["sender"] = senderName;      // 使用从消息中获取的发送者名称
+        privateMessage["sender"] = senderName;
         privateMessage["receiver"] = receiver;
         privateMessage["timestamp"] = QDateTime::currentDateTime().toString("hh:mm:ss");
 
-        // 发送给接收者
-        receiverWorker->sendJson(privateMessage);
-
-        // 同时发送给发送者（让发送者也能看到自己发的消息）
-        sender->sendJson(privateMessage);
+        // 发送给接收者，同时发送给发送者（让发送者也能看到自己发的消息），只编码一次
+        const EncodedFrames frames = ServerWorker::encodeFrames(privateMessage);
+        IoThreadPool::sendFrameTo(receiverWorker, frames);
+        IoThreadPool::sendFrameTo(sender, frames);
 
         // 保存到本地存储
-        if (m_messageStorage) {
-            m_messageStorage->savePrivateMessage(senderName, receiver, text);
-        }
+        persist([senderName, receiver, text](MessageStorage *storage) {
+            storage->savePrivateMessage(senderName, receiver, text);
+        });
 
         // 记录日志
-        emit logMessage(QString("私聊消息: %1 -> %2 : %3")
-                            .arg(senderName)
-                            .arg(receiver)
-                            .arg(text));
+        ServerLog::info("chat", QString("私聊消息: %1 -> %2 : %3")
+                                    .arg(senderName)
+                                    .arg(receiver)
+                                    .arg(text));
 
     } else if (typeVal.toString().compare("login", Qt::CaseInsensitive) == 0) {
         // 登录处理（原有代码）
@@ -203,20 +1093,70 @@ void ChatServer::jsonReceived(ServerWorker *sender, const QJsonObject &docObj)
         if (usernameVal.isNull() || !usernameVal.isString())
             return;
 
-        sender->setUserName(usernameVal.toString());
+        const QString newName = usernameVal.toString();
+        const QString oldName = sender->userName();
+        if (newName.isEmpty())
+            return;
+
+        // 在索引中登记，名字被其他连接占用时拒绝登录
+        const bool indexed = oldName.isEmpty()
+                                 ? m_userIndex.insert(newName, sender)
+                                 : m_userIndex.rename(oldName, newName, sender);
+        if (!indexed) {
+            QJsonObject errorMsg;
+            errorMsg["type"] = "error";
+            errorMsg["text"] = QString("用户名 %1 已被占用").arg(newName);
+            sendTo(sender, errorMsg);
+            Metrics::add(Metrics::LoginsRejected);
+            ServerLog::warning("server", QString("重复登录被拒绝: %1").arg(newName));
+            return;
+        }
+        Metrics::add(Metrics::LoginsAccepted);
 
-        // 保存登录日志
-        if (m_messageStorage) {
-            QString clientAddress = sender->peerAddress().toString();
-            m_messageStorage->saveLoginLog(sender->userName(), clientAddress, true);
+        // 同一连接改名，先通知其他人旧名字已下线
+        if (!oldName.isEmpty() && oldName != newName) {
+            QJsonObject renamedMessage;
+            renamedMessage["type"] = "userdisconnected";
+            renamedMessage["username"] = oldName;
+            broadcast(renamedMessage, nullptr, EncodedFrames::LegacyPresenceClients);
+            presenceChanged(oldName, false);
         }
 
+        sender->setUserName(newName);
+
+        // 登录请求带上 wire 字段的客户端支持二进制协议，之后发给它的帧都改用二进制
+        const int wireVersion = docObj.value("wire").toInt();
+        if (wireVersion > 0)
+            sender->setWireVersion(qMin(wireVersion, int(WireProtocol::Version)));
+        // 声明 presence 的客户端只接收快照和合并后的增量
+        const bool presenceDeltas = docObj.value("presence").toInt() > 0;
+        sender->setPresenceDeltas(presenceDeltas);
+        // 声明 heartbeat 的客户端会回应 ping，空闲时按心跳检查存活
+        sender->setHeartbeatEnabled(docObj.value("heartbeat").toInt() > 0);
+
+        // 保存登录日志
+        const QString loginName = sender->userName();
+        const QString clientAddress = sender->peerAddress();
+        persist([loginName, clientAddress](MessageStorage *storage) {
+            storage->saveLoginLog(loginName, clientAddress, true);
+        });
+        if (oldName != newName)
+            deliverOffline(sender);
+
         QJsonObject connectedMessage;
         connectedMessage["type"] = "newuser";
         connectedMessage["username"] = sender->userName();
 
-        // 广播给所有人，包括新登录用户自己
-        broadcast(connectedMessage, nullptr);
+        // 旧客户端逐条接收上线通知（包括新登录用户自己），新客户端在下一个增量中收到
+        broadcast(connectedMessage, nullptr, EncodedFrames::LegacyPresenceClients);
+        if (oldName != newName)
+            presenceChanged(newName, true);
+
+        if (presenceDeltas) {
+            sendPresenceSnapshot(sender);
+            ServerLog::info("server", QString("用户登录: %1 (在线用户: %2)").arg(sender->userName()).arg(m_clients.size()));
+            return;
+        }
 
         // send user list to new logined user
         QJsonObject userListMessage;
@@ -229,28 +1169,54 @@ void ChatServer::jsonReceived(ServerWorker *sender, const QJsonObject &docObj)
                 userlist.append(worker->userName());
         }
         userListMessage["userlist"] = userlist;
-        sender->sendJson(userListMessage);
+        sendTo(sender, userListMessage);
+
+        ServerLog::info("server", QString("用户登录: %1 (在线用户: %2)").arg(sender->userName()).arg(m_clients.size()));
 
-        emit logMessage(QString("用户登录: %1 (在线用户: %2)").arg(sender->userName()).arg(m_clients.size()));
+    } else if (typeVal.toString().compare("presence_sync", Qt::CaseInsensitive) == 0) {
+        // 客户端发现增量序号不连续时请求重新同步
+        if (!sender->userName().isEmpty() && sender->presenceDeltas())
+            sendPresenceSnapshot(sender);
+    } else {
+        const QString type = typeVal.toString().toLower();
+        if (type == "join_room" || type == "leave_room" || type == "list_rooms"
+            || type == "room_message" || type == "room_history") {
+            roomRequestReceived(sender, type, docObj);
+        } else if (type == "history") {
+            historyRequested(sender, docObj);
+        } else if (type == "search") {
+            searchRequested(sender, docObj);
+        }
     }
 }
 
 void ChatServer::userDisconnected(ServerWorker *sender)
 {
     // 保存登出日志
-    if (m_messageStorage && !sender->userName().isEmpty()) {
-        QString clientAddress = sender->peerAddress().toString();
-        m_messageStorage->saveLoginLog(sender->userName(), clientAddress, false);
+    if (!sender->userName().isEmpty()) {
+        const QString logoutName = sender->userName();
+        const QString clientAddress = sender->peerAddress();
+        persist([logoutName, clientAddress](MessageStorage *storage) {
+            storage->saveLoginLog(logoutName, clientAddress, false);
+        });
     }
 
-    m_clients.removeAll(sender);
+    m_clients.remove(sender);
+    m_admission.release(m_clientIps.take(sender));
+    Metrics::add(Metrics::ConnectionsClosed);
     const QString userName = sender->userName();
+    // 退出所有聊天室，之后的房间消息不再包含该连接
+    for (const QString &room : m_rooms.leaveAll(sender))
+        roomMemberChanged(room, userName, false);
     if (!userName.isEmpty()) {
+        m_userIndex.remove(userName, sender);
+
         QJsonObject disconnectedMessage;
         disconnectedMessage["type"] = "userdisconnected";
         disconnectedMessage["username"] = userName;
-        broadcast(disconnectedMessage, nullptr);
+        broadcast(disconnectedMessage, nullptr, EncodedFrames::LegacyPresenceClients);
+        presenceChanged(userName, false);
     }
-    emit logMessage(QString("%1 断开连接 (剩余用户: %2)").arg(userName).arg(m_clients.size()));
-    sender->deleteLater();
+    ServerLog::info("server", QString("%1 断开连接 (剩余用户: %2)").arg(userName).arg(m_clients.size()));
+    m_ioThreads->detach(sender);
 }
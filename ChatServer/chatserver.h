@@ -3,9 +3,17 @@
 
 #include <QObject>
 #include <QTcpServer>
+#include "admissioncontrol.h"
 #include "serverworker.h"
 #include "threadpool.h"
+#include "iothreadpool.h"
 #include "messagestorage.h"
+#include "userindex.h"
+#include "roomregistry.h"
+#include "metricsserver.h"
+#include <QSet>
+#include <QHash>
+#include <QTimer>
 
 class ChatServer : public QTcpServer
 {
@@ -14,31 +22,134 @@ public:
     explicit ChatServer(QObject *parent = nullptr);
     ~ChatServer();
 
+    // 设置 I/O 线程数（<= 0 表示使用 CPU 核心数），只能在没有客户端连接时调用
+    bool setIoThreadCount(int count);
+    int ioThreadCount() const;
+
+    MessageStorage *messageStorage() const;
+
+    // 流水线各阶段的队列深度和延迟
+    QVector<ThreadPoolManager::StageStats> pipelineStats() const;
+
+    // 在线状态增量的合并窗口（毫秒）
+    void setPresenceWindow(int ms);
+
+    // 对之后接入的连接生效
+    void setOutboundLimits(const ServerWorker::OutboundLimits &limits);
+    ServerWorker::OutboundLimits outboundLimits() const;
+
+    // 各连接的发送积压，只能在 ChatServer 所在线程调用
+    struct ClientOutbound {
+        QString userName;
+        QString peerAddress;
+        qint64 queuedBytes = 0;
+        quint64 droppedFrames = 0;
+    };
+    struct OutboundStats {
+        qint64 totalBytes = 0;
+        quint64 droppedFrames = 0;
+        quint64 evictions = 0;
+        QVector<ClientOutbound> clients;
+    };
+    OutboundStats outboundStats() const;
+    QString outboundSummary() const;
+
+    // 在 address:port 上提供 GET /metrics 以及追踪的开关和导出（/trace/start、/trace/stop、/trace），
+    // port 为 0 时关闭
+    bool startMetrics(const QHostAddress &address, quint16 port);
+
+    // 连接准入：总连接数、每个 IP 的新建速率和并发数、登录超时，以及每轮接入的批量
+    void setAdmissionLimits(const AdmissionControl::Limits &limits);
+    AdmissionControl::Limits admissionLimits() const;
+
+    // 空闲连接的应用层心跳，intervalMs 为 0 时关闭；连续 maxMissed 次没有回应的连接被断开，
+    // 随后像普通断开一样从用户表、聊天室和各 I/O 线程的广播列表中移除
+    void setHeartbeat(int intervalMs, int maxMissed);
+    // Prometheus 文本格式：计数器和直方图，加上抓取时采样的队列深度、积压和缓存状态。
+    // 只能在 ChatServer 所在线程调用
+    QByteArray metricsText() const;
+
 protected:
     void incomingConnection(qintptr socketDescriptor) override;
-    QVector<ServerWorker*> m_clients;
+    QSet<ServerWorker*> m_clients;
+
+    // 已登录用户名 -> worker，用于私聊路由和重复登录检测
+    UserIndex m_userIndex;
+
+    // 聊天室成员表，只在 ChatServer 所在线程（路由阶段）访问
+    RoomRegistry m_rooms;
 
     // 线程池管理器
     ThreadPoolManager* m_threadPool;
 
+    // 多反应器 I/O 线程，ServerWorker 分布在这些线程的事件循环中
+    IoThreadPool* m_ioThreads;
+
     // 消息存储
     MessageStorage* m_messageStorage;
 
-    void broadcast(const QJsonObject &message, ServerWorker *exclude);
+    ServerWorker::OutboundLimits m_outboundLimits;
+
+    MetricsServer *m_metricsServer = nullptr;
+
+    // 接入风暴时 incomingConnection 只把描述符排队，由 drainAccepted 每轮事件循环处理一批，
+    // 期间计时器、路由和断开通知照常执行。只在 ChatServer 所在线程访问
+    AdmissionControl m_admission;
+    QVector<qintptr> m_pendingDescriptors;
+    bool m_drainScheduled = false;
+    bool m_acceptPaused = false;
+    QHash<ServerWorker*, QString> m_clientIps;
+    QTimer *m_handshakeTimer;
+    QTimer *m_acceptResumeTimer;
+
+    void drainAccepted();
+    void checkHandshakes();
+    void onAcceptError(QAbstractSocket::SocketError error);
+
+    // 在线状态：登录时发送一次快照，之后只广播按窗口合并的上下线增量。
+    // 只在 ChatServer 所在线程（路由阶段）访问
+    quint64 m_presenceSeq = 0;
+    QHash<QString, bool> m_pendingPresence;   // 用户名 -> true 上线 / false 下线
+    QTimer *m_presenceTimer;
+
+    void presenceChanged(const QString &userName, bool online);
+    void flushPresence();
+    void sendPresenceSnapshot(ServerWorker *worker);
+
+    void broadcast(const QJsonObject &message, ServerWorker *exclude,
+                   EncodedFrames::Audience audience = EncodedFrames::Everyone);
+    // 在接收者所属的 I/O 线程中发送
+    void sendTo(ServerWorker *worker, const QJsonObject &message);
+    void sendError(ServerWorker *worker, const QString &text);
+
+    // 聊天室：成员快照交给扇出阶段，同一房间的消息按路由顺序送达
+    void multicast(const QString &room, const QJsonObject &message, const RoomRegistry::Members &members);
+    void roomRequestReceived(ServerWorker *sender, const QString &type, const QJsonObject &docObj);
+    void roomMemberChanged(const QString &room, const QString &userName, bool joined);
+
+    // 离线私聊：接收者不在线时写入其离线队列，登录时按批取出发送
+    void storeOffline(ServerWorker *sender, const QString &senderName, const QString &receiver, const QString &text);
+    void deliverOffline(ServerWorker *worker);
+
+    // 历史分页：在查询阶段读取，结果按块发送，不占用路由线程和 I/O 线程的事件循环
+    void historyRequested(ServerWorker *sender, const QJsonObject &docObj);
+    // 全文检索：同样在查询阶段读取索引，只返回发送者有权看到的消息
+    void searchRequested(ServerWorker *sender, const QJsonObject &docObj);
 
-signals:
-    void logMessage(const QString &msg);
-    // 用于线程池调用的信号
-    void broadcastMessage(const QJsonObject &message, ServerWorker *exclude);
-    void handleNewConnection(qintptr socketDescriptor);
+    // 流水线入口，在 worker 所属的 I/O 线程中直接调用
+    void onFrameReceived(ServerWorker *sender, const QByteArray &frame);
+    void onWorkerDisconnected(ServerWorker *sender);
+    static bool validateMessage(const QJsonObject &docObj);
+    void persist(std::function<void(MessageStorage*)> job);
 
 public slots:
     void stopServer();
     void jsonReceived(ServerWorker *sender, const QJsonObject &docObj);
     void userDisconnected(ServerWorker *sender);
-    // 线程池任务对应的槽函数
-    void onBroadcastMessage(const QJsonObject &message, ServerWorker *exclude);
-    void onHandleNewConnection(qintptr socketDescriptor);
+    // 扇出阶段在线程池中执行
+    void onBroadcastMessage(const QJsonObject &message, ServerWorker *exclude,
+                            EncodedFrames::Audience audience = EncodedFrames::Everyone);
+    ServerWorker *onHandleNewConnection(qintptr socketDescriptor);
 };
 
 #endif // CHATSERVER_H
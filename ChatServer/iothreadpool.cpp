@@ -0,0 +1,318 @@
+#include "iothreadpool.h"
+#include "serverworker.h"
+#include "serverlog.h"
+#include "metrics.h"
+#include "tracer.h"
+#include <QMetaObject>
+#include <QTimer>
+
+namespace {
+
+// 时间轮的刻度，心跳检查最多比截止时间晚一个刻度
+const int kHeartbeatTickMs = 250;
+
+qint64 steadyMs()
+{
+    return Metrics::nowNs() / 1000000;
+}
+
+// 向上取整，检查不会早于截止时间
+quint64 wheelTick(qint64 ms)
+{
+    return quint64(qMax<qint64>(0, ms) + kHeartbeatTickMs - 1) / kHeartbeatTickMs;
+}
+
+} // namespace
+
+IoThreadPool::IoThreadPool(int threadCount, QObject *parent)
+    : QObject(parent)
+{
+    if (threadCount <= 0)
+        threadCount = qMax(1, QThread::idealThreadCount());
+
+    for (int i = 0; i < threadCount; ++i) {
+        Reactor *reactor = new Reactor;
+        reactor->thread = new QThread;
+        reactor->thread->setObjectName(QString("io-%1").arg(i));
+        reactor->context = new QObject;
+        reactor->context->moveToThread(reactor->thread);
+        reactor->thread->start();
+        m_reactors.append(reactor);
+    }
+
+    ServerLog::info("io", QString("I/O 线程池已启动，线程数: %1").arg(threadCount));
+}
+
+IoThreadPool::~IoThreadPool()
+{
+    for (Reactor *reactor : m_reactors) {
+        // 在各自线程中销毁剩余的 worker，套接字必须在所属线程中关闭
+        QMetaObject::invokeMethod(reactor->context, [reactor]() {
+            delete reactor->heartbeatTimer;
+            reactor->heartbeatTimer = nullptr;
+            qDeleteAll(reactor->workers);
+            reactor->workers.clear();
+        }, Qt::BlockingQueuedConnection);
+
+        reactor->thread->quit();
+        reactor->thread->wait();
+        delete reactor->context;
+        delete reactor->thread;
+        delete reactor;
+    }
+    m_reactors.clear();
+    m_owner.clear();
+}
+
+int IoThreadPool::threadCount() const
+{
+    return m_reactors.size();
+}
+
+QVector<int> IoThreadPool::loads() const
+{
+    QVector<int> result;
+    result.reserve(m_reactors.size());
+    for (const Reactor *reactor : m_reactors)
+        result.append(reactor->load.load(std::memory_order_relaxed));
+    return result;
+}
+
+IoThreadPool::Reactor *IoThreadPool::leastLoaded()
+{
+    // 从轮询位置开始找负载最小的线程，负载相同时依次轮换
+    const int count = m_reactors.size();
+    Reactor *best = m_reactors.at(m_nextReactor % count);
+    for (int i = 1; i < count; ++i) {
+        Reactor *candidate = m_reactors.at((m_nextReactor + i) % count);
+        if (candidate->load.load(std::memory_order_relaxed) < best->load.load(std::memory_order_relaxed))
+            best = candidate;
+    }
+    m_nextReactor = (m_nextReactor + 1) % count;
+    return best;
+}
+
+void IoThreadPool::attach(ServerWorker *worker, qintptr socketDescriptor)
+{
+    Reactor *reactor = leastLoaded();
+    reactor->load.fetch_add(1, std::memory_order_relaxed);
+    m_owner.insert(worker, reactor);
+
+    // 套接字是 worker 的子对象，会随之一起迁移
+    worker->moveToThread(reactor->thread);
+
+    QMetaObject::invokeMethod(reactor->context, [reactor, worker, socketDescriptor]() {
+        reactor->workers.insert(worker);
+        if (!worker->setSocketDescriptor(socketDescriptor)) {
+            ServerLog::warning("io", "设置套接字描述符失败");
+            emit worker->disconnectedFromClient();
+            return;
+        }
+        if (reactor->heartbeat.intervalMs > 0) {
+            worker->enableKeepAlive(reactor->heartbeat.intervalMs, reactor->heartbeat.maxMissed);
+            scheduleHeartbeat(reactor, worker, steadyMs() + reactor->heartbeat.intervalMs);
+        }
+    }, Qt::QueuedConnection);
+}
+
+void IoThreadPool::detach(ServerWorker *worker)
+{
+    Reactor *reactor = m_owner.take(worker);
+    if (!reactor) {
+        worker->deleteLater();
+        return;
+    }
+
+    reactor->load.fetch_sub(1, std::memory_order_relaxed);
+    QMetaObject::invokeMethod(reactor->context, [reactor, worker]() {
+        reactor->workers.remove(worker);
+        delete worker;
+    }, Qt::QueuedConnection);
+}
+
+void IoThreadPool::broadcastFrame(const EncodedFrames &frames, ServerWorker *exclude)
+{
+    for (Reactor *reactor : m_reactors) {
+        if (reactor->load.load(std::memory_order_relaxed) == 0)
+            continue;
+
+        // 两种帧都隐式共享，每个线程只增加一次引用计数
+        QMetaObject::invokeMethod(reactor->context, [reactor, frames, exclude, traceId = Tracer::currentId()]() {
+            Tracer::Span span("deliver", traceId);
+            Metrics::ScopedTimer timer(Metrics::FanOutDelivery);
+            for (ServerWorker *worker : std::as_const(reactor->workers)) {
+                if (worker != exclude && worker->accepts(frames))
+                    worker->sendFrames(frames);
+            }
+        }, Qt::QueuedConnection);
+    }
+}
+
+IoThreadPool::Recipient IoThreadPool::recipientFor(ServerWorker *worker) const
+{
+    Recipient recipient;
+    recipient.worker = worker;
+    recipient.connectionId = worker->connectionId();
+    recipient.reactor = m_reactors.indexOf(m_owner.value(worker));
+    return recipient;
+}
+
+void IoThreadPool::multicastFrame(const EncodedFrames &frames, const QVector<Recipient> &recipients)
+{
+    QVector<QVector<Recipient>> groups(m_reactors.size());
+    for (const Recipient &recipient : recipients) {
+        if (recipient.reactor >= 0 && recipient.reactor < groups.size())
+            groups[recipient.reactor].append(recipient);
+    }
+
+    for (int i = 0; i < groups.size(); ++i) {
+        if (groups.at(i).isEmpty())
+            continue;
+
+        Reactor *reactor = m_reactors.at(i);
+        QMetaObject::invokeMethod(reactor->context, [reactor, frames, group = groups.at(i),
+                                                     traceId = Tracer::currentId()]() {
+            Tracer::Span span("deliver", traceId);
+            Metrics::ScopedTimer timer(Metrics::FanOutDelivery);
+            for (const Recipient &recipient : group) {
+                // 快照之后断开的连接已从 workers 中移除，编号不同说明地址被新连接复用
+                if (!reactor->workers.contains(recipient.worker)
+                    || recipient.worker->connectionId() != recipient.connectionId)
+                    continue;
+                if (recipient.worker->accepts(frames))
+                    recipient.worker->sendFrames(frames);
+            }
+        }, Qt::QueuedConnection);
+    }
+}
+
+void IoThreadPool::deliverFrames(const Recipient &recipient, const QVector<EncodedFrames> &frames,
+                                 std::function<void(bool)> done)
+{
+    if (recipient.reactor < 0 || recipient.reactor >= m_reactors.size()) {
+        done(false);
+        return;
+    }
+
+    Reactor *reactor = m_reactors.at(recipient.reactor);
+    QMetaObject::invokeMethod(reactor->context, [reactor, recipient, frames, done = std::move(done),
+                                                 traceId = Tracer::currentId()]() {
+        Tracer::Span span("deliver", traceId);
+        ServerWorker *worker = recipient.worker;
+        if (!reactor->workers.contains(worker) || worker->connectionId() != recipient.connectionId) {
+            done(false);
+            return;
+        }
+        const quint64 dropped = worker->droppedFrames();
+        for (const EncodedFrames &frame : frames) {
+            if (!worker->sendFrames(frame)) {
+                done(false);
+                return;
+            }
+        }
+        done(worker->droppedFrames() == dropped);
+    }, Qt::QueuedConnection);
+}
+
+void IoThreadPool::disconnectAll()
+{
+    for (Reactor *reactor : m_reactors) {
+        QMetaObject::invokeMethod(reactor->context, [reactor]() {
+            for (ServerWorker *worker : std::as_const(reactor->workers))
+                worker->disconnectFromClient();
+        }, Qt::QueuedConnection);
+    }
+}
+
+void IoThreadPool::disconnectReceiver(QObject *receiver)
+{
+    // 信号在 worker 所属线程中发出，在该线程里断开才能保证没有进行中的直接调用
+    for (Reactor *reactor : m_reactors) {
+        QMetaObject::invokeMethod(reactor->context, [reactor, receiver]() {
+            for (ServerWorker *worker : std::as_const(reactor->workers))
+                QObject::disconnect(worker, nullptr, receiver, nullptr);
+        }, Qt::BlockingQueuedConnection);
+    }
+}
+
+void IoThreadPool::sendFrameTo(ServerWorker *worker, const QByteArray &frame)
+{
+    QMetaObject::invokeMethod(worker, [worker, frame, traceId = Tracer::currentId()]() {
+        Tracer::Span span("send", traceId);
+        worker->sendFrame(frame);
+    }, Qt::AutoConnection);
+}
+
+void IoThreadPool::sendFrameTo(ServerWorker *worker, const EncodedFrames &frames)
+{
+    QMetaObject::invokeMethod(worker, [worker, frames, traceId = Tracer::currentId()]() {
+        Tracer::Span span("send", traceId);
+        worker->sendFrames(frames);
+    }, Qt::AutoConnection);
+}
+
+void IoThreadPool::disconnectWorker(ServerWorker *worker)
+{
+    QMetaObject::invokeMethod(worker, [worker]() {
+        worker->disconnectFromClient();
+    }, Qt::AutoConnection);
+}
+
+IoThreadPool::Heartbeat IoThreadPool::heartbeat() const
+{
+    return m_heartbeat;
+}
+
+void IoThreadPool::setHeartbeat(const Heartbeat &heartbeat)
+{
+    m_heartbeat = heartbeat;
+    m_heartbeat.maxMissed = qMax(1, m_heartbeat.maxMissed);
+
+    for (Reactor *reactor : m_reactors) {
+        QMetaObject::invokeMethod(reactor->context, [reactor, heartbeat = m_heartbeat]() {
+            const bool wasEnabled = reactor->heartbeat.intervalMs > 0;
+            reactor->heartbeat = heartbeat;
+            if (heartbeat.intervalMs <= 0) {
+                if (reactor->heartbeatTimer)
+                    reactor->heartbeatTimer->stop();
+                reactor->wheel = TimerWheel<HeartbeatEntry>();
+                return;
+            }
+            if (wasEnabled)
+                return;
+
+            // 从关闭变为开启：时间轮从当前时刻重新开始，登记已有的全部连接
+            const qint64 now = steadyMs();
+            reactor->wheel = TimerWheel<HeartbeatEntry>(wheelTick(now));
+            for (ServerWorker *worker : std::as_const(reactor->workers)) {
+                worker->enableKeepAlive(heartbeat.intervalMs, heartbeat.maxMissed);
+                scheduleHeartbeat(reactor, worker, now + heartbeat.intervalMs);
+            }
+            if (!reactor->heartbeatTimer) {
+                reactor->heartbeatTimer = new QTimer(reactor->context);
+                QObject::connect(reactor->heartbeatTimer, &QTimer::timeout, reactor->context,
+                                 [reactor]() { onHeartbeatTimer(reactor); });
+            }
+            reactor->heartbeatTimer->start(kHeartbeatTickMs);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void IoThreadPool::scheduleHeartbeat(Reactor *reactor, ServerWorker *worker, qint64 atMs)
+{
+    reactor->wheel.schedule(wheelTick(atMs), HeartbeatEntry{worker, worker->connectionId()});
+}
+
+void IoThreadPool::onHeartbeatTimer(Reactor *reactor)
+{
+    const qint64 now = steadyMs();
+    const Heartbeat heartbeat = reactor->heartbeat;
+    reactor->wheel.advance(wheelTick(now), [reactor, now, heartbeat](quint64, const HeartbeatEntry &entry) {
+        // 已断开的连接不再登记；编号不同说明地址被新连接复用，新连接有自己的登记
+        if (!reactor->workers.contains(entry.worker) || entry.worker->connectionId() != entry.connectionId)
+            return;
+        const qint64 next = entry.worker->checkHeartbeat(now, heartbeat.intervalMs, heartbeat.maxMissed);
+        if (next >= 0)
+            scheduleHeartbeat(reactor, entry.worker, next);
+    });
+}
@@ -0,0 +1,103 @@
+#ifndef IOTHREADPOOL_H
+#define IOTHREADPOOL_H
+
+#include <QObject>
+#include <QThread>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QByteArray>
+#include <atomic>
+#include <functional>
+#include "timerwheel.h"
+
+class QTimer;
+class ServerWorker;
+struct EncodedFrames;
+
+// 多反应器 I/O 线程池：每个线程运行自己的事件循环，负责一部分客户端套接字。
+// attach/detach/recipientFor 只能在 ChatServer 所在线程调用，
+// broadcastFrame/multicastFrame/disconnectAll 可在任意线程调用。
+class IoThreadPool : public QObject
+{
+    Q_OBJECT
+public:
+    // 组播的一个接收者。所属线程在 ChatServer 线程中确定，扇出时不需要访问 worker，
+    // 到达所属线程后再用连接编号确认 worker 仍然存在
+    struct Recipient {
+        ServerWorker *worker = nullptr;
+        quint64 connectionId = 0;
+        int reactor = -1;
+    };
+
+    // 空闲连接的心跳：intervalMs 为 0 时关闭
+    struct Heartbeat {
+        int intervalMs = 0;
+        int maxMissed = 3;
+    };
+
+    // threadCount <= 0 时使用 CPU 核心数
+    explicit IoThreadPool(int threadCount = 0, QObject *parent = nullptr);
+    ~IoThreadPool();
+
+    int threadCount() const;
+    QVector<int> loads() const;
+
+    // 选择负载最小的线程，把 worker 迁移过去并在该线程中绑定套接字
+    void attach(ServerWorker *worker, qintptr socketDescriptor);
+    // 从所属线程移除并在该线程中销毁 worker
+    void detach(ServerWorker *worker);
+
+    // 每个 I/O 线程只投递一次，由线程内部按各连接协商的协议完成扇出
+    void broadcastFrame(const EncodedFrames &frames, ServerWorker *exclude = nullptr);
+    Recipient recipientFor(ServerWorker *worker) const;
+    // 只发给指定的接收者，按所属线程分组，每个涉及的线程只投递一次
+    void multicastFrame(const EncodedFrames &frames, const QVector<Recipient> &recipients);
+    // 在接收者所属线程中依次发送，不等待结果。全部帧进入发送队列且期间没有帧因积压被丢弃时
+    // 以 true 调用 done，否则以 false 调用。done 在该 I/O 线程中执行（接收者无效时在调用线程中），
+    // 不能阻塞；线程池销毁时尚未执行的投递连同 done 一起丢弃
+    void deliverFrames(const Recipient &recipient, const QVector<EncodedFrames> &frames,
+                       std::function<void(bool)> done);
+    // 在每个 I/O 线程中断开其全部连接
+    void disconnectAll();
+    // 在每个 I/O 线程中断开 worker 到 receiver 的全部信号连接，返回时不会再有正在执行的调用
+    void disconnectReceiver(QObject *receiver);
+    // 在 worker 所属线程中发送单个帧
+    static void sendFrameTo(ServerWorker *worker, const QByteArray &frame);
+    static void sendFrameTo(ServerWorker *worker, const EncodedFrames &frames);
+    // 在 worker 所属线程中断开连接
+    static void disconnectWorker(ServerWorker *worker);
+
+    // 每个 I/O 线程用一个分层时间轮登记其全部连接的下一次心跳检查，只有一个计时器，
+    // 不随连接数增加。之后接入的连接和已有连接都按新设置检查
+    void setHeartbeat(const Heartbeat &heartbeat);
+    Heartbeat heartbeat() const;
+
+private:
+    struct HeartbeatEntry {
+        ServerWorker *worker = nullptr;
+        quint64 connectionId = 0;
+    };
+
+    struct Reactor {
+        QThread *thread = nullptr;
+        QObject *context = nullptr;       // 属于该线程，作为队列调用的目标
+        QSet<ServerWorker*> workers;      // 只在该线程中访问
+        std::atomic<int> load{0};
+        // 以下只在该线程中访问
+        Heartbeat heartbeat;
+        TimerWheel<HeartbeatEntry> wheel;
+        QTimer *heartbeatTimer = nullptr;
+    };
+
+    Reactor *leastLoaded();
+    static void scheduleHeartbeat(Reactor *reactor, ServerWorker *worker, qint64 atMs);
+    static void onHeartbeatTimer(Reactor *reactor);
+
+    QVector<Reactor*> m_reactors;
+    QHash<ServerWorker*, Reactor*> m_owner;   // 只在 ChatServer 线程中访问
+    int m_nextReactor = 0;
+    Heartbeat m_heartbeat;
+};
+
+#endif // IOTHREADPOOL_H
@@ -0,0 +1,479 @@
+#include "logwriter.h"
+#include "binarylog.h"
+#include "metrics.h"
+#include "serverlog.h"
+#include "tracer.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QRegularExpression>
+#include <algorithm>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#elif defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kManifestName[] = "manifest.json";
+
+QString segmentFileName(LogWriter::Target target, const QDate &date, int sequence)
+{
+    QString name = LogWriter::targetPrefix(target) + date.toString("yyyy-MM-dd");
+    if (sequence > 0)
+        name += "." + QString::number(sequence);
+    return name + LogWriter::targetSuffix(target);
+}
+
+const char *targetKey(int target)
+{
+    static const char *keys[LogWriter::TargetCount] = {
+        "public", "private", "login", "public_segment", "private_segment", "room", "room_segment"
+    };
+    return keys[target];
+}
+
+} // namespace
+
+LogWriter::LogWriter(QObject *parent)
+    : QThread(parent)
+{
+    setObjectName("log-writer");
+}
+
+LogWriter::~LogWriter()
+{
+    stop();
+}
+
+void LogWriter::setDirectory(const QString &directory)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_directory == directory)
+        return;
+
+    m_directory = directory;
+    ++m_directoryGeneration;
+    loadManifestLocked();
+}
+
+void LogWriter::setMaxSegmentBytes(qint64 bytes)
+{
+    m_maxSegmentBytes.store(qMax<qint64>(0, bytes), std::memory_order_relaxed);
+}
+
+QString LogWriter::targetPrefix(Target target)
+{
+    switch (target) {
+    case PublicLog:
+    case PublicSegment:  return "public_";
+    case PrivateLog:
+    case PrivateSegment: return "private_";
+    case LoginLog:       return "login_";
+    case RoomLog:
+    case RoomSegment:    return "room_";
+    default:             return QString();
+    }
+}
+
+QString LogWriter::targetSuffix(Target target)
+{
+    return (target == PublicSegment || target == PrivateSegment || target == RoomSegment) ? ".seg" : ".log";
+}
+
+QStringList LogWriter::segmentPaths(Target target, const QDate &since) const
+{
+    QMutexLocker locker(&m_mutex);
+    QDir dir(m_directory);
+    QStringList paths;
+    // m_segments 按（日期, 序号）升序排列
+    for (auto it = m_segments.crbegin(); it != m_segments.crend(); ++it) {
+        if (it->target != target)
+            continue;
+        if (since.isValid() && it->date < since)
+            break;
+        paths.append(dir.filePath(it->fileName));
+    }
+    return paths;
+}
+
+void LogWriter::loadManifestLocked()
+{
+    m_segments.clear();
+
+    QFile manifest(QDir(m_directory).filePath(kManifestName));
+    if (manifest.open(QIODevice::ReadOnly)) {
+        const QJsonArray entries = QJsonDocument::fromJson(manifest.readAll()).object().value("segments").toArray();
+        for (const QJsonValue &value : entries) {
+            const QJsonObject entry = value.toObject();
+            const QString key = entry.value("target").toString();
+            for (int i = 0; i < TargetCount; ++i) {
+                if (key == QLatin1String(targetKey(i))) {
+                    Segment segment;
+                    segment.target = Target(i);
+                    segment.fileName = entry.value("file").toString();
+                    segment.date = QDate::fromString(entry.value("date").toString(), "yyyy-MM-dd");
+                    segment.sequence = entry.value("seq").toInt();
+                    if (!segment.fileName.isEmpty() && segment.date.isValid())
+                        m_segments.append(segment);
+                    break;
+                }
+            }
+        }
+    } else {
+        // 没有清单时（旧版本留下的目录）从文件名重建
+        static const QRegularExpression pattern("^(public|private|login|room)_(\\d{4}-\\d{2}-\\d{2})(?:\\.(\\d+))?\\.(log|seg)$");
+        const QStringList names = QDir(m_directory).entryList(QDir::Files);
+        for (const QString &name : names) {
+            const QRegularExpressionMatch match = pattern.match(name);
+            if (!match.hasMatch())
+                continue;
+
+            const QString kind = match.captured(1);
+            const bool binary = match.captured(4) == "seg";
+            Segment segment;
+            if (kind == "login") {
+                if (binary)
+                    continue;
+                segment.target = LoginLog;
+            } else if (kind == "public") {
+                segment.target = binary ? PublicSegment : PublicLog;
+            } else if (kind == "room") {
+                segment.target = binary ? RoomSegment : RoomLog;
+            } else {
+                segment.target = binary ? PrivateSegment : PrivateLog;
+            }
+            segment.fileName = name;
+            segment.date = QDate::fromString(match.captured(2), "yyyy-MM-dd");
+            segment.sequence = match.captured(3).toInt();
+            m_segments.append(segment);
+        }
+        if (!m_segments.isEmpty())
+            saveManifestLocked();
+    }
+
+    std::sort(m_segments.begin(), m_segments.end(), [](const Segment &a, const Segment &b) {
+        return a.date != b.date ? a.date < b.date : a.sequence < b.sequence;
+    });
+}
+
+void LogWriter::saveManifestLocked() const
+{
+    QJsonArray entries;
+    for (const Segment &segment : m_segments) {
+        QJsonObject entry;
+        entry["target"] = QString::fromLatin1(targetKey(segment.target));
+        entry["file"] = segment.fileName;
+        entry["date"] = segment.date.toString("yyyy-MM-dd");
+        entry["seq"] = segment.sequence;
+        entries.append(entry);
+    }
+    QJsonObject root;
+    root["segments"] = entries;
+
+    // QSaveFile 先写临时文件再原子替换，读取方不会看到写了一半的清单
+    QSaveFile manifest(QDir(m_directory).filePath(kManifestName));
+    if (!manifest.open(QIODevice::WriteOnly)
+        || manifest.write(QJsonDocument(root).toJson()) < 0
+        || !manifest.commit()) {
+        ServerLog::warning("storage", QString("无法写入段清单: %1").arg(manifest.fileName()));
+    }
+}
+
+int LogWriter::latestSequenceLocked(Target target, const QDate &date) const
+{
+    int latest = -1;
+    for (const Segment &segment : m_segments) {
+        if (segment.target == target && segment.date == date)
+            latest = qMax(latest, segment.sequence);
+    }
+    return latest;
+}
+
+void LogWriter::setFileHeader(Target target, const QByteArray &header)
+{
+    QMutexLocker locker(&m_mutex);
+    m_headers[target] = header;
+}
+
+void LogWriter::setDurability(Durability durability)
+{
+    m_durability.store(durability, std::memory_order_relaxed);
+}
+
+LogWriter::Durability LogWriter::durability() const
+{
+    return Durability(m_durability.load(std::memory_order_relaxed));
+}
+
+void LogWriter::setBatchLimits(int maxRecords, int maxDelayMs)
+{
+    m_maxBatchRecords.store(qMax(1, maxRecords), std::memory_order_relaxed);
+    m_maxBatchDelayMs.store(qMax(0, maxDelayMs), std::memory_order_relaxed);
+}
+
+void LogWriter::append(Target target, const QByteArray &line)
+{
+    m_queue.push(Record{target, line});
+    m_appended.fetch_add(1, std::memory_order_release);
+
+    // 只在队列从空变为非空、或刚好攒满一批时唤醒，其余情况由写入线程自行超时提交
+    const int pending = m_pending.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if (pending == 1 || pending == m_maxBatchRecords.load(std::memory_order_relaxed))
+        wakeWriter();
+}
+
+int LogWriter::pendingRecords() const
+{
+    return m_pending.load(std::memory_order_relaxed);
+}
+
+void LogWriter::wakeWriter()
+{
+    QMutexLocker locker(&m_mutex);
+    m_wake.wakeOne();
+}
+
+void LogWriter::sync()
+{
+    const quint64 target = m_appended.load(std::memory_order_acquire);
+
+    QMutexLocker locker(&m_mutex);
+    if (m_committed >= target || !isRunning())
+        return;
+
+    ++m_syncWaiters;
+    m_wake.wakeOne();
+    while (m_committed < target && isRunning())
+        m_committedCond.wait(&m_mutex, 100);
+    --m_syncWaiters;
+}
+
+void LogWriter::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wake.wakeOne();
+    }
+    wait();
+}
+
+void LogWriter::run()
+{
+    forever {
+        bool forceFlush = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (m_pending.load(std::memory_order_acquire) == 0 && !m_stopping && m_syncWaiters == 0)
+                m_wake.wait(&m_mutex);
+
+            // 攒批：未达到条数阈值时最多再等 maxDelay 毫秒
+            if (!m_stopping && m_syncWaiters == 0
+                && m_pending.load(std::memory_order_acquire) < m_maxBatchRecords.load(std::memory_order_relaxed)) {
+                m_wake.wait(&m_mutex, m_maxBatchDelayMs.load(std::memory_order_relaxed));
+            }
+            forceFlush = m_stopping || m_syncWaiters > 0;
+        }
+
+        closeAllIfDirectoryChanged();
+        const int committed = commitBatch(forceFlush);
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_committed += quint64(committed);
+            m_committedCond.wakeAll();
+            if (m_stopping && m_pending.load(std::memory_order_acquire) == 0)
+                break;
+        }
+    }
+
+    for (int i = 0; i < TargetCount; ++i)
+        closeFile(i);
+}
+
+void LogWriter::closeAllIfDirectoryChanged()
+{
+    int generation = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        generation = m_directoryGeneration;
+    }
+    if (generation == m_openGeneration)
+        return;
+
+    for (int i = 0; i < TargetCount; ++i) {
+        closeFile(i);
+        m_openDates[i] = QDate();
+        m_openSequences[i] = 0;
+    }
+    m_openGeneration = generation;
+}
+
+void LogWriter::closeFile(int target)
+{
+    QFile &file = m_files[target];
+    if (!file.isOpen())
+        return;
+
+    file.flush();
+    if (durability() == FsyncPerBatch)
+        syncFileData(file);
+    file.close();
+}
+
+void LogWriter::rotateIfNeeded(int target, const QDate &today)
+{
+    if (!m_files[target].isOpen())
+        return;
+
+    const qint64 maxBytes = m_maxSegmentBytes.load(std::memory_order_relaxed);
+    const bool dateChanged = m_openDates[target] != today;
+    const bool sizeExceeded = maxBytes > 0 && m_openBytes[target] >= maxBytes;
+    if (!dateChanged && !sizeExceeded)
+        return;
+
+    // 只有写入线程持有文件，关闭旧段后下一次 ensureOpen 打开新段即完成交接
+    closeFile(target);
+    if (!dateChanged) {
+        m_openDates[target] = today;
+        ++m_openSequences[target];
+    }
+    ensureOpen(target, today);
+}
+
+void LogWriter::syncFileData(QFile &file)
+{
+#if defined(Q_OS_WIN)
+    _commit(file.handle());
+#elif defined(Q_OS_MACOS)
+    ::fsync(file.handle());
+#elif defined(Q_OS_UNIX)
+    ::fdatasync(file.handle());
+#else
+    Q_UNUSED(file);
+#endif
+}
+
+bool LogWriter::ensureOpen(int target, const QDate &today)
+{
+    QFile &file = m_files[target];
+    if (file.isOpen())
+        return true;
+
+    QString directory;
+    QByteArray header;
+    int sequence = 0;
+    bool isNewSegment = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_directory.isEmpty())
+            return false;
+        directory = m_directory;
+        header = m_headers[target];
+
+        // 同一天已有段时接着写最新的那个；轮转时序号已经递增
+        const int latest = latestSequenceLocked(Target(target), today);
+        if (m_openDates[target] == today && m_openSequences[target] > latest) {
+            sequence = m_openSequences[target];
+        } else {
+            sequence = qMax(0, latest);
+        }
+        isNewSegment = sequence > latest;
+
+        if (isNewSegment) {
+            Segment segment;
+            segment.target = Target(target);
+            segment.fileName = segmentFileName(Target(target), today, sequence);
+            segment.date = today;
+            segment.sequence = sequence;
+            m_segments.append(segment);
+            saveManifestLocked();
+        }
+    }
+
+    QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Append;
+    if (header.isEmpty())
+        mode |= QIODevice::Text;
+
+    const QString path = QDir(directory).filePath(segmentFileName(Target(target), today, sequence));
+    if (!header.isEmpty() && QFile::exists(path)) {
+        // 崩溃时段尾可能留下半条记录，接着追加会把新记录藏在它后面，先截到最后一条完整记录
+        const qint64 validSize = BinaryLog::validSegmentSize(path);
+        if (validSize >= 0 && validSize < QFileInfo(path).size()) {
+            ServerLog::warning("storage", QString("段文件末尾有不完整的记录，已截断: %1").arg(path));
+            QFile::resize(path, validSize);
+        }
+    }
+    file.setFileName(path);
+    if (!file.open(mode)) {
+        ServerLog::warning("storage", QString("无法打开日志文件: %1").arg(path));
+        return false;
+    }
+    if (!header.isEmpty() && file.size() == 0)
+        file.write(header);
+
+    m_openDates[target] = today;
+    m_openSequences[target] = sequence;
+    m_openBytes[target] = file.size();
+    return true;
+}
+
+int LogWriter::commitBatch(bool forceFlush)
+{
+    // 一批最多取出若干条，避免生产者持续写入时一直不提交
+    const int limit = qMax(1, m_maxBatchRecords.load(std::memory_order_relaxed)) * 4;
+    QByteArray buffers[TargetCount];
+
+    int count = 0;
+    Record record;
+    while (count < limit && m_queue.pop(record)) {
+        buffers[record.target].append(record.data);
+        ++count;
+    }
+    if (count == 0 && !forceFlush)
+        return 0;
+    m_pending.fetch_sub(count, std::memory_order_acq_rel);
+    const qint64 startNs = Metrics::nowNs();
+    Tracer::Span span("storage_write", 0);
+
+    // 每批只取一次当前日期，轮转检查不落在单条消息上
+    const QDate today = QDate::currentDate();
+    const Durability mode = durability();
+    for (int i = 0; i < TargetCount; ++i) {
+        QFile &file = m_files[i];
+        if (!buffers[i].isEmpty()) {
+            rotateIfNeeded(i, today);
+            ensureOpen(i, today);
+        }
+        if (!file.isOpen())
+            continue;
+
+        if (!buffers[i].isEmpty()) {
+            const qint64 written = file.write(buffers[i]);
+            if (written != buffers[i].size())
+                ServerLog::warning("storage", QString("写入日志文件失败: %1 %2")
+                                                  .arg(file.fileName(), file.errorString()));
+            m_openBytes[i] += qMax<qint64>(0, written);
+        }
+
+        if (buffers[i].isEmpty() && !forceFlush)
+            continue;
+        if (mode != NoSync || forceFlush)
+            file.flush();
+        if (mode == FsyncPerBatch && !buffers[i].isEmpty())
+            syncFileData(file);
+    }
+
+    if (count > 0) {
+        Metrics::observe(Metrics::StorageWrite, Metrics::nowNs() - startNs);
+        Metrics::add(Metrics::StorageRecords, quint64(count));
+        Metrics::add(Metrics::StorageBatches);
+    }
+    return count;
+}
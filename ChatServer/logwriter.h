@@ -0,0 +1,128 @@
+#ifndef LOGWRITER_H
+#define LOGWRITER_H
+
+#include <QThread>
+#include <QFile>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QDate>
+#include <QVector>
+#include <atomic>
+#include "mpscqueue.h"
+
+// 异步日志写入线程：生产者无锁入队，写入线程按条数或时间阈值批量提交。
+// 文件按日期（以及可选的大小上限）轮转，轮转只在写入线程的批次边界上检查，
+// 不增加每条消息的开销。所有段文件记录在存储目录的 manifest.json 中。
+class LogWriter : public QThread
+{
+    Q_OBJECT
+public:
+    enum Durability {
+        NoSync,          // 只写入用户态缓冲，由缓冲区满或关闭时落盘
+        FlushPerBatch,   // 每批刷到内核
+        FsyncPerBatch    // 每批刷到内核并 fdatasync
+    };
+
+    enum Target {
+        PublicLog,
+        PrivateLog,
+        LoginLog,
+        PublicSegment,    // 二进制段文件
+        PrivateSegment,
+        RoomLog,          // 所有聊天室共用，每行带房间名
+        RoomSegment,
+        TargetCount
+    };
+
+    // 一个已创建的段文件，文件名形如 public_2024-01-01.log、public_2024-01-01.2.log
+    struct Segment {
+        Target target = PublicLog;
+        QString fileName;      // 相对存储目录
+        QDate date;
+        int sequence = 0;
+    };
+
+    explicit LogWriter(QObject *parent = nullptr);
+    ~LogWriter();
+
+    // 切换存储目录并载入（或重建）该目录的段清单
+    void setDirectory(const QString &directory);
+    // 设置了文件头的目标按 BinaryLog 段格式打开，新建文件时先写入文件头，
+    // 重新打开已有的段时先截掉末尾不完整的记录
+    void setFileHeader(Target target, const QByteArray &header);
+    // 单个段文件的大小上限，0 表示只按日期轮转
+    void setMaxSegmentBytes(qint64 bytes);
+    void setDurability(Durability durability);
+    Durability durability() const;
+    // maxRecords 条或 maxDelayMs 毫秒，先到者触发一次提交
+    void setBatchLimits(int maxRecords, int maxDelayMs);
+
+    // 任意线程调用，只做一次无锁入队，不涉及磁盘 I/O
+    void append(Target target, const QByteArray &line);
+    // 阻塞到此前入队的记录都已写入文件并刷到内核，供读取历史前调用
+    void sync();
+    // 写完剩余记录后退出线程
+    void stop();
+    // 已入队但尚未提交的记录数，可在任意线程读取
+    int pendingRecords() const;
+
+    // 某个目标的段文件完整路径，从新到旧；since 有效时只返回该日期及之后的段
+    QStringList segmentPaths(Target target, const QDate &since = QDate()) const;
+
+    static QString targetPrefix(Target target);
+    static QString targetSuffix(Target target);
+    // 把已刷到内核的文件数据落到磁盘（fdatasync）
+    static void syncFileData(QFile &file);
+
+protected:
+    void run() override;
+
+private:
+    struct Record {
+        int target = 0;
+        QByteArray data;
+    };
+
+    int commitBatch(bool forceFlush);
+    void closeAllIfDirectoryChanged();
+    bool ensureOpen(int target, const QDate &today);
+    void rotateIfNeeded(int target, const QDate &today);
+    void closeFile(int target);
+    void wakeWriter();
+
+    // 以下三个函数要求调用方持有 m_mutex
+    void loadManifestLocked();
+    void saveManifestLocked() const;
+    int latestSequenceLocked(Target target, const QDate &date) const;
+
+    MpscQueue<Record> m_queue;
+    std::atomic<int> m_pending{0};
+    std::atomic<quint64> m_appended{0};
+    std::atomic<int> m_durability{FlushPerBatch};
+    std::atomic<int> m_maxBatchRecords{256};
+    std::atomic<int> m_maxBatchDelayMs{10};
+    std::atomic<qint64> m_maxSegmentBytes{0};
+
+    mutable QMutex m_mutex;            // 保护以下成员
+    QWaitCondition m_wake;
+    QWaitCondition m_committedCond;
+    quint64 m_committed = 0;
+    int m_syncWaiters = 0;
+    bool m_stopping = false;
+    QString m_directory;
+    int m_directoryGeneration = 0;
+    QByteArray m_headers[TargetCount];
+    QVector<Segment> m_segments;
+
+    // 只在写入线程中访问；文件在第一次有数据写入时才打开
+    QFile m_files[TargetCount];
+    QDate m_openDates[TargetCount];
+    int m_openSequences[TargetCount] = {};
+    qint64 m_openBytes[TargetCount] = {};
+    int m_openGeneration = 0;
+};
+
+#endif // LOGWRITER_H
@@ -1,11 +1,23 @@
 #include "mainwindow.h"
+#include "serverlog.h"
 
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
-    return a.exec();
+
+    ServerLog *log = ServerLog::instance();
+    log->installMessageHandler();
+    log->start();
+
+    int result = 0;
+    {
+        MainWindow w;
+        w.show();
+        result = a.exec();
+    }
+
+    log->stop();
+    return result;
 }
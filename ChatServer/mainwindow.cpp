@@ -1,5 +1,6 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "serverlog.h"
 #include <QMessageBox>
 
 MainWindow::MainWindow(QWidget *parent)
@@ -9,7 +10,13 @@ MainWindow::MainWindow(QWidget *parent)
     ui->setupUi(this);
     m_chatServer = new ChatServer(this);
 
-    connect(m_chatServer, &ChatServer::logMessage, this, &MainWindow::logMessage);
+    // 日志由输出线程缓存，界面按固定帧率批量拉取，编辑器只保留最近的若干行
+    ui->logEditor->setMaximumBlockCount(MaxLogBlocks);
+    ServerLog::instance()->setGuiFeedEnabled(true, MaxLogBlocks);
+
+    m_logTimer = new QTimer(this);
+    connect(m_logTimer, &QTimer::timeout, this, &MainWindow::pullLogLines);
+    m_logTimer->start(LogRefreshIntervalMs);
 }
 
 MainWindow::~MainWindow()
@@ -35,6 +42,16 @@ void MainWindow::on_startStopButton_clicked()
 
 void MainWindow::logMessage(const QString &msg)
 {
-    ui->logEditor->appendPlainText(msg);
+    ServerLog::info("gui", msg);
+}
+
+void MainWindow::pullLogLines()
+{
+    const QStringList lines = ServerLog::instance()->takeGuiLines(MaxLogBlocks);
+    if (lines.isEmpty())
+        return;
+
+    // 一帧只追加一次，避免每行触发一次重新布局
+    ui->logEditor->appendPlainText(lines.join('\n'));
 }
 
@@ -2,6 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QTimer>
 #include "chatserver.h"
 
 QT_BEGIN_NAMESPACE
@@ -20,6 +21,7 @@ public:
 
 private slots:
     void on_startStopButton_clicked();
+    void pullLogLines();
 
 public slots:
     void logMessage(const QString &msg);
@@ -28,5 +30,9 @@ private:
     Ui::MainWindow *ui;
 
     ChatServer *m_chatServer;
+
+    static constexpr int LogRefreshIntervalMs = 33;
+    static constexpr int MaxLogBlocks = 5000;
+    QTimer *m_logTimer;
 };
 #endif // MAINWINDOW_H
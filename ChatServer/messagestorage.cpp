@@ -1,21 +1,178 @@
 #include "messagestorage.h"
 #include <QDir>
 #include <QStandardPaths>
+#include <QFileInfo>
 #include <QDebug>
+#include <QMap>
+#include <QRegularExpression>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// "[yyyy-MM-dd hh:mm:ss]" 的长度
+const int kTimestampWidth = 21;
+
+bool hasTagAt(const QByteArray &line, int offset, const QByteArray &tag)
+{
+    return line.size() >= offset + tag.size()
+           && std::memcmp(line.constData() + offset, tag.constData(), size_t(tag.size())) == 0;
+}
+
+// 文本日志一条消息占一行：正文中的换行转义后再写入，否则一条消息可以伪造出另一行日志。
+// 反斜杠本身也转义，读回时才能原样还原
+QString escapeLogText(const QString &text)
+{
+    if (!text.contains(QLatin1Char('\\')) && !text.contains(QLatin1Char('\n')) && !text.contains(QLatin1Char('\r')))
+        return text;
+    QString escaped;
+    escaped.reserve(text.size() + 8);
+    for (const QChar c : text) {
+        if (c == QLatin1Char('\\'))
+            escaped += QLatin1String("\\\\");
+        else if (c == QLatin1Char('\n'))
+            escaped += QLatin1String("\\n");
+        else if (c == QLatin1Char('\r'))
+            escaped += QLatin1String("\\r");
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+QString unescapeLogText(const QString &text)
+{
+    if (!text.contains(QLatin1Char('\\')))
+        return text;
+    QString plain;
+    plain.reserve(text.size());
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        const QChar c = text.at(i);
+        if (c != QLatin1Char('\\') || i + 1 == text.size()) {
+            plain += c;
+            continue;
+        }
+        const QChar next = text.at(++i);
+        if (next == QLatin1Char('n'))
+            plain += QLatin1Char('\n');
+        else if (next == QLatin1Char('r'))
+            plain += QLatin1Char('\r');
+        else
+            plain += next;
+    }
+    return plain;
+}
+
+// 把读到的一行还原成历史记录：头部原样保留，只还原头部结尾的 "] " 之后的正文
+QString decodeLogLine(const QByteArray &line)
+{
+    const qsizetype textStart = line.indexOf("] ", kTimestampWidth);
+    if (textStart < 0)
+        return QString::fromUtf8(line);
+    return QString::fromUtf8(line.left(textStart + 2)) + unescapeLogText(QString::fromUtf8(line.mid(textStart + 2)));
+}
+
+// 按块从文件尾部向前读取，每次返回一行（不含换行符），耗时只与读取的行数有关
+class ReverseLineReader
+{
+public:
+    // end >= 0 时只读取 [0, end) 范围，用于从分页游标继续
+    explicit ReverseLineReader(QFile &file, qint64 end = -1)
+        : m_file(file), m_pos(end >= 0 ? qMin(end, file.size()) : file.size())
+    {}
+
+    // 尚未读取部分的末尾；下次从这里构造读取器会接着返回更早的行
+    qint64 position() const { return m_pos + m_buffer.size(); }
+
+    bool readLine(QByteArray &line)
+    {
+        forever {
+            const qsizetype newline = m_buffer.lastIndexOf('\n');
+            if (newline >= 0) {
+                line = m_buffer.mid(newline + 1);
+                m_buffer.truncate(newline);
+                break;
+            }
+            if (m_pos == 0) {
+                if (m_finished)
+                    return false;
+                m_finished = true;
+                line = m_buffer;
+                m_buffer.clear();
+                break;
+            }
+
+            const qint64 blockSize = qMin<qint64>(kBlockSize, m_pos);
+            m_pos -= blockSize;
+            if (!m_file.seek(m_pos))
+                return false;
+            m_buffer.prepend(m_file.read(blockSize));
+        }
+
+        if (line.endsWith('\r'))
+            line.chop(1);
+        return true;
+    }
+
+private:
+    static const qint64 kBlockSize = 64 * 1024;
+
+    QFile &m_file;
+    qint64 m_pos;
+    QByteArray m_buffer;
+    bool m_finished = false;
+};
+
+// 把一行文本日志还原成索引文档，格式见 formatMessage
+bool parseLogLine(const QByteArray &line, SearchIndex::Document *document)
+{
+    static const QRegularExpression pattern(
+        "^\\[(\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2})\\]"
+        "(?:\\[PUBLIC\\]\\[([^\\]]*)\\]|\\[PRIVATE\\]\\[(.*?)->([^\\]]*)\\]|\\[ROOM\\]\\[([^\\]]*)\\]\\[([^\\]]*)\\]) (.*)$");
+    const QRegularExpressionMatch match = pattern.match(QString::fromUtf8(line));
+    if (!match.hasMatch())
+        return false;
+
+    const QDateTime time = QDateTime::fromString(match.captured(1), "yyyy-MM-dd hh:mm:ss");
+    if (!time.isValid())
+        return false;
+    document->timestampMs = time.toMSecsSinceEpoch();
+    if (match.capturedLength(2) > 0) {
+        document->kind = BinaryLog::PublicRecord;
+        document->sender = match.captured(2);
+        document->target.clear();
+    } else if (match.capturedLength(3) > 0) {
+        document->kind = BinaryLog::PrivateRecord;
+        document->sender = match.captured(3);
+        document->target = match.captured(4);
+    } else {
+        document->kind = BinaryLog::RoomRecord;
+        document->target = match.captured(5);
+        document->sender = match.captured(6);
+    }
+    document->text = unescapeLogText(match.captured(7));
+    return true;
+}
+
+} // namespace
 
 MessageStorage::MessageStorage(QObject *parent)
     : QObject(parent)
 {
+    m_writer = new LogWriter(this);
+
     // 默认存储路径为应用程序目录下的 chat_logs 文件夹
     QString defaultPath = QCoreApplication::applicationDirPath() + "/chat_logs";
     initStorage(defaultPath);
+
+    m_writer->start();
 }
 
 MessageStorage::~MessageStorage()
 {
-    if (m_publicLogFile.isOpen()) m_publicLogFile.close();
-    if (m_privateLogFile.isOpen()) m_privateLogFile.close();
-    if (m_loginLogFile.isOpen()) m_loginLogFile.close();
+    // 写完队列中剩余的记录再关闭文件
+    m_writer->stop();
+    m_search.close();
 }
 
 void MessageStorage::initStorage(const QString &storagePath)
@@ -25,70 +182,226 @@ void MessageStorage::initStorage(const QString &storagePath)
     m_storagePath = storagePath;
     ensureDirectoryExists(m_storagePath);
 
-    QString dateStr = getTodayDateString();
-    QString publicLogPath = m_storagePath + "/public_" + dateStr + ".log";
-    QString privateLogPath = m_storagePath + "/private_" + dateStr + ".log";
-    QString loginLogPath = m_storagePath + "/login_" + dateStr + ".log";
+    // 文件名中的日期和轮转由写入线程负责，这里只切换目录
+    m_writer->setDirectory(m_storagePath);
+    m_writer->setFileHeader(LogWriter::PublicSegment, BinaryLog::segmentHeader());
+    m_writer->setFileHeader(LogWriter::PrivateSegment, BinaryLog::segmentHeader());
+    m_writer->setFileHeader(LogWriter::RoomSegment, BinaryLog::segmentHeader());
+    m_binaryLog.open(m_storagePath);
+    m_offline.open(m_storagePath + "/offline");
+    m_search.open(m_storagePath + "/index");
 
-    // 打开或创建日志文件
-    m_publicLogFile.setFileName(publicLogPath);
-    if (!m_publicLogFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
-        qDebug() << "无法打开公共聊天日志文件:" << publicLogPath;
+    // 缓存中的内容和游标都属于旧目录
+    m_recent.clear();
+    {
+        QMutexLocker cacheLocker(&m_cacheMutex);
+        m_pageCache.clear();
     }
 
-    m_privateLogFile.setFileName(privateLogPath);
-    if (!m_privateLogFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
-        qDebug() << "无法打开私聊日志文件:" << privateLogPath;
-    }
+    qDebug() << "消息存储初始化完成，路径:" << m_storagePath;
+}
 
-    m_loginLogFile.setFileName(loginLogPath);
-    if (!m_loginLogFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
-        qDebug() << "无法打开登录日志文件:" << loginLogPath;
-    }
+void MessageStorage::setDurability(LogWriter::Durability durability)
+{
+    m_writer->setDurability(durability);
+    m_binaryLog.setSyncDictionary(durability == LogWriter::FsyncPerBatch);
+}
 
-    qDebug() << "消息存储初始化完成，路径:" << m_storagePath;
+void MessageStorage::setBatchLimits(int maxRecords, int maxDelayMs)
+{
+    m_writer->setBatchLimits(maxRecords, maxDelayMs);
 }
 
-void MessageStorage::savePublicMessage(const QString &sender, const QString &message)
+void MessageStorage::setMaxSegmentBytes(qint64 bytes)
 {
-    QMutexLocker locker(&m_mutex);
+    m_writer->setMaxSegmentBytes(bytes);
+}
 
-    if (!m_publicLogFile.isOpen()) {
-        initStorage(m_storagePath); // 重新初始化
-    }
+void MessageStorage::setStorageFormat(StorageFormat format)
+{
+    // 两种格式的时间戳精度不同，缓存的游标不能混用
+    if (m_format.exchange(format, std::memory_order_relaxed) != format)
+        m_recent.clear();
+}
 
-    QString formattedMsg = formatMessage("PUBLIC", sender, "ALL", message);
-    QTextStream out(&m_publicLogFile);
-    out << formattedMsg << "\n";
-    m_publicLogFile.flush();
+MessageStorage::StorageFormat MessageStorage::storageFormat() const
+{
+    return StorageFormat(m_format.load(std::memory_order_relaxed));
+}
 
-    qDebug() << "保存公共消息:" << formattedMsg;
+bool MessageStorage::exportSegmentToText(const QString &segmentPath, const QString &textPath)
+{
+    m_writer->sync();
+    return m_binaryLog.exportToText(segmentPath, textPath);
+}
+
+void MessageStorage::savePublicMessage(const QString &sender, const QString &message)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (storageFormat() == BinaryFormat) {
+        // 二进制格式只写整数时间戳和名字ID，不需要格式化时间字符串
+        m_writer->append(LogWriter::PublicSegment,
+                         m_binaryLog.encode(BinaryLog::PublicRecord, sender, QString(), message, now));
+    } else {
+        QString formattedMsg = formatMessage("PUBLIC", sender, "ALL", escapeLogText(message), now);
+        m_writer->append(LogWriter::PublicLog, (formattedMsg + "\n").toUtf8());
+    }
+    rememberRecent(RecentMessageCache::publicKey(), now, sender, QString(), message);
+    indexMessage(BinaryLog::PublicRecord, now, sender, QString(), message);
 }
 
 void MessageStorage::savePrivateMessage(const QString &sender, const QString &receiver, const QString &message)
 {
-    QMutexLocker locker(&m_mutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (storageFormat() == BinaryFormat) {
+        m_writer->append(LogWriter::PrivateSegment,
+                         m_binaryLog.encode(BinaryLog::PrivateRecord, sender, receiver, message, now));
+    } else {
+        QString formattedMsg = formatMessage("PRIVATE", sender, receiver, escapeLogText(message), now);
+        m_writer->append(LogWriter::PrivateLog, (formattedMsg + "\n").toUtf8());
+    }
+    rememberRecent(RecentMessageCache::privateKey(sender, receiver), now, sender, receiver, message);
+    indexMessage(BinaryLog::PrivateRecord, now, sender, receiver, message);
+}
 
-    if (!m_privateLogFile.isOpen()) {
-        initStorage(m_storagePath); // 重新初始化
+void MessageStorage::saveRoomMessage(const QString &room, const QString &sender, const QString &message)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (storageFormat() == BinaryFormat) {
+        m_writer->append(LogWriter::RoomSegment,
+                         m_binaryLog.encode(BinaryLog::RoomRecord, sender, room, message, now));
+    } else {
+        QString formattedMsg = formatMessage("ROOM", sender, room, escapeLogText(message), now);
+        m_writer->append(LogWriter::RoomLog, (formattedMsg + "\n").toUtf8());
     }
+    rememberRecent(RecentMessageCache::roomKey(room), now, sender, room, message);
+    indexMessage(BinaryLog::RoomRecord, now, sender, room, message);
+}
 
-    QString formattedMsg = formatMessage("PRIVATE", sender, receiver, message);
-    QTextStream out(&m_privateLogFile);
-    out << formattedMsg << "\n";
-    m_privateLogFile.flush();
+void MessageStorage::rememberRecent(const QString &key, qint64 timestampMs, const QString &sender,
+                                    const QString &target, const QString &message)
+{
+    // 文本日志只有秒级时间戳，缓存中保持一致，游标才能与文件中的记录对上
+    if (storageFormat() == TextFormat)
+        timestampMs = timestampMs / 1000 * 1000;
+    m_recent.append(key, RecentMessageCache::Message{timestampMs, sender, target, message});
+}
 
-    qDebug() << "保存私聊消息:" << formattedMsg;
+void MessageStorage::indexMessage(BinaryLog::Kind kind, qint64 timestampMs, const QString &sender,
+                                  const QString &target, const QString &message)
+{
+    if (m_searchEnabled.load(std::memory_order_relaxed))
+        m_search.add(SearchIndex::Document{timestampMs, quint8(kind), sender, target, message});
 }
 
-void MessageStorage::saveLoginLog(const QString &username, const QString &ip, bool isLogin)
+void MessageStorage::setSearchIndexEnabled(bool enabled)
 {
-    QMutexLocker locker(&m_mutex);
+    m_searchEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+QVector<SearchIndex::Hit> MessageStorage::searchMessages(const QString &query, int limit, quint64 beforeDocId,
+                                                         const SearchIndex::Filter &filter, quint64 *resumeBefore)
+{
+    return m_search.search(query, limit, beforeDocId, filter, resumeBefore);
+}
+
+qint64 MessageStorage::rebuildSearchIndex()
+{
+    m_writer->sync();
+    if (!m_search.clear())
+        return -1;
 
-    if (!m_loginLogFile.isOpen()) {
-        initStorage(m_storagePath);
+    // 按日期分组，组内两种格式、三类会话的记录合并后按时间排序，整体保持从旧到新编号
+    static const QRegularExpression datePattern("_(\\d{4}-\\d{2}-\\d{2})(?:\\.\\d+)?\\.(?:log|seg)$");
+    const LogWriter::Target targets[] = {
+        LogWriter::PublicLog, LogWriter::PrivateLog, LogWriter::RoomLog,
+        LogWriter::PublicSegment, LogWriter::PrivateSegment, LogWriter::RoomSegment
+    };
+    QMap<QDate, QStringList> filesByDate;
+    for (LogWriter::Target target : targets) {
+        const QStringList paths = m_writer->segmentPaths(target);
+        // segmentPaths 从新到旧，倒过来保持同一天内的轮转顺序
+        for (auto it = paths.crbegin(); it != paths.crend(); ++it) {
+            const QRegularExpressionMatch match = datePattern.match(*it);
+            const QDate date = match.hasMatch() ? QDate::fromString(match.captured(1), "yyyy-MM-dd") : QDate();
+            if (date.isValid())
+                filesByDate[date].append(*it);
+        }
     }
 
+    qint64 total = 0;
+    for (auto day = filesByDate.cbegin(); day != filesByDate.cend(); ++day) {
+        QVector<SearchIndex::Document> documents;
+        for (const QString &path : day.value()) {
+            if (path.endsWith(LogWriter::targetSuffix(LogWriter::PublicSegment))) {
+                QVector<SearchIndex::Document> segment;
+                m_binaryLog.scanBackward(path, [&](const BinaryLog::Entry &entry) {
+                    if (!entry.checksumOk())
+                        return true;
+                    SearchIndex::Document document;
+                    document.timestampMs = entry.timestampMs;
+                    document.kind = entry.kind;
+                    document.sender = m_binaryLog.nameOf(entry.senderId);
+                    if (entry.kind != BinaryLog::PublicRecord)
+                        document.target = m_binaryLog.nameOf(entry.receiverId);
+                    document.text = QString::fromUtf8(entry.text, entry.textSize);
+                    segment.append(document);
+                    return true;
+                });
+                std::reverse(segment.begin(), segment.end());
+                documents += segment;
+                continue;
+            }
+
+            QFile file(path);
+            if (!file.open(QIODevice::ReadOnly)) {
+                qDebug() << "无法读取聊天日志:" << path;
+                continue;
+            }
+            SearchIndex::Document document;
+            while (!file.atEnd()) {
+                QByteArray line = file.readLine();
+                while (line.endsWith('\n') || line.endsWith('\r'))
+                    line.chop(1);
+                if (parseLogLine(line, &document))
+                    documents.append(document);
+            }
+        }
+
+        std::stable_sort(documents.begin(), documents.end(),
+                         [](const SearchIndex::Document &a, const SearchIndex::Document &b) {
+                             return a.timestampMs < b.timestampMs;
+                         });
+        for (const SearchIndex::Document &document : std::as_const(documents))
+            m_search.add(document);
+        total += documents.size();
+    }
+
+    if (!m_search.flush())
+        return -1;
+    return total;
+}
+
+void MessageStorage::setRecentCacheLimits(int perConversation, qint64 maxBytes)
+{
+    // 缓存比一页浅时，大于缓存深度的第一页总是读文件
+    if (perConversation > 0)
+        perConversation = qMax(perConversation, int(MaxHistoryPageSize));
+    m_recent.setLimits(perConversation, maxBytes);
+}
+
+RecentMessageCache::Stats MessageStorage::recentCacheStats() const
+{
+    return m_recent.stats();
+}
+
+int MessageStorage::pendingWrites() const
+{
+    return m_writer->pendingRecords();
+}
+
+void MessageStorage::saveLoginLog(const QString &username, const QString &ip, bool isLogin)
+{
     QString timestamp = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
     QString action = isLogin ? "LOGIN" : "LOGOUT";
     QString logEntry = QString("[%1] %2 %3 from %4")
@@ -97,54 +410,315 @@ void MessageStorage::saveLoginLog(const QString &username, const QString &ip, bo
                            .arg(username)
                            .arg(ip);
 
-    QTextStream out(&m_loginLogFile);
-    out << logEntry << "\n";
-    m_loginLogFile.flush();
+    m_writer->append(LogWriter::LoginLog, (logEntry + "\n").toUtf8());
+}
 
-    qDebug() << "保存登录日志:" << logEntry;
+OfflineStore::EnqueueResult MessageStorage::saveOfflineMessage(const QString &receiver, const QString &sender,
+                                                              const QString &message)
+{
+    return m_offline.enqueue(receiver, sender, message, QDateTime::currentMSecsSinceEpoch());
+}
+
+QVector<OfflineStore::Message> MessageStorage::pendingOfflineMessages(const QString &receiver, int *records)
+{
+    return m_offline.pending(receiver, records);
+}
+
+void MessageStorage::acknowledgeOfflineMessages(const QString &receiver, int records)
+{
+    m_offline.acknowledge(receiver, records);
+}
+
+void MessageStorage::releaseOfflineMessages(const QString &receiver)
+{
+    m_offline.release(receiver);
+}
+
+void MessageStorage::addOfflineUser(const QString &name)
+{
+    m_offline.addKnownUser(name);
+}
+
+void MessageStorage::setOfflineLimits(int maxMessages, int maxAgeDays, int maxRecipients)
+{
+    m_offline.setLimits(maxMessages, maxAgeDays, maxRecipients);
 }
 
 QStringList MessageStorage::getChatHistory(const QString &user1, const QString &user2, int limit)
 {
-    QMutexLocker locker(&m_mutex);
-    QStringList history;
+    HistoryQuery query;
+    query.conversation = user2.isEmpty() ? HistoryQuery::Public : HistoryQuery::Private;
+    query.user1 = user1;
+    query.user2 = user2;
+    query.limit = limit;
+    return getHistoryPage(query).lines;
+}
 
-    QString filename;
-    if (user2.isEmpty()) {
-        // 获取公共聊天历史
-        QString dateStr = getTodayDateString();
-        filename = m_storagePath + "/public_" + dateStr + ".log";
-    } else {
-        // 获取私聊历史
-        QString dateStr = getTodayDateString();
-        filename = m_storagePath + "/private_" + dateStr + ".log";
-    }
-
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qDebug() << "无法读取聊天历史文件:" << filename;
-        return history;
-    }
-
-    QTextStream in(&file);
-    int count = 0;
-    while (!in.atEnd() && count < limit) {
-        QString line = in.readLine();
-        if (user2.isEmpty()) {
-            // 公共聊天历史，全部返回
-            history.prepend(line); // 最新的在前面
-            count++;
-        } else {
-            // 私聊历史，只返回两个用户之间的
-            if (line.contains(user1) && line.contains(user2)) {
-                history.prepend(line);
-                count++;
+QStringList MessageStorage::getRoomHistory(const QString &room, int limit)
+{
+    HistoryQuery query;
+    query.conversation = HistoryQuery::Room;
+    query.room = room;
+    query.limit = limit;
+    return getHistoryPage(query).lines;
+}
+
+MessageStorage::HistoryPage MessageStorage::getHistoryPage(const HistoryQuery &query)
+{
+    HistoryPage page;
+    if (query.limit <= 0)
+        return page;
+    if (query.conversation == HistoryQuery::Private && (query.user1.isEmpty() || query.user2.isEmpty()))
+        return page;
+    if (query.conversation == HistoryQuery::Room && query.room.isEmpty())
+        return page;
+
+    // 最新的一页优先从内存取，不读文件，也不需要等待写入线程
+    if (query.cursor.isEmpty() && query.beforeMs <= 0 && recentPage(query, &page))
+        return page;
+
+    const StorageFormat format = storageFormat();
+    const QString key = cacheKey(query, format);
+    if (!query.cursor.isEmpty()) {
+        QMutexLocker locker(&m_cacheMutex);
+        if (const HistoryPage *cached = m_pageCache.object(key))
+            return *cached;
+    }
+    if (query.cursor.isEmpty() || query.cursor.startsWith("t:")) {
+        // 第一页包含最新的记录；时间游标要跳过的记录可能还在写入队列中。先让写入线程写到文件
+        m_writer->sync();
+    }
+
+    const bool binary = format == BinaryFormat;
+    LogWriter::Target target = binary ? LogWriter::PublicSegment : LogWriter::PublicLog;
+    if (query.conversation == HistoryQuery::Private)
+        target = binary ? LogWriter::PrivateSegment : LogWriter::PrivateLog;
+    else if (query.conversation == HistoryQuery::Room)
+        target = binary ? LogWriter::RoomSegment : LogWriter::RoomLog;
+    const QStringList files = historyFiles(target);
+
+    // 游标定位到某个段文件内的偏移，该文件之前（更新）的文件不再读取
+    int startFile = 0;
+    qint64 startOffset = -1;
+    TimeBound bound;
+    if (query.beforeMs > 0)
+        bound.untilMs = query.beforeMs - 1;
+    if (query.cursor.startsWith("t:")) {
+        // 时间游标：从最新的文件开始，跳过内存中已经返回的记录
+        const QStringList parts = query.cursor.split(':');
+        bool timeOk = false;
+        bool skipOk = false;
+        const qint64 untilMs = parts.size() == 3 ? parts.at(1).toLongLong(&timeOk) : -1;
+        const int skipEqual = parts.size() == 3 ? parts.at(2).toInt(&skipOk) : 0;
+        if (!timeOk || !skipOk || untilMs < 0 || skipEqual < 0)
+            return page;
+        if (bound.untilMs < 0 || untilMs <= bound.untilMs) {
+            bound.untilMs = untilMs;
+            bound.skipEqual = skipEqual;
+        }
+    } else if (!query.cursor.isEmpty()) {
+        const int colon = query.cursor.lastIndexOf(':');
+        bool ok = false;
+        startOffset = colon > 0 ? query.cursor.mid(colon + 1).toLongLong(&ok) : -1;
+        const QString fileName = query.cursor.left(colon);
+        startFile = -1;
+        for (int i = 0; ok && i < files.size(); ++i) {
+            if (QFileInfo(files.at(i)).fileName() == fileName) {
+                startFile = i;
+                break;
+            }
+        }
+        if (startFile < 0 || startOffset < 0)
+            return page;   // 游标无效，或对应的文件已超出回溯范围
+    }
+
+    page = binary ? readBinaryPage(query, files, startFile, startOffset, bound)
+                  : readTextPage(query, files, startFile, startOffset, bound);
+
+    if (!query.cursor.isEmpty()) {
+        QMutexLocker locker(&m_cacheMutex);
+        m_pageCache.insert(key, new HistoryPage(page), qMax(1, int(page.lines.size()) / 50));
+    }
+    return page;
+}
+
+bool MessageStorage::TimeBound::accept(qint64 timestampMs, int *equalSeen) const
+{
+    if (untilMs < 0 || timestampMs < untilMs)
+        return true;
+    if (timestampMs > untilMs)
+        return false;
+    return (*equalSeen)++ >= skipEqual;
+}
+
+bool MessageStorage::recentPage(const HistoryQuery &query, HistoryPage *page)
+{
+    QString key = RecentMessageCache::publicKey();
+    if (query.conversation == HistoryQuery::Private)
+        key = RecentMessageCache::privateKey(query.user1, query.user2);
+    else if (query.conversation == HistoryQuery::Room)
+        key = RecentMessageCache::roomKey(query.room);
+
+    QVector<RecentMessageCache::Message> recent;
+    if (!m_recent.recent(key, query.limit, &recent))
+        return false;
+
+    page->lines.clear();
+    for (const RecentMessageCache::Message &message : recent) {
+        switch (query.conversation) {
+        case HistoryQuery::Public:
+            page->lines.append(formatMessage("PUBLIC", message.sender, "ALL", message.text, message.timestampMs));
+            break;
+        case HistoryQuery::Private:
+            page->lines.append(formatMessage("PRIVATE", message.sender, message.target, message.text, message.timestampMs));
+            break;
+        case HistoryQuery::Room:
+            page->lines.append(formatMessage("ROOM", message.sender, message.target, message.text, message.timestampMs));
+            break;
+        }
+    }
+
+    // 同一时间戳可能有多条，记下本页已经返回了几条
+    const qint64 oldest = recent.constLast().timestampMs;
+    int sameTime = 0;
+    for (const RecentMessageCache::Message &message : recent) {
+        if (message.timestampMs == oldest)
+            ++sameTime;
+    }
+    page->nextCursor = QString("t:%1:%2").arg(oldest).arg(sameTime);
+    return true;
+}
+
+MessageStorage::HistoryPage MessageStorage::readTextPage(const HistoryQuery &query, const QStringList &files,
+                                                         int startFile, qint64 startOffset, const TimeBound &bound)
+{
+    HistoryPage page;
+
+    // 私聊只匹配时间戳之后的 [PRIVATE][a->b] 头部，两个方向都算
+    QByteArray forwardTag;
+    QByteArray backwardTag;
+    if (query.conversation == HistoryQuery::Private) {
+        forwardTag = QString("[PRIVATE][%1->%2] ").arg(query.user1, query.user2).toUtf8();
+        backwardTag = QString("[PRIVATE][%1->%2] ").arg(query.user2, query.user1).toUtf8();
+    } else if (query.conversation == HistoryQuery::Room) {
+        forwardTag = QString("[ROOM][%1]").arg(query.room).toUtf8();
+    }
+
+    // 从最新的日志文件开始，每个文件从尾部往前读，凑够 limit 条即停止
+    int equalSeen = 0;
+    for (int i = startFile; i < files.size(); ++i) {
+        const QString &filename = files.at(i);
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qDebug() << "无法读取聊天历史文件:" << filename;
+            continue;
+        }
+
+        ReverseLineReader reader(file, i == startFile && startOffset >= 0 ? startOffset : -1);
+        QByteArray line;
+        while (reader.readLine(line)) {
+            if (line.isEmpty())
+                continue;
+            if (!forwardTag.isEmpty() && !hasTagAt(line, kTimestampWidth, forwardTag)
+                && (backwardTag.isEmpty() || !hasTagAt(line, kTimestampWidth, backwardTag)))
+                continue;
+            if (bound.untilMs >= 0) {
+                const QDateTime time = QDateTime::fromString(QString::fromLatin1(line.mid(1, kTimestampWidth - 2)),
+                                                             "yyyy-MM-dd hh:mm:ss");
+                if (time.isValid() && !bound.accept(time.toMSecsSinceEpoch(), &equalSeen))
+                    continue;
+            }
+            page.lines.append(decodeLogLine(line)); // 最新的在前面
+            if (page.lines.size() >= query.limit) {
+                page.nextCursor = QFileInfo(filename).fileName() + ':' + QString::number(reader.position());
+                return page;
             }
         }
     }
+    return page;
+}
+
+MessageStorage::HistoryPage MessageStorage::readBinaryPage(const HistoryQuery &query, const QStringList &files,
+                                                           int startFile, qint64 startOffset, const TimeBound &bound)
+{
+    HistoryPage page;
+
+    // 按整数ID比较，名字从未出现过说明没有记录
+    quint32 id1 = 0;
+    quint32 id2 = 0;
+    if (query.conversation == HistoryQuery::Private) {
+        id1 = m_binaryLog.idOf(query.user1);
+        id2 = m_binaryLog.idOf(query.user2);
+        if (id1 == 0 || id2 == 0)
+            return page;
+    } else if (query.conversation == HistoryQuery::Room) {
+        id1 = m_binaryLog.idOf(query.room);
+        if (id1 == 0)
+            return page;
+    }
+
+    int equalSeen = 0;
+    for (int i = startFile; i < files.size(); ++i) {
+        const QString &filename = files.at(i);
+        m_binaryLog.scanBackward(filename, [&](const BinaryLog::Entry &entry) {
+            if (query.conversation == HistoryQuery::Private
+                && !((entry.senderId == id1 && entry.receiverId == id2)
+                     || (entry.senderId == id2 && entry.receiverId == id1)))
+                return true;
+            if (query.conversation == HistoryQuery::Room
+                && (entry.kind != BinaryLog::RoomRecord || entry.receiverId != id1))
+                return true;
+            if (!bound.accept(entry.timestampMs, &equalSeen))
+                return true;
+            if (!entry.checksumOk())
+                return true;
+            page.lines.append(m_binaryLog.formatEntry(entry)); // 最新的在前面
+            if (page.lines.size() < query.limit)
+                return true;
+            page.nextCursor = QFileInfo(filename).fileName() + ':' + QString::number(entry.offset);
+            return false;
+        }, i == startFile ? startOffset : -1);
+
+        if (page.lines.size() >= query.limit)
+            break;
+    }
+    return page;
+}
+
+QString MessageStorage::cacheKey(const HistoryQuery &query, StorageFormat format)
+{
+    // 私聊两个方向是同一个会话
+    QString conversation;
+    if (query.conversation == HistoryQuery::Private) {
+        conversation = query.user1 < query.user2 ? query.user1 + '\n' + query.user2
+                                                 : query.user2 + '\n' + query.user1;
+    } else if (query.conversation == HistoryQuery::Room) {
+        conversation = query.room;
+    }
+    return QString("%1|%2|%3|%4|%5|%6")
+        .arg(int(format))
+        .arg(int(query.conversation))
+        .arg(conversation, query.cursor)
+        .arg(query.limit)
+        .arg(query.beforeMs);
+}
 
-    file.close();
-    return history;
+void MessageStorage::setHistoryCacheSize(int pages)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    m_pageCache.setMaxCost(qMax(0, pages));
+}
+
+QStringList MessageStorage::historyFiles(LogWriter::Target target) const
+{
+    // 段清单包含所有轮转出来的文件，按日期和序号从新到旧
+    const QDate since = QDate::currentDate().addDays(-(m_historyDays - 1));
+    return m_writer->segmentPaths(target, since);
+}
+
+void MessageStorage::setHistoryDays(int days)
+{
+    m_historyDays = qMax(1, days);
 }
 
 void MessageStorage::ensureDirectoryExists(const QString &path)
@@ -161,20 +735,17 @@ QString MessageStorage::getTodayDateString() const
     return QDateTime::currentDateTime().toString("yyyy-MM-dd");
 }
 
-QString MessageStorage::formatMessage(const QString &type, const QString &sender,  const QString &receiver, const QString &message)
+QString MessageStorage::formatMessage(const QString &type, const QString &sender, const QString &receiver,
+                                      const QString &message, qint64 timestampMs)
 {
-    QString timestamp = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+    QString timestamp = QDateTime::fromMSecsSinceEpoch(timestampMs).toString("yyyy-MM-dd hh:mm:ss");
 
+    // 一次替换所有占位符，名字或正文中的 %1 之类不会被后面的参数再次替换
     if (type == "PUBLIC") {
-        return QString("[%1][PUBLIC][%2] %3")
-        .arg(timestamp)
-            .arg(sender)
-            .arg(message);
+        return QString("[%1][PUBLIC][%2] %3").arg(timestamp, sender, message);
+    } else if (type == "ROOM") {
+        return QString("[%1][ROOM][%2][%3] %4").arg(timestamp, receiver, sender, message);
     } else {
-        return QString("[%1][PRIVATE][%2->%3] %4")
-        .arg(timestamp)
-            .arg(sender)
-            .arg(receiver)
-            .arg(message);
+        return QString("[%1][PRIVATE][%2->%3] %4").arg(timestamp, sender, receiver, message);
     }
 }
@@ -9,32 +9,142 @@
 #include <QJsonDocument>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QCache>
 #include <QCoreApplication>
 #include <QDir>
+#include "logwriter.h"
+#include "binarylog.h"
+#include "offlinestore.h"
+#include "recentcache.h"
+#include "searchindex.h"
+#include <atomic>
 
 class MessageStorage : public QObject
 {
     Q_OBJECT
 public:
+    enum StorageFormat {
+        TextFormat,      // [时间][类型][发送者] 文本日志
+        BinaryFormat     // 二进制段文件，历史查询通过 mmap 倒序扫描
+    };
+
     explicit MessageStorage(QObject *parent = nullptr);
     ~MessageStorage();
 
     void initStorage(const QString &storagePath = "chat_logs");
     void savePublicMessage(const QString &sender, const QString &message);
     void savePrivateMessage(const QString &sender, const QString &receiver, const QString &message);
+    // 聊天室消息写入独立的 room_ 日志，每条记录带房间名
+    void saveRoomMessage(const QString &room, const QString &sender, const QString &message);
+    // 返回最新的 limit 条记录（最新的在前面），从文件尾部倒序读取，可跨越多天的日志
     QStringList getChatHistory(const QString &user1, const QString &user2 = "", int limit = 100);
+    // 某个聊天室最新的 limit 条记录（最新的在前面），不会扫描公共和私聊日志
+    QStringList getRoomHistory(const QString &room, int limit = 100);
+
+    // 分页查询：公共聊天、两人私聊或某个聊天室
+    struct HistoryQuery {
+        enum Conversation { Public, Private, Room };
+        Conversation conversation = Public;
+        QString user1;
+        QString user2;          // 私聊的另一方
+        QString room;
+        QString cursor;         // 上一页返回的游标，空表示从最新的记录开始
+        qint64 beforeMs = 0;    // 大于 0 时只返回早于该时间的记录
+        int limit = 50;
+    };
+    // 一页最多的条数，最近消息缓存的深度不小于它，任何一页都能从内存取到
+    static constexpr int MaxHistoryPageSize = 500;
+    // 游标是“段文件名:偏移”，指向本页最旧一条记录之前，下一页从那里继续倒序读取，
+    // 不需要重新扫描已经返回过的记录。日志只追加，带游标的页内容不会再变化，可以缓存。
+    // 第一页由内存缓存提供时不知道文件偏移，游标为“t:毫秒:同一时间戳已返回的条数”
+    struct HistoryPage {
+        QStringList lines;      // 最新的在前面
+        QString nextCursor;     // 为空表示没有更早的记录
+    };
+    // 可在任意线程调用，多个查询可以并行
+    HistoryPage getHistoryPage(const HistoryQuery &query);
+    // 缓存的带游标页数，0 表示不缓存
+    void setHistoryCacheSize(int pages);
+
+    // 每个会话在内存中保留的最近消息条数和所有会话的总内存上限，条数为 0 时关闭，
+    // 非 0 时至少为 MaxHistoryPageSize
+    void setRecentCacheLimits(int perConversation, qint64 maxBytes);
+    RecentMessageCache::Stats recentCacheStats() const;
+    // 写入线程中尚未提交的记录数
+    int pendingWrites() const;
+    // 全文检索：最新的在前，beforeDocId 为上一页最后一条的编号。可在任意线程调用
+    QVector<SearchIndex::Hit> searchMessages(const QString &query, int limit, quint64 beforeDocId = 0,
+                                             const SearchIndex::Filter &filter = SearchIndex::Filter(),
+                                             quint64 *resumeBefore = nullptr);
+    // 丢弃现有索引，按时间顺序重新读取全部聊天日志（两种格式）建立索引，返回文档数，失败返回 -1
+    qint64 rebuildSearchIndex();
+    // 关闭后新消息不再进入索引，已有索引仍可查询
+    void setSearchIndexEnabled(bool enabled);
+    SearchIndex &searchIndex() { return m_search; }
+    // 历史查询最多回溯的日志文件（天）数
+    void setHistoryDays(int days);
     void saveLoginLog(const QString &username, const QString &ip, bool isLogin);
 
+    // 离线私聊的存储转发，只能在持久化通道中调用
+    OfflineStore::EnqueueResult saveOfflineMessage(const QString &receiver, const QString &sender, const QString &message);
+    QVector<OfflineStore::Message> pendingOfflineMessages(const QString &receiver, int *records);
+    void acknowledgeOfflineMessages(const QString &receiver, int records);
+    void releaseOfflineMessages(const QString &receiver);
+    // 登录过的用户才能接收离线私聊
+    void addOfflineUser(const QString &name);
+    // 每个接收者最多保留的条数和天数，以及最多保留多少个接收者的队列
+    void setOfflineLimits(int maxMessages, int maxAgeDays, int maxRecipients);
+
+    // 写入耐久性：不刷盘 / 每批刷到内核 / 每批 fdatasync
+    void setDurability(LogWriter::Durability durability);
+    // 批量提交阈值：条数或毫秒，先到者触发
+    void setBatchLimits(int maxRecords, int maxDelayMs);
+
+    // 单个日志文件的大小上限，超过后在当天内轮转出新文件；0 表示只按日期轮转
+    void setMaxSegmentBytes(qint64 bytes);
+
+    // 聊天消息的存储格式，登录日志始终为文本
+    void setStorageFormat(StorageFormat format);
+    StorageFormat storageFormat() const;
+    // 把二进制段文件导出为文本日志格式
+    bool exportSegmentToText(const QString &segmentPath, const QString &textPath);
+
 private:
     QString m_storagePath;
-    QFile m_publicLogFile;
-    QFile m_privateLogFile;
-    QFile m_loginLogFile;
+    LogWriter *m_writer;
+    BinaryLog m_binaryLog;
+    OfflineStore m_offline;
     QMutex m_mutex;
+    int m_historyDays = 30;
+    std::atomic<int> m_format{TextFormat};
+
+    QMutex m_cacheMutex;                            // 保护 m_pageCache
+    QCache<QString, HistoryPage> m_pageCache{256};
+    RecentMessageCache m_recent;                    // 写入路径填充，第一页优先从这里取
+    SearchIndex m_search;                           // 写入路径增量维护
+    std::atomic<bool> m_searchEnabled{true};
 
     void ensureDirectoryExists(const QString &path);
     QString getTodayDateString() const;
-    QString formatMessage(const QString &type, const QString &sender, const QString &receiver, const QString &message);
+    QStringList historyFiles(LogWriter::Target target) const;
+    // 按时间定位：只接受不晚于 untilMs 的记录，其中恰好等于 untilMs 的先跳过 skipEqual 条（从新到旧数）
+    struct TimeBound {
+        qint64 untilMs = -1;    // -1 表示不限
+        int skipEqual = 0;
+        bool accept(qint64 timestampMs, int *equalSeen) const;
+    };
+    HistoryPage readTextPage(const HistoryQuery &query, const QStringList &files, int startFile,
+                             qint64 startOffset, const TimeBound &bound);
+    HistoryPage readBinaryPage(const HistoryQuery &query, const QStringList &files, int startFile,
+                               qint64 startOffset, const TimeBound &bound);
+    bool recentPage(const HistoryQuery &query, HistoryPage *page);
+    static QString cacheKey(const HistoryQuery &query, StorageFormat format);
+    static QString formatMessage(const QString &type, const QString &sender, const QString &receiver,
+                                 const QString &message, qint64 timestampMs);
+    void indexMessage(BinaryLog::Kind kind, qint64 timestampMs, const QString &sender,
+                      const QString &target, const QString &message);
+    void rememberRecent(const QString &key, qint64 timestampMs, const QString &sender,
+                        const QString &target, const QString &message);
 };
 
 #endif // MESSAGESTORAGE_H
@@ -0,0 +1,293 @@
+#include "metrics.h"
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <atomic>
+#include <vector>
+
+namespace {
+
+// le = 1us * 2^i，i = 0..24，最后一个桶为 +Inf
+const int kFiniteBuckets = 25;
+const int kBuckets = kFiniteBuckets + 1;
+
+const char *const kStageNames[] = {"decode", "validate", "route", "persist", "fanout", "query"};
+static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) == Metrics::HistogramCount - Metrics::StageLatency,
+              "每个流水线阶段一个直方图");
+
+const char *const kMessageTypeNames[Metrics::MessageTypeCount] = {
+    "public", "private", "room", "login", "history", "search", "presence", "room_control", "error", "heartbeat", "other"
+};
+
+// 每个线程独占一个，只有所属线程写入；对齐到缓存行，相邻分片不会互相干扰
+struct alignas(64) Shard {
+    std::atomic<quint64> counters[Metrics::CounterCount];
+    std::atomic<quint64> messagesIn[Metrics::MessageTypeCount];
+    std::atomic<quint64> messagesOut[Metrics::MessageTypeCount];
+    std::atomic<quint64> buckets[Metrics::HistogramCount][kBuckets];
+    std::atomic<quint64> sumNs[Metrics::HistogramCount];
+};
+
+struct Registry {
+    QMutex mutex;
+    std::vector<Shard*> all;     // 分片从不释放，导出时全部求和
+    std::vector<Shard*> idle;    // 所属线程已退出，等待新线程领取
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+struct ShardOwner {
+    Shard *shard = nullptr;
+
+    ~ShardOwner()
+    {
+        if (!shard)
+            return;
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        r.idle.push_back(shard);
+    }
+};
+
+thread_local ShardOwner t_owner;
+
+Shard &localShard()
+{
+    if (Q_LIKELY(t_owner.shard))
+        return *t_owner.shard;
+
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    if (!r.idle.empty()) {
+        t_owner.shard = r.idle.back();
+        r.idle.pop_back();
+    } else {
+        t_owner.shard = new Shard();   // 值初始化，全部为 0
+        r.all.push_back(t_owner.shard);
+    }
+    return *t_owner.shard;
+}
+
+// 只有一个写入者，不需要原子的读改写
+inline void bump(std::atomic<quint64> &cell, quint64 value)
+{
+    cell.store(cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+int bucketFor(qint64 nanoseconds)
+{
+    // 向上取整到微秒，保证每个值都不超过所在桶的上界
+    const quint64 us = (quint64(qMax<qint64>(0, nanoseconds)) + 999) / 1000;
+    if (us <= 1)
+        return 0;
+    // 落在 (2^(i-1), 2^i] 微秒的值进入第 i 个桶
+    const int bucket = 64 - qCountLeadingZeroBits(us - 1);
+    return qMin(bucket, kFiniteBuckets);
+}
+
+struct Totals {
+    quint64 counters[Metrics::CounterCount] = {};
+    quint64 messagesIn[Metrics::MessageTypeCount] = {};
+    quint64 messagesOut[Metrics::MessageTypeCount] = {};
+    quint64 buckets[Metrics::HistogramCount][kBuckets] = {};
+    quint64 sumNs[Metrics::HistogramCount] = {};
+};
+
+void collect(Totals *totals)
+{
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (const Shard *shard : r.all) {
+        for (int i = 0; i < Metrics::CounterCount; ++i)
+            totals->counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < Metrics::MessageTypeCount; ++i) {
+            totals->messagesIn[i] += shard->messagesIn[i].load(std::memory_order_relaxed);
+            totals->messagesOut[i] += shard->messagesOut[i].load(std::memory_order_relaxed);
+        }
+        for (int h = 0; h < Metrics::HistogramCount; ++h) {
+            for (int b = 0; b < kBuckets; ++b)
+                totals->buckets[h][b] += shard->buckets[h][b].load(std::memory_order_relaxed);
+            totals->sumNs[h] += shard->sumNs[h].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void writeHistogram(QByteArray &out, const char *name, const Totals &totals, int histogram,
+                    const QByteArray &labels)
+{
+    const QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+    const QByteArray bucketName = QByteArray(name) + "_bucket";
+    quint64 cumulative = 0;
+    for (int b = 0; b < kFiniteBuckets; ++b) {
+        cumulative += totals.buckets[histogram][b];
+        const double le = double(quint64(1) << b) / 1e6;
+        Metrics::writeSample(out, bucketName.constData(), double(cumulative),
+                             prefix + "le=\"" + QByteArray::number(le, 'g', 16) + '"');
+    }
+    cumulative += totals.buckets[histogram][kFiniteBuckets];
+    Metrics::writeSample(out, bucketName.constData(), double(cumulative), prefix + "le=\"+Inf\"");
+    Metrics::writeSample(out, (QByteArray(name) + "_sum").constData(), totals.sumNs[histogram] / 1e9, labels);
+    Metrics::writeSample(out, (QByteArray(name) + "_count").constData(), double(cumulative), labels);
+}
+
+} // namespace
+
+void Metrics::add(Counter counter, quint64 value)
+{
+    bump(localShard().counters[counter], value);
+}
+
+void Metrics::messageIn(MessageType type)
+{
+    bump(localShard().messagesIn[type], 1);
+}
+
+void Metrics::messageOut(MessageType type)
+{
+    bump(localShard().messagesOut[type], 1);
+}
+
+void Metrics::observe(Histogram histogram, qint64 nanoseconds)
+{
+    Shard &shard = localShard();
+    bump(shard.buckets[histogram][bucketFor(nanoseconds)], 1);
+    bump(shard.sumNs[histogram], quint64(qMax<qint64>(0, nanoseconds)));
+}
+
+Metrics::MessageType Metrics::messageType(const QString &type)
+{
+    // 只读表，初始化后可在任意线程查询
+    static const QHash<QString, MessageType> types = {
+        {"message", PublicMessage},
+        {"private", PrivateMessage},
+        {"room_message", RoomMessage},
+        {"login", LoginMessage},
+        {"history", HistoryMessage},
+        {"room_history", HistoryMessage},
+        {"offline_messages", HistoryMessage},
+        {"search", SearchMessage},
+        {"search_results", SearchMessage},
+        {"newuser", PresenceMessage},
+        {"userdisconnected", PresenceMessage},
+        {"userlist", PresenceMessage},
+        {"presence", PresenceMessage},
+        {"presence_snapshot", PresenceMessage},
+        {"presence_sync", PresenceMessage},
+        {"join_room", RoomControlMessage},
+        {"leave_room", RoomControlMessage},
+        {"list_rooms", RoomControlMessage},
+        {"room_joined", RoomControlMessage},
+        {"room_left", RoomControlMessage},
+        {"room_list", RoomControlMessage},
+        {"room_member", RoomControlMessage},
+        {"error", ErrorMessage},
+        {"ping", HeartbeatMessage},
+        {"pong", HeartbeatMessage},
+    };
+    // 协议里的类型都是小写，大小写不同的才需要转换
+    const auto it = types.constFind(type);
+    if (it != types.constEnd())
+        return it.value();
+    return types.value(type.toLower(), OtherMessage);
+}
+
+const char *Metrics::messageTypeName(MessageType type)
+{
+    return type >= 0 && type < MessageTypeCount ? kMessageTypeNames[type] : "other";
+}
+
+void Metrics::writeHeader(QByteArray &out, const char *name, const char *type, const char *help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void Metrics::writeSample(QByteArray &out, const char *name, double value, const QByteArray &labels)
+{
+    out += name;
+    if (!labels.isEmpty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += QByteArray::number(value, 'g', 16);
+    out += '\n';
+}
+
+void Metrics::render(QByteArray &out)
+{
+    Totals totals;
+    collect(&totals);
+
+    // 名字相同的相邻项是同一个指标的不同标签，只输出一次说明
+    struct CounterInfo {
+        const char *name;
+        const char *labels;
+        const char *help;
+    };
+    static const CounterInfo counters[CounterCount] = {
+        {"chat_connections_accepted_total", "", "Accepted client connections"},
+        {"chat_connections_closed_total", "", "Closed client connections"},
+        {"chat_connections_rejected_total", "reason=\"full\"", "Connections refused by admission control"},
+        {"chat_connections_rejected_total", "reason=\"rate\"", "Connections refused by admission control"},
+        {"chat_connections_rejected_total", "reason=\"per_ip\"", "Connections refused by admission control"},
+        {"chat_handshake_timeouts_total", "", "Connections closed for not logging in in time"},
+        {"chat_accept_pauses_total", "", "Times accepting was paused to protect descriptors and memory"},
+        {"chat_heartbeat_pings_total", "", "Heartbeat pings sent to idle connections"},
+        {"chat_heartbeat_evictions_total", "", "Connections closed after missing heartbeats"},
+        {"chat_logins_total", "", "Successful logins"},
+        {"chat_logins_rejected_total", "", "Logins rejected because the name is taken"},
+        {"chat_received_bytes_total", "", "Bytes read from client sockets"},
+        {"chat_sent_bytes_total", "", "Bytes handed to client sockets"},
+        {"chat_received_frames_total", "", "Complete frames read from client sockets"},
+        {"chat_parse_errors_total", "", "Frames that could not be decoded or exceeded the size limit"},
+        {"chat_invalid_messages_total", "", "Decoded messages rejected by validation"},
+        {"chat_pipeline_dropped_total", "stage=\"decode\"", "Jobs dropped because a pipeline stage queue was full"},
+        {"chat_pipeline_dropped_total", "stage=\"validate\"", "Jobs dropped because a pipeline stage queue was full"},
+        {"chat_pipeline_dropped_total", "stage=\"route\"", "Jobs dropped because a pipeline stage queue was full"},
+        {"chat_pipeline_dropped_total", "stage=\"persist\"", "Jobs dropped because a pipeline stage queue was full"},
+        {"chat_pipeline_dropped_total", "stage=\"fanout\"", "Jobs dropped because a pipeline stage queue was full"},
+        {"chat_storage_records_total", "", "Log records committed by the writer thread"},
+        {"chat_storage_batches_total", "", "Batches committed by the writer thread"},
+    };
+    for (int i = 0; i < CounterCount; ++i) {
+        if (i == 0 || qstrcmp(counters[i].name, counters[i - 1].name) != 0)
+            writeHeader(out, counters[i].name, "counter", counters[i].help);
+        writeSample(out, counters[i].name, double(totals.counters[i]), QByteArray(counters[i].labels));
+    }
+
+    writeHeader(out, "chat_messages_received_total", "counter", "Messages received from clients by type");
+    for (int i = 0; i < MessageTypeCount; ++i) {
+        writeSample(out, "chat_messages_received_total", double(totals.messagesIn[i]),
+                    QByteArray("type=\"") + kMessageTypeNames[i] + '"');
+    }
+    writeHeader(out, "chat_messages_sent_total", "counter", "Messages queued to client connections by type");
+    for (int i = 0; i < MessageTypeCount; ++i) {
+        writeSample(out, "chat_messages_sent_total", double(totals.messagesOut[i]),
+                    QByteArray("type=\"") + kMessageTypeNames[i] + '"');
+    }
+
+    writeHeader(out, "chat_fanout_delivery_seconds", "histogram",
+                "Time an I/O thread spends handing one broadcast or multicast to its connections");
+    writeHistogram(out, "chat_fanout_delivery_seconds", totals, FanOutDelivery, QByteArray());
+    writeHeader(out, "chat_storage_write_seconds", "histogram", "Time to write and flush one log batch");
+    writeHistogram(out, "chat_storage_write_seconds", totals, StorageWrite, QByteArray());
+    writeHeader(out, "chat_pipeline_latency_seconds", "histogram",
+                "Time from submitting a pipeline job to finishing it, by stage");
+    for (int h = StageLatency; h < HistogramCount; ++h) {
+        writeHistogram(out, "chat_pipeline_latency_seconds", totals, h,
+                       QByteArray("stage=\"") + kStageNames[h - StageLatency] + '"');
+    }
+}
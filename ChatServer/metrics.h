@@ -0,0 +1,106 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+#include <chrono>
+
+// 进程内的计数器和直方图，按 Prometheus 文本格式导出。
+//
+// 每个线程第一次记录时领取一个私有分片，之后只写自己的分片：计数加一是一次普通的
+// relaxed load + store，没有锁，也没有跨核的原子读改写，热路径上只有几纳秒。
+// 导出时遍历所有分片求和，读到的是各线程最近写入的值。线程退出后分片交给下一个新线程继续使用，
+// 累计值不会丢失，分片总数不超过同时存在过的线程数。
+//
+// 直方图的桶按 2 的幂划分（1us、2us、4us ... 约 16s），记录时只需要一次前导零计数。
+class Metrics
+{
+public:
+    enum Counter {
+        ConnectionsAccepted,
+        ConnectionsClosed,
+        RejectedFull,       // 准入控制拒绝的连接，按原因分开
+        RejectedRate,
+        RejectedPerIp,
+        HandshakeTimeouts,  // 接入后超时未登录被断开
+        AcceptPauses,       // 描述符耗尽或积压过多时暂停接入
+        HeartbeatPings,
+        HeartbeatEvictions, // 连续多次心跳没有回应而断开
+        LoginsAccepted,
+        LoginsRejected,
+        BytesIn,
+        BytesOut,
+        FramesIn,
+        ParseErrors,        // JSON/二进制解码失败、帧超长
+        InvalidMessages,    // 字段校验失败
+        DroppedDecode,      // 流水线某一阶段队列已满而丢弃的任务，按阶段分开
+        DroppedValidate,
+        DroppedRoute,
+        DroppedPersist,
+        DroppedFanOut,
+        StorageRecords,     // 写入线程提交的记录数
+        StorageBatches,
+        CounterCount
+    };
+
+    // 按消息的 type 字段分类，未列出的类型计入 Other
+    enum MessageType {
+        PublicMessage,
+        PrivateMessage,
+        RoomMessage,
+        LoginMessage,
+        HistoryMessage,
+        SearchMessage,
+        PresenceMessage,
+        RoomControlMessage,
+        ErrorMessage,
+        HeartbeatMessage,
+        OtherMessage,
+        MessageTypeCount
+    };
+
+    enum Histogram {
+        FanOutDelivery,     // 一个 I/O 线程把一条广播或组播交给各连接的耗时
+        StorageWrite,       // 写入线程提交一批记录（写文件、刷新、可选的 fdatasync）的耗时
+        StageLatency,       // 流水线各阶段从提交到执行完成，后面依次是各阶段
+        HistogramCount = StageLatency + 6
+    };
+
+    static void add(Counter counter, quint64 value = 1);
+    static void messageIn(MessageType type);
+    static void messageOut(MessageType type);
+    static void observe(Histogram histogram, qint64 nanoseconds);
+
+    static MessageType messageType(const QString &type);
+    static const char *messageTypeName(MessageType type);
+
+    static qint64 nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 作用域结束时把耗时记入直方图
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Histogram histogram) : m_histogram(histogram), m_start(nowNs()) {}
+        ~ScopedTimer() { observe(m_histogram, nowNs() - m_start); }
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+        Histogram m_histogram;
+        qint64 m_start;
+    };
+
+    // 追加本类记录的全部计数器和直方图
+    static void render(QByteArray &out);
+
+    // 供调用方追加自己的指标；labels 形如 stage="route"，可以为空
+    static void writeHeader(QByteArray &out, const char *name, const char *type, const char *help);
+    static void writeSample(QByteArray &out, const char *name, double value, const QByteArray &labels = QByteArray());
+};
+
+#endif // METRICS_H
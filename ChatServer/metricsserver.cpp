@@ -0,0 +1,75 @@
+#include "metricsserver.h"
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace {
+
+// 请求头的上限，超出说明不是抓取请求
+const int kMaxRequestBytes = 8 * 1024;
+// 客户端迟迟不发完请求头时断开
+const int kRequestTimeoutMs = 5000;
+
+} // namespace
+
+MetricsServer::MetricsServer(Renderer renderer, QObject *parent)
+    : QTcpServer(parent)
+{
+    addRoute("/metrics", "text/plain; version=0.0.4; charset=utf-8", std::move(renderer));
+    connect(this, &QTcpServer::newConnection, this, &MetricsServer::onNewConnection);
+}
+
+void MetricsServer::addRoute(const QByteArray &path, const QByteArray &contentType, Renderer renderer)
+{
+    m_routes.insert(path, Route{contentType, std::move(renderer)});
+}
+
+void MetricsServer::onNewConnection()
+{
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        QTimer::singleShot(kRequestTimeoutMs, socket, [socket]() { socket->abort(); });
+    }
+}
+
+void MetricsServer::onReadyRead(QTcpSocket *socket)
+{
+    // 数据还留在套接字里，等请求头收齐再一次取出
+    const QByteArray pending = socket->peek(kMaxRequestBytes + 1);
+    if (!pending.contains("\r\n\r\n") && !pending.contains("\n\n")) {
+        if (pending.size() > kMaxRequestBytes)
+            socket->abort();
+        return;
+    }
+    const QByteArray request = socket->readAll();
+    disconnect(socket, &QTcpSocket::readyRead, this, nullptr);
+
+    const QList<QByteArray> requestLine = request.left(request.indexOf('\n')).trimmed().split(' ');
+    const QByteArray method = requestLine.value(0);
+    QByteArray path = requestLine.value(1);
+    const qsizetype query = path.indexOf('?');
+    if (query >= 0)
+        path.truncate(query);
+
+    if (method != "GET") {
+        reply(socket, "405 Method Not Allowed", "text/plain", "method not allowed\n");
+    } else if (!m_routes.contains(path)) {
+        reply(socket, "404 Not Found", "text/plain", "see /metrics\n");
+    } else {
+        const Route route = m_routes.value(path);
+        reply(socket, "200 OK", route.contentType, route.renderer ? route.renderer() : QByteArray());
+    }
+}
+
+void MetricsServer::reply(QTcpSocket *socket, const QByteArray &status, const QByteArray &contentType,
+                          const QByteArray &body)
+{
+    QByteArray response = "HTTP/1.1 " + status + "\r\n";
+    response += "Content-Type: " + contentType + "\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+    socket->write(response);
+    // 写完后断开，disconnected 时释放套接字
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,37 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QTcpServer>
+#include <QByteArray>
+#include <QHash>
+#include <functional>
+
+class QTcpSocket;
+
+// 最小的 HTTP 服务：GET /metrics 返回 Prometheus 文本格式，另外可以登记其他只读或管理用的路径。
+// 运行在创建它的线程（ChatServer 线程）中，渲染函数可以直接读取只在该线程访问的状态。
+// 每个请求读到空行即回复并关闭连接，不支持 keep-alive。
+class MetricsServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    using Renderer = std::function<QByteArray()>;
+
+    explicit MetricsServer(Renderer renderer, QObject *parent = nullptr);
+    // path 不含查询参数，例如 "/trace"
+    void addRoute(const QByteArray &path, const QByteArray &contentType, Renderer renderer);
+
+private:
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+    static void reply(QTcpSocket *socket, const QByteArray &status, const QByteArray &contentType,
+                      const QByteArray &body);
+
+    struct Route {
+        QByteArray contentType;
+        Renderer renderer;
+    };
+    QHash<QByteArray, Route> m_routes;
+};
+
+#endif // METRICSSERVER_H
@@ -0,0 +1,87 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+
+// 无锁多生产者单消费者队列（Vyukov 侵入式链表算法）。
+// push 可在任意线程并发调用，只需一次原子交换；pop 只能由单一消费者线程调用。
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : m_head(&m_stub), m_tail(&m_stub)
+    {
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value)) {
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T value)
+    {
+        Node *node = new Node;
+        node->value = std::move(value);
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // 队列为空（或生产者正在链接新节点）时返回 false
+    bool pop(T &value)
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (tail == &m_stub) {
+            if (!next)
+                return false;
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            m_tail = next;
+            value = std::move(tail->value);
+            delete tail;
+            return true;
+        }
+
+        if (tail != m_head.load(std::memory_order_acquire))
+            return false;
+
+        // 只剩最后一个节点，重新挂上哨兵节点后再取出
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+        Node *prev = m_head.exchange(&m_stub, std::memory_order_acq_rel);
+        prev->next.store(&m_stub, std::memory_order_release);
+
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            m_tail = next;
+            value = std::move(tail->value);
+            delete tail;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    std::atomic<Node*> m_head;   // 生产者端
+    Node *m_tail;                // 消费者端
+    Node m_stub;
+};
+
+#endif // MPSCQUEUE_H
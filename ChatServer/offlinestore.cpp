@@ -0,0 +1,252 @@
+#include "offlinestore.h"
+#include "serverlog.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+namespace {
+
+const char kQueueSuffix[] = ".q";
+const char kKnownUsersFile[] = "known_users";
+
+// 用户名可能包含任意字符，文件名用 UTF-8 的十六进制
+QString encodeName(const QString &name)
+{
+    return QString::fromLatin1(name.toUtf8().toHex());
+}
+
+void writeMessage(QDataStream &out, const OfflineStore::Message &message)
+{
+    out << message.timestampMs << message.sender << message.text;
+}
+
+} // namespace
+
+bool OfflineStore::open(const QString &directory)
+{
+    m_directory = directory;
+    m_counts.clear();
+    m_knownUsers.clear();
+    m_delivering.clear();
+
+    QDir dir;
+    if (!dir.mkpath(directory)) {
+        ServerLog::warning("offline", QString("无法创建离线消息目录: %1").arg(directory));
+        return false;
+    }
+
+    const QStringList files = QDir(directory).entryList({QString("*") + kQueueSuffix}, QDir::Files);
+    for (const QString &file : files) {
+        const QByteArray hex = file.left(file.size() - int(sizeof(kQueueSuffix) - 1)).toLatin1();
+        const QString name = QString::fromUtf8(QByteArray::fromHex(hex));
+        if (!name.isEmpty()) {
+            m_counts.insert(name, -1);
+            m_knownUsers.insert(name);
+        }
+    }
+
+    QFile known(QDir(directory).filePath(kKnownUsersFile));
+    if (known.open(QIODevice::ReadOnly)) {
+        while (!known.atEnd()) {
+            const QByteArray hex = known.readLine().trimmed();
+            if (!hex.isEmpty())
+                m_knownUsers.insert(QString::fromUtf8(QByteArray::fromHex(hex)));
+        }
+    }
+    return true;
+}
+
+void OfflineStore::addKnownUser(const QString &name)
+{
+    if (m_directory.isEmpty() || name.isEmpty() || m_knownUsers.contains(name))
+        return;
+    m_knownUsers.insert(name);
+
+    QFile known(QDir(m_directory).filePath(kKnownUsersFile));
+    if (!known.open(QIODevice::WriteOnly | QIODevice::Append)
+        || known.write(encodeName(name).toLatin1() + '\n') < 0)
+        ServerLog::warning("offline", QString("无法写入已知用户列表: %1").arg(known.fileName()));
+}
+
+void OfflineStore::setLimits(int maxMessages, int maxAgeDays, int maxRecipients)
+{
+    m_maxMessages = qMax(1, maxMessages);
+    m_maxAgeMs = qint64(qMax(1, maxAgeDays)) * 24 * 3600 * 1000;
+    m_maxRecipients = qMax(1, maxRecipients);
+}
+
+QString OfflineStore::pathFor(const QString &receiver) const
+{
+    return QDir(m_directory).filePath(encodeName(receiver) + kQueueSuffix);
+}
+
+OfflineStore::EnqueueResult OfflineStore::enqueue(const QString &receiver, const QString &sender,
+                                                  const QString &text, qint64 timestampMs)
+{
+    if (m_directory.isEmpty())
+        return Rejected;
+    if (!m_knownUsers.contains(receiver))
+        return UnknownRecipient;
+
+    auto it = m_counts.find(receiver);
+    if (it == m_counts.end()) {
+        if (m_counts.size() >= m_maxRecipients)
+            return Rejected;
+        it = m_counts.insert(receiver, 0);
+    } else if (it.value() < 0) {
+        it.value() = recoverQueue(receiver);
+    }
+
+    QFile file(pathFor(receiver));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        ServerLog::warning("offline", QString("无法写入离线消息: %1").arg(file.fileName()));
+        return Rejected;
+    }
+    const qint64 previousSize = file.size();
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    writeMessage(out, Message{timestampMs, sender, text});
+    if (out.status() != QDataStream::Ok || !file.flush()) {
+        // 写了一半的记录会挡住之后追加的记录，退回到写入前的长度
+        ServerLog::warning("offline", QString("写入离线消息失败: %1").arg(file.fileName()));
+        file.resize(previousSize);
+        return Rejected;
+    }
+    file.close();
+    ++it.value();
+
+    // 超出上限一定比例才重写，避免每条消息都重写整个文件
+    if (it.value() <= m_maxMessages + m_maxMessages / 4)
+        return Queued;
+
+    QVector<Message> messages = readQueue(receiver);
+    trim(messages);
+    rewriteQueue(receiver, messages);
+    m_counts[receiver] = int(messages.size());
+    return QueuedDroppedOldest;
+}
+
+QVector<OfflineStore::Message> OfflineStore::pending(const QString &receiver, int *records)
+{
+    *records = 0;
+    auto it = m_counts.constFind(receiver);
+    if (it == m_counts.constEnd() || m_delivering.contains(receiver))
+        return {};
+    if (it.value() < 0)
+        recoverQueue(receiver);
+
+    QVector<Message> messages = readQueue(receiver);
+    *records = int(messages.size());
+    m_counts[receiver] = *records;
+    trim(messages);
+    if (!messages.isEmpty())
+        m_delivering.insert(receiver);
+    return messages;
+}
+
+void OfflineStore::release(const QString &receiver)
+{
+    m_delivering.remove(receiver);
+}
+
+void OfflineStore::acknowledge(const QString &receiver, int records)
+{
+    auto it = m_counts.find(receiver);
+    if (it == m_counts.end() || records <= 0)
+        return;
+    m_delivering.remove(receiver);
+
+    if (it.value() >= 0 && it.value() <= records) {
+        QFile::remove(pathFor(receiver));
+        m_counts.erase(it);
+        return;
+    }
+
+    // 读出之后又有新消息追加，只去掉已经送出的部分
+    QVector<Message> messages = readQueue(receiver);
+    messages.remove(0, qMin<qsizetype>(records, messages.size()));
+    if (messages.isEmpty()) {
+        QFile::remove(pathFor(receiver));
+        m_counts.erase(it);
+        return;
+    }
+    if (!rewriteQueue(receiver, messages)) {
+        ServerLog::warning("offline", QString("无法重写离线消息: %1").arg(pathFor(receiver)));
+        it.value() = -1;   // 文件保持原样，下次使用时重新统计
+        return;
+    }
+    it.value() = int(messages.size());
+}
+
+int OfflineStore::pendingCount(const QString &receiver)
+{
+    auto it = m_counts.find(receiver);
+    if (it == m_counts.end())
+        return 0;
+    if (it.value() < 0)
+        it.value() = recoverQueue(receiver);
+    return it.value();
+}
+
+int OfflineStore::recoverQueue(const QString &receiver)
+{
+    qint64 validSize = 0;
+    const int records = int(readQueue(receiver, &validSize).size());
+
+    // 崩溃留下的半条记录之后再追加，新记录永远读不到，先截掉
+    QFile file(pathFor(receiver));
+    if (file.exists() && file.size() > validSize) {
+        ServerLog::warning("offline", QString("离线消息文件末尾有不完整的记录，已截断: %1").arg(file.fileName()));
+        if (!file.resize(validSize))
+            ServerLog::warning("offline", QString("无法截断离线消息: %1").arg(file.fileName()));
+    }
+    return records;
+}
+
+QVector<OfflineStore::Message> OfflineStore::readQueue(const QString &receiver, qint64 *validSize) const
+{
+    QVector<Message> messages;
+    if (validSize)
+        *validSize = 0;
+    QFile file(pathFor(receiver));
+    if (!file.open(QIODevice::ReadOnly))
+        return messages;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    while (!in.atEnd()) {
+        Message message;
+        in >> message.timestampMs >> message.sender >> message.text;
+        if (in.status() != QDataStream::Ok)
+            break;   // 尾部不完整的记录
+        messages.append(message);
+        if (validSize)
+            *validSize = file.pos();
+    }
+    return messages;
+}
+
+bool OfflineStore::rewriteQueue(const QString &receiver, const QVector<Message> &messages)
+{
+    QSaveFile file(pathFor(receiver));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    for (const Message &message : messages)
+        writeMessage(out, message);
+    return file.commit();
+}
+
+void OfflineStore::trim(QVector<Message> &messages) const
+{
+    const qint64 oldest = QDateTime::currentMSecsSinceEpoch() - m_maxAgeMs;
+    qsizetype first = 0;
+    while (first < messages.size() && messages.at(first).timestampMs < oldest)
+        ++first;
+    first = qMax(first, messages.size() - m_maxMessages);
+    if (first > 0)
+        messages.remove(0, first);
+}
@@ -0,0 +1,83 @@
+#ifndef OFFLINESTORE_H
+#define OFFLINESTORE_H
+
+#include <QString>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+// 离线私聊的存储转发队列：每个接收者一个追加式文件，位于存储目录的 offline/ 下。
+//
+// 记录用 QDataStream 顺序写入（i64 毫秒时间戳、发送者、正文），
+// 上线时整个文件顺序读一遍就能取出全部消息，与积压条数成线性关系，不需要索引。
+// 队列有条数和保存时间上限：超过条数上限 1/4 后整体重写一次，只保留最新的记录，
+// 过期记录在重写和取出时丢弃。崩溃留下的半条记录在第一次使用该队列时截掉，
+// 写入失败时退回到写入前的长度，新记录不会追加在半条记录之后。
+//
+// 只为登录过的用户建立队列：名字记在 known_users 中（每行一个十六进制编码的名字），
+// 发给从未登录过的名字的私聊直接拒绝，编造大量名字不会占满接收者上限。
+//
+// 不加锁，所有调用都应在同一个串行通道（持久化阶段）中进行。
+class OfflineStore
+{
+public:
+    struct Message {
+        qint64 timestampMs = 0;
+        QString sender;
+        QString text;
+    };
+
+    enum EnqueueResult {
+        Queued,
+        QueuedDroppedOldest,   // 已满，最早的记录被挤出
+        Rejected,              // 接收者数量已达上限或写入失败
+        UnknownRecipient       // 接收者从未登录过
+    };
+
+    OfflineStore() = default;
+    OfflineStore(const OfflineStore &) = delete;
+    OfflineStore &operator=(const OfflineStore &) = delete;
+
+    // 打开（或创建）目录并登记已有的队列
+    bool open(const QString &directory);
+
+    void setLimits(int maxMessages, int maxAgeDays, int maxRecipients);
+    int maxMessages() const { return m_maxMessages; }
+
+    // 登录时调用，之后才能为该用户排队
+    void addKnownUser(const QString &name);
+    bool isKnownUser(const QString &name) const { return m_knownUsers.contains(name); }
+
+    EnqueueResult enqueue(const QString &receiver, const QString &sender, const QString &text, qint64 timestampMs);
+    // 读出该用户的全部未过期消息，旧的在前，文件保持不变。records 为此时文件中的记录数。
+    // 消息进入接收者的发送队列后再调用 acknowledge 删除这些记录，投递失败时调用 release，
+    // 记录留到下次登录重发，所以同一条消息可能送达不止一次。
+    // 返回非空时该用户进入投递中状态，acknowledge 或 release 之前再次调用返回空，
+    // 避免两次投递各自确认时删掉之后追加的记录
+    QVector<Message> pending(const QString &receiver, int *records);
+    // 删除最早的 records 条记录，之后追加的记录保留
+    void acknowledge(const QString &receiver, int records);
+    // 放弃这次投递，记录保持不变
+    void release(const QString &receiver);
+    int pendingCount(const QString &receiver);
+    int recipientCount() const { return m_counts.size(); }
+
+private:
+    QString pathFor(const QString &receiver) const;
+    // validSize 非空时返回最后一条完整记录的结束位置
+    QVector<Message> readQueue(const QString &receiver, qint64 *validSize = nullptr) const;
+    // 截掉末尾不完整的记录并返回记录数，第一次使用某个队列前调用
+    int recoverQueue(const QString &receiver);
+    bool rewriteQueue(const QString &receiver, const QVector<Message> &messages);
+    void trim(QVector<Message> &messages) const;
+
+    QString m_directory;
+    int m_maxMessages = 1000;
+    qint64 m_maxAgeMs = 7LL * 24 * 3600 * 1000;
+    int m_maxRecipients = 10000;
+    QHash<QString, int> m_counts;   // 接收者 -> 文件中的记录数，-1 表示还没有统计
+    QSet<QString> m_knownUsers;
+    QSet<QString> m_delivering;     // 已取出、等待确认的接收者
+};
+
+#endif // OFFLINESTORE_H
@@ -0,0 +1,104 @@
+#include "recentcache.h"
+
+RecentMessageCache::RecentMessageCache(int perConversation, qint64 maxBytes)
+    : m_rings(qMax<qint64>(0, maxBytes))
+    , m_perConversation(qMax(0, perConversation))
+{
+}
+
+RecentMessageCache::~RecentMessageCache() = default;
+
+void RecentMessageCache::setLimits(int perConversation, qint64 maxBytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_perConversation = qMax(0, perConversation);
+    if (m_perConversation == 0)
+        m_rings.clear();
+    m_rings.setMaxCost(qMax<qint64>(0, maxBytes));
+}
+
+bool RecentMessageCache::isEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_perConversation > 0 && m_rings.maxCost() > 0;
+}
+
+qint64 RecentMessageCache::sizeOf(const Message &message)
+{
+    // QString 按 UTF-16 存储，另加每条记录的固定开销
+    return 2 * (message.sender.size() + message.target.size() + message.text.size()) + 96;
+}
+
+void RecentMessageCache::append(const QString &key, const Message &message)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_perConversation == 0)
+        return;
+
+    // 先取出再放回：更新代价，同时把该会话移到 LRU 的最新端
+    Ring *ring = m_rings.take(key);
+    if (!ring)
+        ring = new Ring;
+
+    ring->messages.push_back(message);
+    ring->bytes += sizeOf(message);
+    while (int(ring->messages.size()) > m_perConversation) {
+        ring->bytes -= sizeOf(ring->messages.front());
+        ring->messages.pop_front();
+    }
+
+    // 单个会话超过总上限时 insert 直接丢弃它
+    m_rings.insert(key, ring, ring->bytes);
+}
+
+bool RecentMessageCache::recent(const QString &key, int limit, QVector<Message> *messages)
+{
+    QMutexLocker locker(&m_mutex);
+    const Ring *ring = m_rings.object(key);
+    if (!ring || limit <= 0 || int(ring->messages.size()) < limit) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    messages->clear();
+    messages->reserve(limit);
+    for (auto it = ring->messages.crbegin(); it != ring->messages.crend() && messages->size() < limit; ++it)
+        messages->append(*it);
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void RecentMessageCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_rings.clear();
+}
+
+RecentMessageCache::Stats RecentMessageCache::stats() const
+{
+    Stats stats;
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+
+    QMutexLocker locker(&m_mutex);
+    stats.conversations = int(m_rings.size());
+    stats.bytes = m_rings.totalCost();
+    return stats;
+}
+
+QString RecentMessageCache::publicKey()
+{
+    return QStringLiteral("public");
+}
+
+QString RecentMessageCache::privateKey(const QString &user1, const QString &user2)
+{
+    // 两个方向是同一个会话
+    return user1 < user2 ? "private\n" + user1 + '\n' + user2
+                         : "private\n" + user2 + '\n' + user1;
+}
+
+QString RecentMessageCache::roomKey(const QString &room)
+{
+    return "room\n" + room;
+}
@@ -0,0 +1,68 @@
+#ifndef RECENTCACHE_H
+#define RECENTCACHE_H
+
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <deque>
+
+// 每个会话（公共聊天、两人私聊、聊天室）最近 K 条消息的内存缓存。
+//
+// 由写入路径在追加日志的同时填充，顺序与日志文件一致。会话第一次写入时才创建，
+// 所以只能保证“创建之后的每一条都在”：请求的条数不超过已缓存的条数时才算命中。
+// 所有会话按 LRU 共享一个总内存上限，被淘汰的会话下次写入时重新开始累积。
+// 可在任意线程调用，内部一把互斥锁，临界区只做哈希查找和少量复制。
+class RecentMessageCache
+{
+public:
+    struct Message {
+        qint64 timestampMs = 0;
+        QString sender;
+        QString target;     // 私聊的接收者或聊天室名，公共聊天为空
+        QString text;
+    };
+
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        int conversations = 0;
+        qint64 bytes = 0;
+    };
+
+    explicit RecentMessageCache(int perConversation = 500, qint64 maxBytes = 32 * 1024 * 1024);
+    ~RecentMessageCache();
+    RecentMessageCache(const RecentMessageCache &) = delete;
+    RecentMessageCache &operator=(const RecentMessageCache &) = delete;
+
+    // perConversation 为 0 时关闭缓存
+    void setLimits(int perConversation, qint64 maxBytes);
+    bool isEnabled() const;
+
+    void append(const QString &key, const Message &message);
+    // 缓存覆盖了该会话最新的 limit 条时返回 true，messages 中最新的在前
+    bool recent(const QString &key, int limit, QVector<Message> *messages);
+    void clear();
+    Stats stats() const;
+
+    static QString publicKey();
+    static QString privateKey(const QString &user1, const QString &user2);
+    static QString roomKey(const QString &room);
+
+private:
+    struct Ring {
+        std::deque<Message> messages;   // 旧的在前
+        qint64 bytes = 0;
+    };
+
+    static qint64 sizeOf(const Message &message);
+
+    mutable QMutex m_mutex;
+    QCache<QString, Ring> m_rings;      // 代价为字节数
+    int m_perConversation;
+    std::atomic<quint64> m_hits{0};
+    std::atomic<quint64> m_misses{0};
+};
+
+#endif // RECENTCACHE_H
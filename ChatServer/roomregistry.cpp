@@ -0,0 +1,90 @@
+#include "roomregistry.h"
+#include <algorithm>
+
+bool RoomRegistry::isValidName(const QString &room)
+{
+    if (room.isEmpty() || room.size() > kMaxNameLength)
+        return false;
+    for (const QChar ch : room) {
+        if (ch.isSpace() || ch.category() == QChar::Other_Control
+            || ch == QLatin1Char('[') || ch == QLatin1Char(']'))
+            return false;
+    }
+    return true;
+}
+
+bool RoomRegistry::join(const QString &room, const IoThreadPool::Recipient &member)
+{
+    QStringList &joined = m_memberships[member.worker];
+    if (joined.contains(room))
+        return false;
+
+    // 扇出阶段可能还持有旧列表，append 会先复制出新列表，旧快照不受影响
+    m_rooms[room].append(member);
+    joined.append(room);
+    return true;
+}
+
+bool RoomRegistry::leave(const QString &room, ServerWorker *worker)
+{
+    const auto membership = m_memberships.find(worker);
+    if (membership == m_memberships.end() || !membership->removeOne(room))
+        return false;
+    if (membership->isEmpty())
+        m_memberships.erase(membership);
+
+    const auto it = m_rooms.find(room);
+    if (it == m_rooms.end())
+        return true;
+
+    Members &members = it.value();
+    members.erase(std::remove_if(members.begin(), members.end(),
+                                 [worker](const IoThreadPool::Recipient &member) {
+                                     return member.worker == worker;
+                                 }),
+                  members.end());
+    if (members.isEmpty())
+        m_rooms.erase(it);
+    return true;
+}
+
+QStringList RoomRegistry::leaveAll(ServerWorker *worker)
+{
+    const QStringList joined = m_memberships.value(worker);
+    for (const QString &room : joined)
+        leave(room, worker);
+    return joined;
+}
+
+bool RoomRegistry::isMember(const QString &room, ServerWorker *worker) const
+{
+    const auto it = m_memberships.constFind(worker);
+    return it != m_memberships.constEnd() && it->contains(room);
+}
+
+RoomRegistry::Members RoomRegistry::members(const QString &room) const
+{
+    return m_rooms.value(room);
+}
+
+QStringList RoomRegistry::roomsOf(ServerWorker *worker) const
+{
+    return m_memberships.value(worker);
+}
+
+QVector<RoomRegistry::RoomInfo> RoomRegistry::rooms() const
+{
+    QVector<RoomInfo> result;
+    result.reserve(m_rooms.size());
+    for (auto it = m_rooms.constBegin(); it != m_rooms.constEnd(); ++it)
+        result.append(RoomInfo{it.key(), int(it.value().size())});
+    std::sort(result.begin(), result.end(), [](const RoomInfo &a, const RoomInfo &b) {
+        return a.name < b.name;
+    });
+    return result;
+}
+
+int RoomRegistry::roomCount() const
+{
+    return m_rooms.size();
+}
@@ -0,0 +1,54 @@
+#ifndef ROOMREGISTRY_H
+#define ROOMREGISTRY_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "iothreadpool.h"
+
+class ServerWorker;
+
+// 聊天室 -> 成员表，只在 ChatServer 所在线程（路由阶段）访问。
+// 成员列表是隐式共享的 QVector：路由阶段把发送时刻的列表交给扇出阶段，
+// 之后的加入和退出只会在路由线程复制出新列表，扇出不需要加锁，也不会等待成员变化。
+// 消息只投递给该房间的成员，与其他房间和空闲连接的数量无关。
+class RoomRegistry
+{
+public:
+    using Members = QVector<IoThreadPool::Recipient>;
+
+    struct RoomInfo {
+        QString name;
+        int members = 0;
+    };
+
+    static const int kMaxNameLength = 32;
+    static const int kMaxRoomsPerUser = 64;
+
+    RoomRegistry() = default;
+    RoomRegistry(const RoomRegistry &) = delete;
+    RoomRegistry &operator=(const RoomRegistry &) = delete;
+
+    // 房间名不能为空、过长，也不能包含空白、方括号或控制字符（日志按 [ROOM][名字] 匹配）
+    static bool isValidName(const QString &room);
+
+    // 已经是成员时返回 false
+    bool join(const QString &room, const IoThreadPool::Recipient &member);
+    // 不是成员时返回 false，最后一个成员离开后房间被删除
+    bool leave(const QString &room, ServerWorker *worker);
+    // 连接断开时调用，返回它离开的房间
+    QStringList leaveAll(ServerWorker *worker);
+
+    bool isMember(const QString &room, ServerWorker *worker) const;
+    Members members(const QString &room) const;
+    QStringList roomsOf(ServerWorker *worker) const;
+    QVector<RoomInfo> rooms() const;
+    int roomCount() const;
+
+private:
+    QHash<QString, Members> m_rooms;
+    QHash<ServerWorker*, QStringList> m_memberships;
+};
+
+#endif // ROOMREGISTRY_H
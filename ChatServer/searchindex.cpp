@@ -0,0 +1,607 @@
+#include "searchindex.h"
+#include "serverlog.h"
+#include "wireprotocol.h"
+#include <QDataStream>
+#include <QDir>
+#include <QSaveFile>
+#include <QRegularExpression>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char kIndexMagic[] = "CHATIDX1";
+const int kMagicSize = 8;
+// 魔数 | u64 首个文档编号 | u32 文档数 | u32 词元数 | u64 词典偏移 | u64 文档表偏移 | u64 文件长度
+const int kHeaderSize = 64;
+// 词典项：u64 词元偏移 | u32 词元长度 | u32 文档数 | u64 倒排表偏移 | u32 倒排表字节数 | u32 保留
+const int kTermEntrySize = 32;
+const char kJournalName[] = "active.journal";
+const int kJournalFlushInterval = 256;
+const int kMaxWordLength = 64;
+
+bool isCjk(char16_t c)
+{
+    return (c >= 0x3040 && c <= 0x30FF)      // 平假名、片假名
+           || (c >= 0x3400 && c <= 0x4DBF)   // 扩展 A
+           || (c >= 0x4E00 && c <= 0x9FFF)   // 基本汉字
+           || (c >= 0xAC00 && c <= 0xD7AF)   // 谚文音节
+           || (c >= 0xF900 && c <= 0xFAFF);  // 兼容汉字
+}
+
+void writeString(QByteArray &out, const QString &text)
+{
+    const QByteArray utf8 = text.toUtf8();
+    WireProtocol::writeVarint(out, quint64(utf8.size()));
+    out.append(utf8);
+}
+
+bool readString(const char *&cursor, const char *end, QString *text)
+{
+    quint64 size = 0;
+    if (!WireProtocol::readVarint(cursor, end, &size) || size > quint64(end - cursor))
+        return false;
+    *text = QString::fromUtf8(cursor, qsizetype(size));
+    cursor += size;
+    return true;
+}
+
+void appendU32(QByteArray &out, quint32 value)
+{
+    char buffer[4];
+    qToLittleEndian<quint32>(value, buffer);
+    out.append(buffer, 4);
+}
+
+void appendU64(QByteArray &out, quint64 value)
+{
+    char buffer[8];
+    qToLittleEndian<quint64>(value, buffer);
+    out.append(buffer, 8);
+}
+
+QString segmentFileName(quint64 firstDocId)
+{
+    // 十六进制补齐，文件名顺序即文档编号顺序
+    return QString("seg_%1.idx").arg(firstDocId, 16, 16, QLatin1Char('0'));
+}
+
+// 单次查询最多检查的候选数，约为几十毫秒的扫描
+const int kMaxScannedPostings = 20000;
+
+} // namespace
+
+// 一个只读的段文件，整体 mmap
+class SearchIndex::Segment
+{
+public:
+    ~Segment()
+    {
+        if (m_base)
+            m_file.unmap(m_base);
+    }
+
+    static std::unique_ptr<Segment> load(const QString &path)
+    {
+        std::unique_ptr<Segment> segment(new Segment);
+        segment->m_file.setFileName(path);
+        if (!segment->m_file.open(QIODevice::ReadOnly))
+            return nullptr;
+        segment->m_size = segment->m_file.size();
+        if (segment->m_size < kHeaderSize)
+            return nullptr;
+        segment->m_base = segment->m_file.map(0, segment->m_size);
+        if (!segment->m_base)
+            return nullptr;
+
+        const uchar *base = segment->m_base;
+        if (std::memcmp(base, kIndexMagic, kMagicSize) != 0
+            || qFromLittleEndian<quint64>(base + 40) != quint64(segment->m_size))
+            return nullptr;
+
+        segment->m_firstDocId = qFromLittleEndian<quint64>(base + 8);
+        segment->m_docCount = qFromLittleEndian<quint32>(base + 16);
+        segment->m_termCount = qFromLittleEndian<quint32>(base + 20);
+        segment->m_termTable = qFromLittleEndian<quint64>(base + 24);
+        segment->m_docTable = qFromLittleEndian<quint64>(base + 32);
+        if (segment->m_termTable + quint64(segment->m_termCount) * kTermEntrySize > quint64(segment->m_size)
+            || segment->m_docTable + quint64(segment->m_docCount) * 8 > quint64(segment->m_size))
+            return nullptr;
+        return segment;
+    }
+
+    quint64 firstDocId() const { return m_firstDocId; }
+    quint32 docCount() const { return m_docCount; }
+
+    // 词典按字节序排列，二分查找
+    bool postings(const QByteArray &term, QVector<quint32> *out) const
+    {
+        quint32 low = 0;
+        quint32 high = m_termCount;
+        while (low < high) {
+            const quint32 mid = low + (high - low) / 2;
+            const uchar *entry = m_base + m_termTable + quint64(mid) * kTermEntrySize;
+            const quint64 keyOffset = qFromLittleEndian<quint64>(entry);
+            const quint32 keyLength = qFromLittleEndian<quint32>(entry + 8);
+            const int cmp = compare(reinterpret_cast<const char *>(m_base + keyOffset), keyLength, term);
+            if (cmp < 0) {
+                low = mid + 1;
+            } else if (cmp > 0) {
+                high = mid;
+            } else {
+                const quint32 count = qFromLittleEndian<quint32>(entry + 12);
+                const quint64 offset = qFromLittleEndian<quint64>(entry + 16);
+                const quint32 bytes = qFromLittleEndian<quint32>(entry + 24);
+                if (offset + bytes > quint64(m_size))
+                    return false;
+                const char *cursor = reinterpret_cast<const char *>(m_base + offset);
+                const char *end = cursor + bytes;
+                out->clear();
+                out->reserve(int(count));
+                quint64 value = 0;
+                quint32 local = 0;
+                for (quint32 i = 0; i < count; ++i) {
+                    if (!WireProtocol::readVarint(cursor, end, &value))
+                        return false;
+                    local += quint32(value);
+                    out->append(local);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool document(quint32 local, Document *document) const
+    {
+        if (local >= m_docCount)
+            return false;
+        const quint64 offset = qFromLittleEndian<quint64>(m_base + m_docTable + quint64(local) * 8);
+        if (offset + 9 > quint64(m_size))
+            return false;
+        const char *cursor = reinterpret_cast<const char *>(m_base + offset);
+        const char *end = reinterpret_cast<const char *>(m_base + m_size);
+        document->timestampMs = qFromLittleEndian<qint64>(cursor);
+        document->kind = quint8(cursor[8]);
+        cursor += 9;
+        return readString(cursor, end, &document->sender)
+               && readString(cursor, end, &document->target)
+               && readString(cursor, end, &document->text);
+    }
+
+private:
+    static int compare(const char *key, quint32 keyLength, const QByteArray &term)
+    {
+        const int common = int(qMin<quint32>(keyLength, quint32(term.size())));
+        const int cmp = std::memcmp(key, term.constData(), size_t(common));
+        if (cmp != 0)
+            return cmp;
+        return keyLength < quint32(term.size()) ? -1 : (keyLength > quint32(term.size()) ? 1 : 0);
+    }
+
+    QFile m_file;
+    uchar *m_base = nullptr;
+    qint64 m_size = 0;
+    quint64 m_firstDocId = 0;
+    quint32 m_docCount = 0;
+    quint32 m_termCount = 0;
+    quint64 m_termTable = 0;
+    quint64 m_docTable = 0;
+};
+
+SearchIndex::SearchIndex() = default;
+
+SearchIndex::~SearchIndex()
+{
+    close();
+}
+
+QStringList SearchIndex::tokenize(const QString &text)
+{
+    QStringList tokens;
+    QString word;
+    QString cjk;
+
+    auto flushWord = [&]() {
+        if (!word.isEmpty())
+            tokens.append(word.left(kMaxWordLength));
+        word.clear();
+    };
+    auto flushCjk = [&]() {
+        if (cjk.size() == 1)
+            tokens.append(cjk);
+        for (int i = 0; i + 1 < cjk.size(); ++i)
+            tokens.append(cjk.mid(i, 2));
+        cjk.clear();
+    };
+
+    for (const QChar ch : text) {
+        if (isCjk(ch.unicode())) {
+            flushWord();
+            cjk.append(ch);
+        } else if (ch.isLetterOrNumber()) {
+            flushCjk();
+            word.append(ch.toLower());
+        } else {
+            flushWord();
+            flushCjk();
+        }
+    }
+    flushWord();
+    flushCjk();
+
+    tokens.removeDuplicates();
+    return tokens;
+}
+
+bool SearchIndex::open(const QString &directory)
+{
+    close();
+
+    QDir dir;
+    if (!dir.mkpath(directory)) {
+        ServerLog::warning("search", QString("无法创建索引目录: %1").arg(directory));
+        return false;
+    }
+
+    QWriteLocker locker(&m_lock);
+    m_directory = directory;
+    m_nextDocId = 1;
+
+    const QStringList files = QDir(directory).entryList({"seg_*.idx"}, QDir::Files, QDir::Name);
+    for (const QString &file : files) {
+        std::unique_ptr<Segment> segment = Segment::load(QDir(directory).filePath(file));
+        if (!segment) {
+            ServerLog::warning("search", QString("索引段文件损坏，已跳过（可用 --rebuild-index 重建）: %1").arg(file));
+            continue;
+        }
+        m_nextDocId = qMax(m_nextDocId, segment->firstDocId() + segment->docCount());
+        m_segments.push_back(std::move(segment));
+    }
+    m_activeFirstId = m_nextDocId;
+
+    // 重放尚未写成段文件的文档；编号小于已有段的说明段已写出但日志没来得及清空
+    m_journal.setFileName(QDir(directory).filePath(kJournalName));
+    if (m_journal.open(QIODevice::ReadOnly)) {
+        QDataStream in(&m_journal);
+        in.setVersion(QDataStream::Qt_6_0);
+        while (!in.atEnd()) {
+            quint64 docId = 0;
+            Document document;
+            in >> docId >> document.timestampMs >> document.kind
+               >> document.sender >> document.target >> document.text;
+            if (in.status() != QDataStream::Ok)
+                break;
+            if (docId < m_nextDocId)
+                continue;
+
+            const quint32 local = quint32(m_activeDocs.size());
+            for (const QString &token : tokenize(document.text))
+                m_activePostings[token.toUtf8()].append(local);
+            m_activeDocs.append(document);
+            ++m_nextDocId;
+        }
+        m_journal.close();
+    }
+
+    if (!m_journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        ServerLog::warning("search", QString("无法打开索引日志: %1").arg(m_journal.fileName()));
+        return false;
+    }
+    return true;
+}
+
+void SearchIndex::close()
+{
+    QWriteLocker locker(&m_lock);
+    if (m_journal.isOpen()) {
+        m_journal.flush();
+        m_journal.close();
+    }
+    m_segments.clear();
+    m_activeDocs.clear();
+    m_activePostings.clear();
+    m_directory.clear();
+    m_unflushedJournal = 0;
+}
+
+bool SearchIndex::isOpen() const
+{
+    QReadLocker locker(&m_lock);
+    return !m_directory.isEmpty();
+}
+
+void SearchIndex::setSegmentDocs(int docs)
+{
+    QWriteLocker locker(&m_lock);
+    m_segmentDocs = qMax(1, docs);
+}
+
+void SearchIndex::add(const Document &document)
+{
+    // 分词不需要锁
+    const QStringList tokens = tokenize(document.text);
+
+    quint64 docId = 0;
+    bool full = false;
+    {
+        QWriteLocker locker(&m_lock);
+        if (m_directory.isEmpty())
+            return;
+        const quint32 local = quint32(m_activeDocs.size());
+        for (const QString &token : tokens)
+            m_activePostings[token.toUtf8()].append(local);
+        m_activeDocs.append(document);
+        docId = m_nextDocId++;
+        full = m_activeDocs.size() >= m_segmentDocs;
+    }
+
+    // 日志只有写入方访问。每隔一段才刷到内核，崩溃时最多丢失这一段，可以重建
+    QDataStream out(&m_journal);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << docId << document.timestampMs << document.kind
+        << document.sender << document.target << document.text;
+    if (++m_unflushedJournal >= kJournalFlushInterval) {
+        m_journal.flush();
+        m_unflushedJournal = 0;
+    }
+
+    if (full)
+        flush();
+}
+
+bool SearchIndex::flush()
+{
+    QWriteLocker locker(&m_lock);
+    if (m_directory.isEmpty())
+        return false;
+    if (m_activeDocs.isEmpty())
+        return true;
+    if (!writeSegmentLocked())
+        return false;
+
+    m_activeDocs.clear();
+    m_activePostings.clear();
+    m_activeFirstId = m_nextDocId;
+    m_journal.flush();
+    m_journal.resize(0);
+    m_unflushedJournal = 0;
+    return true;
+}
+
+bool SearchIndex::writeSegmentLocked()
+{
+    QList<QByteArray> terms = m_activePostings.keys();
+    std::sort(terms.begin(), terms.end());
+
+    // 先算出各部分的大小和偏移，再一次性写出
+    QByteArray keys;
+    QByteArray postings;
+    QByteArray termTable;
+    termTable.reserve(int(terms.size()) * kTermEntrySize);
+    QVector<quint64> keyOffsets;
+    QVector<quint64> postingOffsets;
+    keyOffsets.reserve(terms.size());
+    postingOffsets.reserve(terms.size());
+    for (const QByteArray &term : std::as_const(terms)) {
+        keyOffsets.append(quint64(keys.size()));
+        keys.append(term);
+        postingOffsets.append(quint64(postings.size()));
+        quint32 previous = 0;
+        for (quint32 local : m_activePostings.value(term)) {
+            WireProtocol::writeVarint(postings, local - previous);
+            previous = local;
+        }
+    }
+
+    QByteArray docs;
+    QVector<quint64> docOffsets;
+    docOffsets.reserve(m_activeDocs.size());
+    for (const Document &document : std::as_const(m_activeDocs)) {
+        docOffsets.append(quint64(docs.size()));
+        char header[9];
+        qToLittleEndian<qint64>(document.timestampMs, header);
+        header[8] = char(document.kind);
+        docs.append(header, 9);
+        writeString(docs, document.sender);
+        writeString(docs, document.target);
+        writeString(docs, document.text);
+    }
+
+    const quint64 termTableOffset = kHeaderSize;
+    const quint64 keysOffset = termTableOffset + quint64(terms.size()) * kTermEntrySize;
+    const quint64 postingsOffset = keysOffset + quint64(keys.size());
+    const quint64 docTableOffset = postingsOffset + quint64(postings.size());
+    const quint64 docsOffset = docTableOffset + quint64(m_activeDocs.size()) * 8;
+    const quint64 fileSize = docsOffset + quint64(docs.size());
+
+    for (int i = 0; i < terms.size(); ++i) {
+        const quint64 nextPosting = i + 1 < terms.size() ? postingOffsets.at(i + 1) : quint64(postings.size());
+        appendU64(termTable, keysOffset + keyOffsets.at(i));
+        appendU32(termTable, quint32(terms.at(i).size()));
+        appendU32(termTable, quint32(m_activePostings.value(terms.at(i)).size()));
+        appendU64(termTable, postingsOffset + postingOffsets.at(i));
+        appendU32(termTable, quint32(nextPosting - postingOffsets.at(i)));
+        appendU32(termTable, 0);
+    }
+
+    QByteArray header(kIndexMagic, kMagicSize);
+    appendU64(header, m_activeFirstId);
+    appendU32(header, quint32(m_activeDocs.size()));
+    appendU32(header, quint32(terms.size()));
+    appendU64(header, termTableOffset);
+    appendU64(header, docTableOffset);
+    appendU64(header, fileSize);
+    header.append(QByteArray(kHeaderSize - header.size(), '\0'));
+
+    QByteArray docTable;
+    docTable.reserve(m_activeDocs.size() * 8);
+    for (quint64 offset : std::as_const(docOffsets))
+        appendU64(docTable, docsOffset + offset);
+
+    const QString path = QDir(m_directory).filePath(segmentFileName(m_activeFirstId));
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(header) < 0 || file.write(termTable) < 0 || file.write(keys) < 0
+        || file.write(postings) < 0 || file.write(docTable) < 0 || file.write(docs) < 0
+        || !file.commit()) {
+        ServerLog::warning("search", QString("无法写入索引段文件: %1").arg(path));
+        return false;
+    }
+
+    std::unique_ptr<Segment> segment = Segment::load(path);
+    if (!segment)
+        return false;
+    m_segments.push_back(std::move(segment));
+    return true;
+}
+
+bool SearchIndex::clear()
+{
+    QWriteLocker locker(&m_lock);
+    if (m_directory.isEmpty())
+        return false;
+
+    m_segments.clear();
+    QDir dir(m_directory);
+    for (const QString &file : dir.entryList({"seg_*.idx"}, QDir::Files))
+        dir.remove(file);
+    m_activeDocs.clear();
+    m_activePostings.clear();
+    m_nextDocId = 1;
+    m_activeFirstId = 1;
+    m_journal.flush();
+    m_journal.resize(0);
+    m_unflushedJournal = 0;
+    return true;
+}
+
+bool SearchIndex::matches(const Document &document, const QStringList &phrases) const
+{
+    for (const QString &phrase : phrases) {
+        if (!document.text.contains(phrase, Qt::CaseInsensitive))
+            return false;
+    }
+    return true;
+}
+
+QVector<SearchIndex::Hit> SearchIndex::search(const QString &query, int limit, quint64 beforeDocId,
+                                              const Filter &filter, quint64 *resumeBefore) const
+{
+    QVector<Hit> hits;
+    if (resumeBefore)
+        *resumeBefore = 0;
+    const QStringList tokens = tokenize(query);
+    if (tokens.isEmpty() || limit <= 0)
+        return hits;
+
+    static const QRegularExpression whitespace("\\s+");
+    const QStringList phrases = query.split(whitespace, Qt::SkipEmptyParts);
+    QVector<QByteArray> terms;
+    terms.reserve(tokens.size());
+    for (const QString &token : tokens)
+        terms.append(token.toUtf8());
+
+    // 整个查询持有读锁，而 add 需要写锁：过滤条件很严时扫描可能很长，会拖住持久化通道。
+    // 每次查询最多检查 kMaxScannedPostings 个候选，剩下的由调用方按 resumeBefore 继续
+    int scanned = 0;
+    auto stopAt = [&](quint64 next) {
+        if (resumeBefore)
+            *resumeBefore = next;
+        return true;
+    };
+
+    // 在一个段内求交集：从最短的倒排表里从新到旧取候选，到其他表中二分确认
+    auto collect = [&](quint64 firstDocId, QVector<QVector<quint32>> &lists,
+                       const std::function<bool(quint32, Document *)> &load) {
+        std::sort(lists.begin(), lists.end(), [](const QVector<quint32> &a, const QVector<quint32> &b) {
+            return a.size() < b.size();
+        });
+        const QVector<quint32> &shortest = lists.constFirst();
+        for (auto it = shortest.crbegin(); it != shortest.crend(); ++it) {
+            const quint64 docId = firstDocId + *it;
+            if (beforeDocId > 0 && docId >= beforeDocId)
+                continue;
+            if (++scanned > kMaxScannedPostings)
+                return stopAt(docId + 1);
+            bool inAll = true;
+            for (int i = 1; i < lists.size() && inAll; ++i)
+                inAll = std::binary_search(lists.at(i).cbegin(), lists.at(i).cend(), *it);
+            if (!inAll)
+                continue;
+
+            Document document;
+            if (!load(*it, &document) || !matches(document, phrases))
+                continue;
+            if (filter && !filter(document))
+                continue;
+            hits.append(Hit{docId, document});
+            if (hits.size() >= limit)
+                return stopAt(docId);
+        }
+        return false;
+    };
+
+    QReadLocker locker(&m_lock);
+
+    // 内存段最新，先查
+    if (beforeDocId == 0 || beforeDocId > m_activeFirstId) {
+        QVector<QVector<quint32>> lists;
+        for (const QByteArray &term : std::as_const(terms)) {
+            const auto it = m_activePostings.constFind(term);
+            if (it == m_activePostings.constEnd()) {
+                lists.clear();
+                break;
+            }
+            lists.append(it.value());
+        }
+        if (!lists.isEmpty()) {
+            const bool done = collect(m_activeFirstId, lists, [this](quint32 local, Document *document) {
+                if (local >= quint32(m_activeDocs.size()))
+                    return false;
+                *document = m_activeDocs.at(int(local));
+                return true;
+            });
+            if (done)
+                return hits;
+        }
+    }
+
+    for (auto segment = m_segments.crbegin(); segment != m_segments.crend(); ++segment) {
+        const Segment *current = segment->get();
+        if (beforeDocId > 0 && current->firstDocId() >= beforeDocId)
+            continue;
+
+        QVector<QVector<quint32>> lists;
+        lists.reserve(terms.size());
+        for (const QByteArray &term : std::as_const(terms)) {
+            QVector<quint32> postings;
+            if (!current->postings(term, &postings)) {
+                lists.clear();
+                break;
+            }
+            lists.append(postings);
+        }
+        if (lists.isEmpty())
+            continue;
+
+        if (collect(current->firstDocId(), lists, [current](quint32 local, Document *document) {
+                return current->document(local, document);
+            }))
+            break;
+    }
+    return hits;
+}
+
+quint64 SearchIndex::documentCount() const
+{
+    QReadLocker locker(&m_lock);
+    return m_nextDocId - 1;
+}
+
+int SearchIndex::segmentCount() const
+{
+    QReadLocker locker(&m_lock);
+    return int(m_segments.size());
+}
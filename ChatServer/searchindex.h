@@ -0,0 +1,94 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+#include <QFile>
+#include <QReadWriteLock>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// 聊天记录的增量倒排索引，位于存储目录的 index/ 下。
+//
+// 分词：连续的汉字、假名、谚文按相邻两字切成二元组（单独一个字时保留单字），
+// 其他字母数字按词切分并转成小写。查询按同样方式分词，所有词元都要命中（AND），
+// 再用原文做一次包含校验，排除二元组不相邻造成的误命中。
+//
+// 文档按保存顺序编号，编号越大越新。最新的文档在内存段中，同时追加到 active.journal，
+// 重启时重放；内存段满 segmentDocs 条后写成只读的段文件（词典有序，倒排表为差分 varint，
+// 并带有原文），之后通过 mmap 查询。查询从最新的段往旧的段走，凑够 limit 条即停止，
+// 结果天然按时间倒序，耗时与需要扫描的倒排表长度有关，与总文档数无关。
+//
+// add 只能由一个线程调用（持久化通道），search 可在任意线程并行调用。
+class SearchIndex
+{
+public:
+    struct Document {
+        qint64 timestampMs = 0;
+        quint8 kind = 0;        // BinaryLog::Kind
+        QString sender;
+        QString target;         // 私聊的接收者或聊天室名
+        QString text;
+    };
+
+    struct Hit {
+        quint64 docId = 0;
+        Document document;
+    };
+
+    // 返回 false 的文档不出现在结果中，用于按用户过滤私聊和聊天室
+    using Filter = std::function<bool(const Document &)>;
+
+    SearchIndex();
+    ~SearchIndex();
+    SearchIndex(const SearchIndex &) = delete;
+    SearchIndex &operator=(const SearchIndex &) = delete;
+
+    // 打开（或创建）索引目录：映射已有段文件并重放日志
+    bool open(const QString &directory);
+    void close();
+    bool isOpen() const;
+
+    void setSegmentDocs(int docs);
+    void add(const Document &document);
+    // 把内存段写成段文件，清空日志
+    bool flush();
+    // 删除全部段文件和日志，用于重建
+    bool clear();
+
+    // 最新的在前；beforeDocId 大于 0 时只返回编号更小的文档，用于翻页。
+    // 凑满 limit 条或检查的候选数达到上限时停止，resumeBefore 置为下一页的 beforeDocId；
+    // 查完全部索引时置为 0。达到上限时结果可能不满一页，甚至为空
+    QVector<Hit> search(const QString &query, int limit, quint64 beforeDocId = 0,
+                        const Filter &filter = Filter(), quint64 *resumeBefore = nullptr) const;
+    quint64 documentCount() const;
+    int segmentCount() const;
+
+    static QStringList tokenize(const QString &text);
+
+private:
+    class Segment;
+
+    bool matches(const Document &document, const QStringList &phrases) const;
+    bool writeSegmentLocked();
+
+    mutable QReadWriteLock m_lock;
+    QString m_directory;
+    std::vector<std::unique_ptr<Segment>> m_segments;   // 从旧到新
+    quint64 m_nextDocId = 1;
+
+    // 内存段，编号从 m_activeFirstId 开始
+    quint64 m_activeFirstId = 1;
+    QVector<Document> m_activeDocs;
+    QHash<QByteArray, QVector<quint32>> m_activePostings;
+
+    QFile m_journal;
+    int m_unflushedJournal = 0;
+    int m_segmentDocs = 200000;
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,311 @@
+#include "serverlog.h"
+#include <QDateTime>
+#include <QDebug>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+constexpr size_t RingCapacity = 16384;
+constexpr int MaxEntriesPerPass = 1024;
+constexpr int IdleSleepMs = 20;
+constexpr qint64 SummaryIntervalMs = 1000;
+
+QtMessageHandler g_previousHandler = nullptr;
+
+void qtMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    ServerLog::Level level = ServerLog::Info;
+    switch (type) {
+    case QtDebugMsg:
+        level = ServerLog::Debug;
+        break;
+    case QtInfoMsg:
+        level = ServerLog::Info;
+        break;
+    case QtWarningMsg:
+        level = ServerLog::Warning;
+        break;
+    case QtCriticalMsg:
+    case QtFatalMsg:
+        level = ServerLog::Error;
+        break;
+    }
+
+    // qFatal 之后进程会立即终止，来不及等输出线程，交给原处理函数
+    if (type == QtFatalMsg) {
+        if (g_previousHandler)
+            g_previousHandler(type, context, message);
+        std::abort();
+    }
+
+    // Qt 的分类名是静态字符串，可以直接保存指针
+    ServerLog::write(level, context.category ? context.category : "qt", message);
+}
+
+} // namespace
+
+ServerLog *ServerLog::instance()
+{
+    // 不析构：进程退出前由 main() 调用 stop()，避免静态析构顺序问题
+    static ServerLog *log = new ServerLog;
+    return log;
+}
+
+ServerLog::ServerLog(QObject *parent)
+    : QThread(parent)
+    , m_ring(RingCapacity)
+{
+    setObjectName("server-log");
+}
+
+ServerLog::~ServerLog()
+{
+    stop();
+}
+
+bool ServerLog::enabled(Level level)
+{
+    return level >= instance()->m_level.load(std::memory_order_relaxed);
+}
+
+void ServerLog::write(Level level, const char *category, const QString &message)
+{
+    ServerLog *log = instance();
+    if (level < log->m_level.load(std::memory_order_relaxed))
+        return;
+    log->push(level, category, message);
+}
+
+bool ServerLog::parseLevel(const QString &text, Level *level)
+{
+    if (text == "debug") {
+        *level = Debug;
+    } else if (text == "info") {
+        *level = Info;
+    } else if (text == "warning") {
+        *level = Warning;
+    } else if (text == "error") {
+        *level = Error;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char *ServerLog::levelName(Level level)
+{
+    switch (level) {
+    case Debug:
+        return "DEBUG";
+    case Info:
+        return "INFO";
+    case Warning:
+        return "WARN";
+    case Error:
+        return "ERROR";
+    }
+    return "INFO";
+}
+
+void ServerLog::setLevel(Level level)
+{
+    m_level.store(level, std::memory_order_relaxed);
+}
+
+ServerLog::Level ServerLog::level() const
+{
+    return Level(m_level.load(std::memory_order_relaxed));
+}
+
+void ServerLog::setRateLimit(int messagesPerSecond)
+{
+    m_rateLimit.store(qMax(0, messagesPerSecond), std::memory_order_relaxed);
+}
+
+void ServerLog::setDebugSampling(int oneInN)
+{
+    m_debugSampling.store(qMax(1, oneInN), std::memory_order_relaxed);
+}
+
+bool ServerLog::setOutputFile(const QString &path)
+{
+    m_file.close();
+    if (path.isEmpty())
+        return true;
+
+    m_file.setFileName(path);
+    return m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+}
+
+void ServerLog::setStdoutEnabled(bool enabled)
+{
+    m_stdoutEnabled = enabled;
+}
+
+void ServerLog::setGuiFeedEnabled(bool enabled, int maxLines)
+{
+    QMutexLocker locker(&m_guiMutex);
+    m_guiEnabled = enabled;
+    m_guiMaxLines = qMax(1, maxLines);
+    if (!enabled)
+        m_guiLines.clear();
+}
+
+QStringList ServerLog::takeGuiLines(int maxLines)
+{
+    QMutexLocker locker(&m_guiMutex);
+    if (m_guiLines.size() <= maxLines) {
+        QStringList lines;
+        lines.swap(m_guiLines);
+        return lines;
+    }
+
+    const QStringList lines = m_guiLines.mid(0, maxLines);
+    m_guiLines.erase(m_guiLines.begin(), m_guiLines.begin() + maxLines);
+    return lines;
+}
+
+void ServerLog::installMessageHandler()
+{
+    if (m_handlerInstalled.exchange(true))
+        return;
+    g_previousHandler = qInstallMessageHandler(qtMessageHandler);
+}
+
+void ServerLog::stop()
+{
+    // 先恢复原处理函数，之后的 qDebug 不再进入已停止的环形缓冲
+    if (m_handlerInstalled.exchange(false))
+        qInstallMessageHandler(g_previousHandler);
+
+    if (!isRunning())
+        return;
+    m_stopping.store(true, std::memory_order_release);
+    wait();
+    m_stopping.store(false, std::memory_order_release);
+}
+
+bool ServerLog::admit(Level level)
+{
+    // 错误日志不受限流和采样影响
+    if (level >= Error)
+        return true;
+
+    if (level == Debug) {
+        const int sampling = m_debugSampling.load(std::memory_order_relaxed);
+        if (sampling > 1 && m_debugCounter.fetch_add(1, std::memory_order_relaxed) % sampling != 0)
+            return false;
+    }
+
+    const int limit = m_rateLimit.load(std::memory_order_relaxed);
+    if (limit <= 0)
+        return true;
+
+    // 按秒划分的固定窗口，窗口切换时的竞争最多让几条日志多算进旧窗口
+    const qint64 second = QDateTime::currentMSecsSinceEpoch() / 1000;
+    qint64 window = m_windowSecond.load(std::memory_order_relaxed);
+    if (window != second && m_windowSecond.compare_exchange_strong(window, second, std::memory_order_relaxed))
+        m_windowCount.store(0, std::memory_order_relaxed);
+    return m_windowCount.fetch_add(1, std::memory_order_relaxed) < limit;
+}
+
+void ServerLog::push(Level level, const char *category, const QString &message)
+{
+    if (!admit(level)) {
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Entry entry;
+    entry.timestampMs = QDateTime::currentMSecsSinceEpoch();
+    entry.level = level;
+    entry.category = category;
+    entry.message = message;
+    if (!m_ring.tryPush(std::move(entry)))
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+QString ServerLog::formatEntry(const Entry &entry)
+{
+    return QDateTime::fromMSecsSinceEpoch(entry.timestampMs).toString("yyyy-MM-dd hh:mm:ss.zzz")
+           + QLatin1String(" [") + QLatin1String(levelName(Level(entry.level)))
+           + QLatin1String("] [") + QLatin1String(entry.category)
+           + QLatin1String("] ") + entry.message;
+}
+
+void ServerLog::output(const QStringList &lines)
+{
+    if (lines.isEmpty())
+        return;
+
+    QByteArray data;
+    for (const QString &line : lines) {
+        data += line.toUtf8();
+        data += '\n';
+    }
+
+    if (m_file.isOpen()) {
+        m_file.write(data);
+        m_file.flush();
+    }
+    if (m_stdoutEnabled) {
+        m_stdout.write(data);
+        m_stdout.flush();
+    }
+
+    QMutexLocker locker(&m_guiMutex);
+    if (!m_guiEnabled)
+        return;
+    m_guiLines += lines;
+    const int overflow = m_guiLines.size() - m_guiMaxLines;
+    if (overflow > 0)
+        m_guiLines.erase(m_guiLines.begin(), m_guiLines.begin() + overflow);
+}
+
+void ServerLog::run()
+{
+    if (m_stdoutEnabled && !m_stdout.isOpen())
+        m_stdout.open(stdout, QIODevice::WriteOnly);
+
+    qint64 lastSummaryMs = QDateTime::currentMSecsSinceEpoch();
+    QStringList lines;
+    forever {
+        const bool stopping = m_stopping.load(std::memory_order_acquire);
+
+        Entry entry;
+        while (lines.size() < MaxEntriesPerPass && m_ring.tryPop(entry))
+            lines.append(formatEntry(entry));
+
+        // 被限流或丢弃的条数按固定间隔汇总成一行，而不是每条都报告
+        const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+        if (stopping || nowMs - lastSummaryMs >= SummaryIntervalMs) {
+            lastSummaryMs = nowMs;
+            const quint64 suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+            const quint64 dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+            if (suppressed > 0 || dropped > 0) {
+                Entry summary;
+                summary.timestampMs = nowMs;
+                summary.level = Warning;
+                summary.category = "log";
+                summary.message = QString("限流或采样丢弃 %1 条日志，缓冲区满丢弃 %2 条")
+                                      .arg(suppressed)
+                                      .arg(dropped);
+                lines.append(formatEntry(summary));
+            }
+        }
+
+        const bool drained = lines.size() < MaxEntriesPerPass;
+        output(lines);
+        lines.clear();
+
+        if (drained) {
+            if (stopping)
+                break;
+            msleep(IdleSleepMs);
+        }
+    }
+
+    m_file.flush();
+    m_stdout.flush();
+}
@@ -0,0 +1,108 @@
+#ifndef SERVERLOG_H
+#define SERVERLOG_H
+
+#include <QThread>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include "ringbuffer.h"
+
+// 服务器日志：分级、限流、异步输出。
+// 任意线程写日志只做一次级别判断和一次无锁入队，格式化和 I/O 都在输出线程里完成，
+// 环形缓冲满时直接丢弃并计数，不会阻塞 I/O 线程和流水线。
+// 输出线程写到文件或标准输出，同时可以为界面保留一份有界的待显示行，由界面按帧拉取。
+class ServerLog : public QThread
+{
+    Q_OBJECT
+public:
+    enum Level {
+        Debug,
+        Info,
+        Warning,
+        Error
+    };
+
+    // 进程内唯一实例
+    static ServerLog *instance();
+
+    // 热路径上先判断级别，避免为不会输出的日志拼接字符串
+    static bool enabled(Level level);
+
+    // category 必须是静态字符串（例如字面量），输出线程稍后才读取它
+    static void write(Level level, const char *category, const QString &message);
+    static void debug(const char *category, const QString &message) { write(Debug, category, message); }
+    static void info(const char *category, const QString &message) { write(Info, category, message); }
+    static void warning(const char *category, const QString &message) { write(Warning, category, message); }
+    static void error(const char *category, const QString &message) { write(Error, category, message); }
+
+    static bool parseLevel(const QString &text, Level *level);
+    static const char *levelName(Level level);
+
+    void setLevel(Level level);
+    Level level() const;
+    // 每秒最多输出的非错误日志条数，0 表示不限；超出部分丢弃并在汇总中报告
+    void setRateLimit(int messagesPerSecond);
+    // 调试日志每 n 条只保留 1 条，n <= 1 表示全部保留
+    void setDebugSampling(int oneInN);
+
+    // 以下三个函数需在 start() 之前调用
+    // path 为空时写标准输出
+    bool setOutputFile(const QString &path);
+    void setStdoutEnabled(bool enabled);
+    // 为界面缓存最多 maxLines 行，超出时丢弃最旧的行
+    void setGuiFeedEnabled(bool enabled, int maxLines = 5000);
+
+    // 界面定时调用，取走最多 maxLines 行待显示的日志
+    QStringList takeGuiLines(int maxLines);
+
+    // 把 qDebug/qInfo/qWarning/qCritical 也转入本日志，stop() 时恢复原处理函数
+    void installMessageHandler();
+
+    // 输出剩余日志后退出线程
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    struct Entry {
+        qint64 timestampMs = 0;
+        int level = Info;
+        const char *category = "";
+        QString message;
+    };
+
+    explicit ServerLog(QObject *parent = nullptr);
+    ~ServerLog();
+
+    void push(Level level, const char *category, const QString &message);
+    bool admit(Level level);
+    void output(const QStringList &lines);
+    static QString formatEntry(const Entry &entry);
+
+    RingBuffer<Entry> m_ring;
+    std::atomic<int> m_level{Info};
+    std::atomic<int> m_rateLimit{0};
+    std::atomic<int> m_debugSampling{1};
+    std::atomic<quint64> m_debugCounter{0};
+    std::atomic<qint64> m_windowSecond{0};
+    std::atomic<int> m_windowCount{0};
+    std::atomic<quint64> m_suppressed{0};   // 限流或采样丢弃
+    std::atomic<quint64> m_dropped{0};      // 环形缓冲满丢弃
+    std::atomic<bool> m_stopping{false};
+    std::atomic<bool> m_handlerInstalled{false};
+
+    // 只在输出线程中使用
+    QFile m_file;
+    QFile m_stdout;
+    bool m_stdoutEnabled = false;
+
+    QMutex m_guiMutex;                      // 保护以下成员
+    bool m_guiEnabled = false;
+    int m_guiMaxLines = 5000;
+    QStringList m_guiLines;
+};
+
+#endif // SERVERLOG_H
@@ -3,130 +3,518 @@
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QHostAddress>
-#include <QDebug>
+#if defined(Q_OS_LINUX)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+#include "serverlog.h"
+#include "wireprotocol.h"
+#include "tracer.h"
+
+namespace {
+
+std::atomic<qint64> g_totalOutboundBytes{0};
+std::atomic<quint64> g_totalDroppedFrames{0};
+std::atomic<quint64> g_totalEvictions{0};
+std::atomic<quint64> g_nextConnectionId{0};
+
+} // namespace
 
 ServerWorker::ServerWorker(QObject *parent)
     : QObject{parent}
+    , m_connectionId(g_nextConnectionId.fetch_add(1, std::memory_order_relaxed) + 1)
 {
     m_serverSocket = new QTcpSocket(this);
     connect(m_serverSocket, &QTcpSocket::readyRead, this, &ServerWorker::onReadyRead);
+    connect(m_serverSocket, &QTcpSocket::bytesWritten, this, &ServerWorker::onBytesWritten);
     connect(m_serverSocket, &QTcpSocket::disconnected, this, &ServerWorker::disconnectedFromClient);
+
+    // 随 worker 一起迁移到 I/O 线程
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_flushTimer, &QTimer::timeout, this, &ServerWorker::flushBatch);
+}
+
+ServerWorker::~ServerWorker()
+{
+    g_totalOutboundBytes.fetch_sub(m_outboundBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
 }
 
 bool ServerWorker::setSocketDescriptor(qintptr socketDescriptor)
 {
-    return m_serverSocket->setSocketDescriptor(socketDescriptor);
+    if (!m_serverSocket->setSocketDescriptor(socketDescriptor))
+        return false;
+
+    // 小帧已经在应用层合并，不需要再让 Nagle 算法等待
+    m_serverSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    m_lastReceivedMs = Metrics::nowNs() / 1000000;
+
+    QString ip = m_serverSocket->peerAddress().toString();
+    // 去掉IPv6的前缀（如果有）
+    if (ip.startsWith("::ffff:")) {
+        ip = ip.mid(7); // 去掉 "::ffff:"
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_peerAddress = ip + ":" + QString::number(m_serverSocket->peerPort());
+    return true;
+}
+
+void ServerWorker::setOutboundLimits(const OutboundLimits &limits)
+{
+    m_limits = limits;
+    m_limits.lowWatermark = qBound<qint64>(1, m_limits.lowWatermark, m_limits.highWatermark);
+}
+
+qint64 ServerWorker::outboundBytes() const
+{
+    return m_outboundBytes.load(std::memory_order_relaxed);
+}
+
+quint64 ServerWorker::droppedFrames() const
+{
+    return m_droppedFrames.load(std::memory_order_relaxed);
+}
+
+qint64 ServerWorker::totalOutboundBytes()
+{
+    return g_totalOutboundBytes.load(std::memory_order_relaxed);
+}
+
+quint64 ServerWorker::totalDroppedFrames()
+{
+    return g_totalDroppedFrames.load(std::memory_order_relaxed);
+}
+
+quint64 ServerWorker::totalEvictions()
+{
+    return g_totalEvictions.load(std::memory_order_relaxed);
+}
+
+bool ServerWorker::parseOverflowPolicy(const QString &text, OverflowPolicy *policy)
+{
+    if (text == "drop-oldest") {
+        *policy = DropOldest;
+    } else if (text == "coalesce") {
+        *policy = CoalescePresence;
+    } else if (text == "disconnect") {
+        *policy = DisconnectSlowConsumer;
+    } else {
+        return false;
+    }
+    return true;
 }
 
 QString ServerWorker::userName()
 {
+    QMutexLocker locker(&m_mutex);
     return m_userName;
 }
 
 void ServerWorker::setUserName(QString user)
 {
+    QMutexLocker locker(&m_mutex);
     m_userName = user;
 }
 
+quint64 ServerWorker::connectionId() const
+{
+    return m_connectionId;
+}
+
 void ServerWorker::disconnectFromClient()
 {
     if (m_serverSocket->state() == QAbstractSocket::ConnectedState) {
+        // 先写出本轮合并中的帧，例如关闭前的 shutdown 通知
+        flushBatch();
         m_serverSocket->disconnectFromHost();
     }
 }
 
 QString ServerWorker::peerAddress() const
 {
-    if (m_serverSocket) {
-        QString ip = m_serverSocket->peerAddress().toString();
-        // 去掉IPv6的前缀（如果有）
-        if (ip.startsWith("::ffff:")) {
-            ip = ip.mid(7); // 去掉 "::ffff:"
-        }
-        return ip + ":" + QString::number(m_serverSocket->peerPort());
-    }
-    return "Unknown";
+    // 地址在绑定套接字时缓存，避免跨线程访问套接字
+    QMutexLocker locker(&m_mutex);
+    return m_peerAddress.isEmpty() ? QString("Unknown") : m_peerAddress;
 }
 
 void ServerWorker::onReadyRead()
 {
-    QByteArray jsonData;
-    QDataStream socketStream(m_serverSocket);
-    socketStream.setVersion(QDataStream::Qt_5_12);
-    // start an infinite loop
-    for (;;) {
-        socketStream.startTransaction();
-        socketStream >> jsonData;
-        if (socketStream.commitTransaction()) {
-            // emit logMessage(QString::fromUtf8(jsonData));
-            // sendMessage("I recieved message");
-
-            QJsonParseError parseError;
-            const QJsonDocument jsonDoc = QJsonDocument::fromJson(jsonData, &parseError);
-            if (parseError.error == QJsonParseError::NoError) {
-                if (jsonDoc.isObject()) { // and is a JSON object
-                    emit logMessage(QJsonDocument(jsonDoc).toJson(QJsonDocument::Compact));
-                    emit jsonReceived(this, jsonDoc.object()); // parse the JSON
-                }
-            }
+    Tracer::Span span("read", 0);
+    // 收到任何数据都说明对端还活着，pong 只是空闲连接的回应
+    m_lastReceivedMs = Metrics::nowNs() / 1000000;
+    m_missedHeartbeats = 0;
 
-        } else {
+    // 缓冲区满时 readFrom 提前返回，取完帧后继续读，直到套接字里没有剩余数据
+    do {
+        const qint64 bytes = m_decoder.readFrom(m_serverSocket);
+        if (bytes < 0)
             break;
+        Metrics::add(Metrics::BytesIn, quint64(bytes));
+
+        // 帧要交给其他线程的流水线，视图在这里拷贝一次，这也是唯一的一次拷贝
+        QByteArrayView frame;
+        while (m_decoder.nextFrame(&frame)) {
+            Metrics::add(Metrics::FramesIn);
+            emit frameReceived(this, frame.toByteArray());
         }
-    }
+
+        if (m_decoder.hasError()) {
+            Metrics::add(Metrics::ParseErrors);
+            ServerLog::warning("io", QString("帧长度超过上限 %1 字节，断开连接 %2")
+                                         .arg(m_decoder.maxFrameSize())
+                                         .arg(peerAddress()));
+            m_serverSocket->abort();
+            return;
+        }
+    } while (m_serverSocket->bytesAvailable() > 0);
 }
 
 void ServerWorker::sendMessage(const QString &text, const QString &type)
 {
     if (m_serverSocket->state() != QAbstractSocket::ConnectedState) {
-        qDebug() << "发送失败：套接字未连接";
+        ServerLog::warning("io", "发送失败：套接字未连接");
         return;
     }
 
     if (!text.isEmpty()) {
-        // create a QDataStream operating on the socket
-        QDataStream serverStream(m_serverSocket);
-        serverStream.setVersion(QDataStream::Qt_5_12);
-
         // Create the JSON we want to send
         QJsonObject message;
         message["type"] = type;
         message["text"] = text;
 
-        qDebug() << "发送消息:" << type << text;
+        if (ServerLog::enabled(ServerLog::Debug))
+            ServerLog::debug("io", QString("发送消息: %1 %2").arg(type, text));
 
-        // send the JSON using QDataStream
-        serverStream << QJsonDocument(message).toJson();
+        // 与其他帧一样经过发送队列
+        sendJson(message);
     }
 }
 
-bool ServerWorker::sendJson(const QJsonObject &json)
+QByteArray ServerWorker::encodeFrame(const QJsonObject &json)
 {
     const QByteArray jsonData = QJsonDocument(json).toJson(QJsonDocument::Compact);
-    QString jsonStr = QString::fromUtf8(jsonData);
 
-    qDebug() << "准备发送JSON给" << userName() << ":" << jsonStr;
+    // 与 QDataStream << QByteArray 的格式一致：4字节大端长度 + 数据
+    QByteArray frame;
+    frame.reserve(jsonData.size() + 4);
+    QDataStream frameStream(&frame, QIODevice::WriteOnly);
+    frameStream.setVersion(QDataStream::Qt_5_7);
+    frameStream << jsonData;
+    return frame;
+}
+
+EncodedFrames ServerWorker::encodeFrames(const QJsonObject &json)
+{
+    EncodedFrames frames;
+    frames.json = encodeFrame(json);
+
+    const QString type = json.value("type").toString();
+    frames.messageType = Metrics::messageType(type);
+    if (type == QLatin1String("newuser") || type == QLatin1String("userdisconnected")) {
+        frames.presence = true;
+        frames.presenceKey = json.value("username").toString();
+    } else if (type == QLatin1String("userlist")) {
+        // 完整列表与任何用户名都不冲突
+        frames.presence = true;
+        frames.presenceKey = QStringLiteral("\x01userlist");
+    }
+
+    const QByteArray payload = WireProtocol::encode(json);
+    if (!payload.isEmpty())
+        frames.binary = WireProtocol::frame(payload);
+    return frames;
+}
+
+int ServerWorker::wireVersion() const
+{
+    return m_wireVersion.load(std::memory_order_acquire);
+}
+
+void ServerWorker::setWireVersion(int version)
+{
+    m_wireVersion.store(qBound(0, version, int(WireProtocol::Version)), std::memory_order_release);
+}
+
+const QByteArray &ServerWorker::frameFor(const EncodedFrames &frames) const
+{
+    if (wireVersion() > 0 && !frames.binary.isEmpty())
+        return frames.binary;
+    return frames.json;
+}
+
+bool ServerWorker::presenceDeltas() const
+{
+    return m_presenceDeltas.load(std::memory_order_acquire);
+}
+
+void ServerWorker::setPresenceDeltas(bool enabled)
+{
+    m_presenceDeltas.store(enabled, std::memory_order_release);
+}
+
+bool ServerWorker::accepts(const EncodedFrames &frames) const
+{
+    switch (frames.audience) {
+    case EncodedFrames::LegacyPresenceClients:
+        return !presenceDeltas();
+    case EncodedFrames::PresenceDeltaClients:
+        return presenceDeltas();
+    case EncodedFrames::Everyone:
+        break;
+    }
+    return true;
+}
+
+bool ServerWorker::heartbeatEnabled() const
+{
+    return m_heartbeat.load(std::memory_order_acquire);
+}
+
+void ServerWorker::setHeartbeatEnabled(bool enabled)
+{
+    m_heartbeat.store(enabled, std::memory_order_release);
+}
+
+qint64 ServerWorker::checkHeartbeat(qint64 nowMs, int intervalMs, int maxMissed)
+{
+    if (m_evicted || m_serverSocket->state() != QAbstractSocket::ConnectedState)
+        return -1;
+
+    // 活跃的连接不发 ping，下次检查排在距上次收到数据一个间隔之后
+    if (nowMs - m_lastReceivedMs < intervalMs)
+        return m_lastReceivedMs + intervalMs;
+    if (!heartbeatEnabled())
+        return nowMs + intervalMs;
+
+    if (m_missedHeartbeats >= maxMissed) {
+        ServerLog::warning("io", QString("%1 (%2) 连续 %3 次心跳没有回应，断开连接")
+                                     .arg(userName(), peerAddress())
+                                     .arg(m_missedHeartbeats));
+        Metrics::add(Metrics::HeartbeatEvictions);
+        // 半开连接上的数据永远发不出去，直接丢弃
+        m_evicted = true;
+        m_outbound.clear();
+        m_queuedBytes = 0;
+        m_batch.clear();
+        m_batchBytes = 0;
+        m_serverSocket->abort();
+        updateOutboundBytes();
+        return -1;
+    }
+
+    // 所有连接共用同一个 ping 帧
+    static const EncodedFrames ping = encodeFrames(QJsonObject{{"type", "ping"}});
+    ++m_missedHeartbeats;
+    Metrics::add(Metrics::HeartbeatPings);
+    sendFrames(ping);
+    return nowMs + intervalMs;
+}
+
+void ServerWorker::enableKeepAlive(int intervalMs, int probes)
+{
+    m_serverSocket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+#if defined(Q_OS_LINUX)
+    // 默认两小时后才开始探测，改为与应用层心跳相同的节奏
+    const int fd = int(m_serverSocket->socketDescriptor());
+    const int seconds = qMax(1, intervalMs / 1000);
+    const int count = qMax(1, probes);
+    ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &seconds, sizeof(seconds));
+    ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &seconds, sizeof(seconds));
+    ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#else
+    Q_UNUSED(intervalMs);
+    Q_UNUSED(probes);
+#endif
+}
+
+bool ServerWorker::sendJson(const QJsonObject &json)
+{
+    Tracer::Span span("sendJson");
+    const bool result = sendFrames(encodeFrames(json));
 
+    // 每次发送一条，只在调试级别下才拼接
+    if (result && ServerLog::enabled(ServerLog::Debug)) {
+        ServerLog::debug("io", QLatin1String("成功发送给 ") + userName() + QLatin1String(" - ")
+                                   + QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+    }
+    return result;
+}
+
+bool ServerWorker::sendFrame(const QByteArray &frame)
+{
+    const bool queued = enqueueFrame(frame, false, QString());
+    if (queued)
+        Metrics::messageOut(Metrics::OtherMessage);
+    return queued;
+}
+
+bool ServerWorker::sendFrames(const EncodedFrames &frames)
+{
+    const bool queued = enqueueFrame(frameFor(frames), frames.presence, frames.presenceKey);
+    if (queued)
+        Metrics::messageOut(frames.messageType);
+    return queued;
+}
+
+bool ServerWorker::enqueueFrame(const QByteArray &frame, bool presence, const QString &presenceKey)
+{
+    if (m_evicted)
+        return false;
     if (m_serverSocket->state() != QAbstractSocket::ConnectedState) {
-        qDebug() << "发送失败：套接字未连接";
-        emit logMessage(QLatin1String("发送失败给 ") + userName() + QLatin1String(" - 套接字未连接"));
+        ServerLog::warning("io", QLatin1String("发送失败给 ") + userName() + QLatin1String(" - 套接字未连接"));
         return false;
     }
 
-    QDataStream socketStream(m_serverSocket);
-    socketStream.setVersion(QDataStream::Qt_5_7);
+    // 没有积压时放入当前批次，等窗口结束一次写出
+    if (m_outbound.empty() && m_serverSocket->bytesToWrite() + m_batchBytes < m_limits.lowWatermark) {
+        m_batch.append(frame);
+        m_batchBytes += frame.size();
+        if (m_batchBytes >= m_limits.maxBatchBytes)
+            flushBatch();
+        else
+            scheduleFlush();
+        updateOutboundBytes();
+        return true;
+    }
 
-    bool result = false;
-    try {
-        socketStream << jsonData;
-        result = true;
-        qDebug() << "发送成功，数据长度:" << jsonData.length();
-        emit logMessage(QLatin1String("成功发送给 ") + userName() + QLatin1String(" - ") + jsonStr);
-    } catch (...) {
-        qDebug() << "发送失败：写入套接字时发生异常";
-        emit logMessage(QLatin1String("发送失败给 ") + userName() + QLatin1String(" - 写入异常"));
-        result = false;
+    // 同一用户的旧状态还没发出就被新状态取代
+    if (presence && m_limits.policy == CoalescePresence) {
+        for (auto it = m_outbound.begin(); it != m_outbound.end();) {
+            if (it->presence && it->presenceKey == presenceKey) {
+                m_queuedBytes -= it->frame.size();
+                it = m_outbound.erase(it);
+                m_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                g_totalDroppedFrames.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                ++it;
+            }
+        }
     }
 
-    return result;
+    m_outbound.push_back({frame, presence, presenceKey});
+    m_queuedBytes += frame.size();
+    if (m_queuedBytes + m_batchBytes + m_serverSocket->bytesToWrite() > m_limits.highWatermark)
+        applyOverflowPolicy();
+    updateOutboundBytes();
+    return !m_evicted;
+}
+
+bool ServerWorker::writeToSocket(const QByteArray &frame)
+{
+    // frame 是隐式共享的，这里不会发生拷贝
+    if (m_serverSocket->write(frame) != frame.size()) {
+        ServerLog::warning("io", QLatin1String("发送失败给 ") + userName() + QLatin1String(" - 写入异常: ")
+                                     + m_serverSocket->errorString());
+        return false;
+    }
+    Metrics::add(Metrics::BytesOut, quint64(frame.size()));
+    return true;
+}
+
+bool ServerWorker::writeGathered(const QVector<QByteArray> &frames, qint64 bytes)
+{
+    if (frames.size() == 1)
+        return writeToSocket(frames.first());
+
+    // QTcpSocket 把每次 write 的数据作为一个块，刷新时每块一次 send()。
+    // 拼成一块后整批只需一次系统调用，效果与 writev 相同。
+    QByteArray gathered;
+    gathered.reserve(bytes);
+    for (const QByteArray &frame : frames)
+        gathered.append(frame);
+    return writeToSocket(gathered);
+}
+
+void ServerWorker::scheduleFlush()
+{
+    if (m_flushScheduled)
+        return;
+    m_flushScheduled = true;
+
+    const int windowUs = m_limits.coalesceWindowUs;
+    if (windowUs <= 0) {
+        // 排在本轮已到达的事件之后执行，同一轮里的所有帧合并为一次写入
+        QMetaObject::invokeMethod(this, &ServerWorker::flushBatch, Qt::QueuedConnection);
+    } else {
+        m_flushTimer->start((windowUs + 999) / 1000);
+    }
+}
+
+void ServerWorker::flushBatch()
+{
+    m_flushScheduled = false;
+    m_flushTimer->stop();
+    if (m_batch.isEmpty())
+        return;
+
+    const QVector<QByteArray> frames = std::move(m_batch);
+    const qint64 bytes = m_batchBytes;
+    m_batch.clear();
+    m_batchBytes = 0;
+    if (!m_evicted && m_serverSocket->state() == QAbstractSocket::ConnectedState)
+        writeGathered(frames, bytes);
+    updateOutboundBytes();
+}
+
+void ServerWorker::dropFront()
+{
+    m_queuedBytes -= m_outbound.front().frame.size();
+    m_outbound.pop_front();
+    m_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    g_totalDroppedFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ServerWorker::applyOverflowPolicy()
+{
+    if (m_limits.policy == DisconnectSlowConsumer) {
+        ServerLog::warning("io", QString("%1 (%2) 接收过慢，积压 %3 字节，断开连接")
+                                     .arg(userName(), peerAddress())
+                                     .arg(m_queuedBytes + m_serverSocket->bytesToWrite()));
+        m_evicted = true;
+        m_outbound.clear();
+        m_queuedBytes = 0;
+        m_batch.clear();
+        m_batchBytes = 0;
+        g_totalEvictions.fetch_add(1, std::memory_order_relaxed);
+        m_serverSocket->abort();
+        return;
+    }
+
+    // 已经交给 QTcpSocket 的数据收不回来，只能丢弃队列中的帧，最新的一帧总是保留
+    while (m_outbound.size() > 1
+           && m_queuedBytes + m_batchBytes + m_serverSocket->bytesToWrite() > m_limits.highWatermark) {
+        dropFront();
+    }
+}
+
+void ServerWorker::onBytesWritten()
+{
+    // 批次中的帧总是早于队列中的帧，先写出以保持顺序
+    flushBatch();
+
+    // 写缓冲降到低水位以下再从队列补充，保证 QTcpSocket 内部缓冲有界。
+    // 一次补充的帧合并为一次写入
+    const qint64 budget = m_limits.lowWatermark - m_serverSocket->bytesToWrite();
+    QVector<QByteArray> frames;
+    qint64 bytes = 0;
+    while (!m_outbound.empty() && bytes < budget) {
+        bytes += m_outbound.front().frame.size();
+        frames.append(std::move(m_outbound.front().frame));
+        m_outbound.pop_front();
+    }
+    m_queuedBytes -= bytes;
+    if (!frames.isEmpty())
+        writeGathered(frames, bytes);
+    updateOutboundBytes();
+}
+
+void ServerWorker::updateOutboundBytes()
+{
+    const qint64 bytes = m_queuedBytes + m_batchBytes + m_serverSocket->bytesToWrite();
+    const qint64 previous = m_outboundBytes.exchange(bytes, std::memory_order_relaxed);
+    if (bytes != previous)
+        g_totalOutboundBytes.fetch_add(bytes - previous, std::memory_order_relaxed);
 }
@@ -3,35 +3,156 @@
 
 #include <QObject>
 #include <QTcpSocket>
+#include <QJsonObject>
+#include <QMutex>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+#include <deque>
+#include "framedecoder.h"
+#include "metrics.h"
+
+// 同一条消息的 JSON 帧和二进制帧，按接收者协商的协议选择其一
+struct EncodedFrames {
+    // 广播的接收范围：上下线通知按客户端是否支持在线状态增量区分
+    enum Audience {
+        Everyone,
+        LegacyPresenceClients,   // 仍使用 newuser/userdisconnected/userlist 的客户端
+        PresenceDeltaClients     // 登录时声明 presence 的客户端
+    };
+
+    QByteArray json;
+    QByteArray binary;   // 类型超出二进制协议范围时为空
+    bool presence = false;   // newuser/userdisconnected/userlist，积压时可以合并
+    QString presenceKey;     // 同一 key 的新状态取代旧状态
+    Audience audience = Everyone;
+    Metrics::MessageType messageType = Metrics::OtherMessage;   // 只用于统计
+};
 
 class ServerWorker : public QObject
 {
     Q_OBJECT
 public:
+    // 发送队列超过高水位时的处理方式
+    enum OverflowPolicy {
+        DropOldest,              // 丢弃最早排队的帧
+        CoalescePresence,        // 先合并同一用户的上下线通知，仍超限时丢弃最早的帧
+        DisconnectSlowConsumer   // 直接断开跟不上的客户端
+    };
+
+    // 发送积压 = 待合并批次 + 本地队列 + QTcpSocket 写缓冲。
+    // 写缓冲低于低水位时才从队列补充，积压超过高水位时按策略处理。
+    // 同一窗口内发往同一连接的帧合并成一次写入：窗口为 0 时在本轮事件循环结束时写出，
+    // 否则等待 coalesceWindowUs 微秒（定时器精度为毫秒，向上取整）；批次达到 maxBatchBytes 时立即写出。
+    struct OutboundLimits {
+        qint64 highWatermark = 4 * 1024 * 1024;
+        qint64 lowWatermark = 256 * 1024;
+        OverflowPolicy policy = CoalescePresence;
+        int coalesceWindowUs = 0;
+        int maxBatchBytes = 64 * 1024;
+    };
+
     explicit ServerWorker(QObject *parent = nullptr);
+    ~ServerWorker();
     virtual bool setSocketDescriptor(qintptr socketDescriptor);
 
+    // 只能在 attach 之前调用
+    void setOutboundLimits(const OutboundLimits &limits);
+    // 以下计数可在任意线程读取
+    qint64 outboundBytes() const;
+    quint64 droppedFrames() const;
+    static qint64 totalOutboundBytes();
+    static quint64 totalDroppedFrames();
+    static quint64 totalEvictions();
+    static bool parseOverflowPolicy(const QString &text, OverflowPolicy *policy);
+
     QString userName();
     void setUserName(QString user);
 
+    // 进程内唯一的连接编号，worker 销毁后地址可能被复用，编号不会
+    quint64 connectionId() const;
+
     void disconnectFromClient();
 
     // 新增：获取客户端地址
     QString peerAddress() const;
 
+    // 将JSON编码为带4字节长度前缀的完整帧，广播时只需编码一次
+    static QByteArray encodeFrame(const QJsonObject &json);
+    static EncodedFrames encodeFrames(const QJsonObject &json);
+
+    // 登录时协商的二进制协议版本，0 表示只用 JSON
+    int wireVersion() const;
+    void setWireVersion(int version);
+    const QByteArray &frameFor(const EncodedFrames &frames) const;
+
+    // 登录时声明支持在线状态增量后，不再接收逐条的上下线广播
+    bool presenceDeltas() const;
+    void setPresenceDeltas(bool enabled);
+    bool accepts(const EncodedFrames &frames) const;
+
+    // 登录时声明会回应 ping 的客户端才会因心跳超时被断开，旧客户端只依赖 TCP keepalive
+    bool heartbeatEnabled() const;
+    void setHeartbeatEnabled(bool enabled);
+    // 以下两个函数只能在所属 I/O 线程中调用。
+    // 距上次收到数据不足 intervalMs 时什么都不做；否则发送 ping 并记一次未回应，
+    // 连续 maxMissed 次未回应后断开。返回下一次检查的时间（毫秒），连接已关闭时返回 -1
+    qint64 checkHeartbeat(qint64 nowMs, int intervalMs, int maxMissed);
+    // 打开 TCP keepalive，Linux 上按心跳间隔和次数设置探测参数
+    void enableKeepAlive(int intervalMs, int probes);
+
 signals:
-    void logMessage(const QString &msg);
-    void jsonReceived(ServerWorker *sender, const QJsonObject &docObj);
+    // 收到一个完整的帧（未解析的JSON数据），解析交给流水线的解码阶段
+    void frameReceived(ServerWorker *sender, const QByteArray &frame);
     void disconnectedFromClient();
 
 private:
     QTcpSocket *m_serverSocket;
+    const quint64 m_connectionId;
+    FrameDecoder m_decoder;   // 只在所属 I/O 线程中访问
     QString m_userName;
+    QString m_peerAddress;
+    mutable QMutex m_mutex;   // worker 运行在 I/O 线程，用户名和地址会被 ChatServer 线程读取
+    std::atomic<int> m_wireVersion{0};
+    std::atomic<bool> m_presenceDeltas{false};
+    std::atomic<bool> m_heartbeat{false};
+    qint64 m_lastReceivedMs = 0;   // 以下两项只在所属 I/O 线程中访问
+    int m_missedHeartbeats = 0;
+
+    struct OutboundFrame {
+        QByteArray frame;
+        bool presence = false;
+        QString presenceKey;
+    };
+
+    bool enqueueFrame(const QByteArray &frame, bool presence, const QString &presenceKey);
+    bool writeToSocket(const QByteArray &frame);
+    bool writeGathered(const QVector<QByteArray> &frames, qint64 bytes);
+    void scheduleFlush();
+    void dropFront();
+    void applyOverflowPolicy();
+    void updateOutboundBytes();
+
+    // 发送队列只在所属 I/O 线程中访问
+    OutboundLimits m_limits;
+    std::deque<OutboundFrame> m_outbound;
+    qint64 m_queuedBytes = 0;
+    bool m_evicted = false;
+    QVector<QByteArray> m_batch;          // 等待合并写出的帧
+    qint64 m_batchBytes = 0;
+    bool m_flushScheduled = false;
+    QTimer *m_flushTimer;
+    std::atomic<qint64> m_outboundBytes{0};
+    std::atomic<quint64> m_droppedFrames{0};
 
 public slots:
     void onReadyRead();
     void sendMessage(const QString &text, const QString &type = "message");
     bool sendJson(const QJsonObject &json);  // 改为返回bool
+    bool sendFrame(const QByteArray &frame); // 发送已编码好的帧，经过发送队列
+    bool sendFrames(const EncodedFrames &frames);
+    void onBytesWritten();
+    void flushBatch();
 };
 
 #endif // SERVERWORKER_H
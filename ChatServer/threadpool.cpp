@@ -1,56 +1,208 @@
 #include "threadpool.h"
-#include "serverworker.h"
+#include "metrics.h"
 #include <QMetaObject>
 #include <QThread>
+#include <QHash>
+#include <QStringList>
+#include <QDebug>
+#include <chrono>
 
-void MessageTask::run()
-{
-    if (m_receiver) {
-        // 模拟一些处理时间（实际使用时可以根据消息复杂度调整）
-        QThread::msleep(1);
+namespace {
 
-        QMetaObject::invokeMethod(m_receiver, "broadcastMessage",
-                                  Qt::QueuedConnection,
-                                  Q_ARG(QJsonObject, m_message),
-                                  Q_ARG(ServerWorker*, m_exclude));
-    }
+// 每次调度最多连续处理的任务数，避免单个通道长期占用线程
+const int kLaneBatch = 64;
+
+qint64 nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-void ConnectionTask::run()
+static_assert(ThreadPoolManager::StageCount == Metrics::HistogramCount - Metrics::StageLatency,
+              "每个流水线阶段一个延迟直方图");
+
+} // namespace
+
+class LaneTask : public QRunnable
 {
-    if (m_receiver) {
-        // 模拟连接处理时间
-        QThread::msleep(10);
+public:
+    LaneTask(ThreadPoolManager *manager, ThreadPoolManager::Stage stage, ThreadPoolManager::Lane *lane)
+        : m_manager(manager), m_stage(stage), m_lane(lane)
+    {}
 
-        QMetaObject::invokeMethod(m_receiver, "handleNewConnection",
-                                  Qt::QueuedConnection,
-                                  Q_ARG(qintptr, m_socketDescriptor));
+    void run() override
+    {
+        m_manager->drainLane(m_stage, m_lane);
     }
-}
+
+private:
+    ThreadPoolManager *m_manager;
+    ThreadPoolManager::Stage m_stage;
+    ThreadPoolManager::Lane *m_lane;
+};
 
 ThreadPoolManager::ThreadPoolManager(QObject *parent)
     : QObject(parent)
 {
-    // 设置线程池大小为10，可以根据需要调整
-    m_threadPool.setMaxThreadCount(10);
+    const int threads = qMax(2, QThread::idealThreadCount());
+    m_threadPool.setMaxThreadCount(threads);
     m_threadPool.setExpiryTimeout(30000); // 30秒后回收空闲线程
+
+    for (int i = 0; i < StageCount; ++i) {
+        for (int lane = 0; lane < threads; ++lane)
+            m_stages[i].lanes.append(new Lane);
+    }
+
+    // 持久化队列允许积压更多，磁盘抖动时不影响路由
+    m_stages[PersistStage].capacity = 50000;
 }
 
-void ThreadPoolManager::startMessageTask(QObject* receiver, const QJsonObject &message, ServerWorker *exclude)
+ThreadPoolManager::~ThreadPoolManager()
 {
-    MessageTask *task = new MessageTask(receiver, message, exclude);
-    task->setAutoDelete(true);
-    m_threadPool.start(task);
+    m_threadPool.waitForDone();
+    for (StageState &state : m_stages) {
+        qDeleteAll(state.lanes);
+        state.lanes.clear();
+    }
+}
+
+void ThreadPoolManager::setStageContext(Stage stage, QObject *context)
+{
+    m_stages[stage].context = context;
+}
+
+void ThreadPoolManager::setStageCapacity(Stage stage, int capacity)
+{
+    m_stages[stage].capacity = qMax(1, capacity);
+}
+
+bool ThreadPoolManager::submit(Stage stage, quintptr key, std::function<void()> job, bool force)
+{
+    StageState &state = m_stages[stage];
+
+    if (!force && state.depth.load(std::memory_order_relaxed) >= state.capacity) {
+        state.rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    state.depth.fetch_add(1, std::memory_order_relaxed);
+
+    Job entry{std::move(job), nowNs()};
+
+    if (state.context) {
+        // 投递到指定线程，事件队列本身保证先进先出
+        QMetaObject::invokeMethod(state.context, [this, stage, entry]() mutable {
+            runJob(stage, entry);
+        }, Qt::QueuedConnection);
+        return true;
+    }
+
+    Lane *lane = state.lanes.at(int(qHash(key) % uint(state.lanes.size())));
+    bool schedule = false;
+    {
+        QMutexLocker locker(&lane->mutex);
+        lane->jobs.push_back(std::move(entry));
+        if (!lane->scheduled) {
+            lane->scheduled = true;
+            schedule = true;
+        }
+    }
+
+    if (schedule) {
+        LaneTask *task = new LaneTask(this, stage, lane);
+        task->setAutoDelete(true);
+        m_threadPool.start(task);
+    }
+    return true;
 }
 
-void ThreadPoolManager::startConnectionTask(QObject* receiver, qintptr socketDescriptor)
+void ThreadPoolManager::drainLane(Stage stage, Lane *lane)
 {
-    ConnectionTask *task = new ConnectionTask(receiver, socketDescriptor);
+    for (int i = 0; i < kLaneBatch; ++i) {
+        Job job;
+        {
+            QMutexLocker locker(&lane->mutex);
+            if (lane->jobs.empty()) {
+                lane->scheduled = false;
+                return;
+            }
+            job = std::move(lane->jobs.front());
+            lane->jobs.pop_front();
+        }
+        runJob(stage, job);
+    }
+
+    // 还有剩余任务，重新排队让其他通道有机会执行
+    LaneTask *task = new LaneTask(this, stage, lane);
     task->setAutoDelete(true);
     m_threadPool.start(task);
 }
 
+void ThreadPoolManager::runJob(Stage stage, Job &job)
+{
+    StageState &state = m_stages[stage];
+
+    if (job.run)
+        job.run();
+
+    const quint64 latency = quint64(qMax<qint64>(0, nowNs() - job.enqueuedAt));
+    state.totalLatencyNs.fetch_add(latency, std::memory_order_relaxed);
+    quint64 currentMax = state.maxLatencyNs.load(std::memory_order_relaxed);
+    while (latency > currentMax
+           && !state.maxLatencyNs.compare_exchange_weak(currentMax, latency, std::memory_order_relaxed)) {
+    }
+    state.processed.fetch_add(1, std::memory_order_relaxed);
+    state.depth.fetch_sub(1, std::memory_order_relaxed);
+    Metrics::observe(Metrics::Histogram(Metrics::StageLatency + stage), qint64(latency));
+}
+
+QVector<ThreadPoolManager::StageStats> ThreadPoolManager::stats() const
+{
+    QVector<StageStats> result;
+    for (int i = 0; i < StageCount; ++i) {
+        const StageState &state = m_stages[i];
+        StageStats s;
+        s.name = stageName(Stage(i));
+        s.queueDepth = state.depth.load(std::memory_order_relaxed);
+        s.capacity = state.capacity;
+        s.processed = state.processed.load(std::memory_order_relaxed);
+        s.rejected = state.rejected.load(std::memory_order_relaxed);
+        s.avgLatencyUs = s.processed ? state.totalLatencyNs.load(std::memory_order_relaxed) / 1000.0 / s.processed : 0.0;
+        s.maxLatencyUs = state.maxLatencyNs.load(std::memory_order_relaxed) / 1000.0;
+        result.append(s);
+    }
+    return result;
+}
+
+QString ThreadPoolManager::statsSummary() const
+{
+    QStringList parts;
+    for (const StageStats &s : stats()) {
+        parts << QString("%1: 队列 %2/%3, 已处理 %4, 拒绝 %5, 平均 %6us, 最大 %7us")
+                     .arg(s.name)
+                     .arg(s.queueDepth)
+                     .arg(s.capacity)
+                     .arg(s.processed)
+                     .arg(s.rejected)
+                     .arg(s.avgLatencyUs, 0, 'f', 1)
+                     .arg(s.maxLatencyUs, 0, 'f', 1);
+    }
+    return parts.join("; ");
+}
+
 int ThreadPoolManager::activeThreadCount() const
 {
     return m_threadPool.activeThreadCount();
 }
+
+QString ThreadPoolManager::stageName(Stage stage)
+{
+    switch (stage) {
+    case DecodeStage:   return "decode";
+    case ValidateStage: return "validate";
+    case RouteStage:    return "route";
+    case PersistStage:  return "persist";
+    case FanOutStage:   return "fanout";
+    case QueryStage:    return "query";
+    default:            return "unknown";
+    }
+}
@@ -4,54 +4,87 @@
 #include <QObject>
 #include <QThreadPool>
 #include <QRunnable>
-#include <QJsonObject>
-#include <QDateTime>
-#include <QDebug>
+#include <QMutex>
+#include <QVector>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <functional>
 
-// 前向声明，避免循环引用
-class ServerWorker;
-
-class MessageTask : public QRunnable
+// 消息处理流水线：解码 -> 校验 -> 路由 -> 持久化 -> 扇出
+// 每个阶段有独立的有界队列；同一 key 的任务在同一阶段内严格按提交顺序执行，
+// 不同 key 的任务可以在线程池中并行。
+class ThreadPoolManager : public QObject
 {
+    Q_OBJECT
 public:
-    MessageTask(QObject* receiver, const QJsonObject &message, ServerWorker *exclude = nullptr)
-        : m_receiver(receiver), m_message(message), m_exclude(exclude)
-    {}
+    enum Stage {
+        DecodeStage,     // JSON 解析
+        ValidateStage,   // 字段校验
+        RouteStage,      // 查找接收者、构造回复（在 ChatServer 线程执行）
+        PersistStage,    // 写入 MessageStorage
+        FanOutStage,     // 编码广播帧并分发到 I/O 线程
+        QueryStage,      // 历史和检索等只读查询，不与持久化阶段的写入共用通道
+        StageCount
+    };
 
-    void run() override;
+    struct StageStats {
+        QString name;
+        int queueDepth = 0;       // 已提交但尚未执行完的任务数
+        int capacity = 0;
+        quint64 processed = 0;
+        quint64 rejected = 0;     // 队列满被拒绝的任务数
+        double avgLatencyUs = 0;  // 从提交到执行完成的平均耗时
+        double maxLatencyUs = 0;
+    };
 
-private:
-    QObject* m_receiver;
-    QJsonObject m_message;
-    ServerWorker* m_exclude;
-};
+    explicit ThreadPoolManager(QObject *parent = nullptr);
+    ~ThreadPoolManager();
 
-class ConnectionTask : public QRunnable
-{
-public:
-    ConnectionTask(QObject* receiver, qintptr socketDescriptor)
-        : m_receiver(receiver), m_socketDescriptor(socketDescriptor)
-    {}
+    // context 不为空时，该阶段的任务投递到 context 所在线程执行，而不是线程池
+    void setStageContext(Stage stage, QObject *context);
+    void setStageCapacity(Stage stage, int capacity);
+
+    // 提交任务；队列已满时返回 false。
+    // force 为 true 时忽略容量限制，用于断开连接等不能丢弃的控制消息。
+    bool submit(Stage stage, quintptr key, std::function<void()> job, bool force = false);
+
+    QVector<StageStats> stats() const;
+    QString statsSummary() const;
+    int activeThreadCount() const;
 
-    void run() override;
+    static QString stageName(Stage stage);
 
 private:
-    QObject* m_receiver;
-    qintptr m_socketDescriptor;
-};
+    struct Job {
+        std::function<void()> run;
+        qint64 enqueuedAt;
+    };
 
-class ThreadPoolManager : public QObject
-{
-    Q_OBJECT
-public:
-    explicit ThreadPoolManager(QObject *parent = nullptr);
+    // 一个有序执行通道，同一时刻最多只有一个线程在处理
+    struct Lane {
+        QMutex mutex;
+        std::deque<Job> jobs;
+        bool scheduled = false;
+    };
 
-    void startMessageTask(QObject* receiver, const QJsonObject &message, ServerWorker *exclude = nullptr);
-    void startConnectionTask(QObject* receiver, qintptr socketDescriptor);
-    int activeThreadCount() const;
+    struct StageState {
+        QObject *context = nullptr;
+        int capacity = 10000;
+        QVector<Lane*> lanes;
+        std::atomic<int> depth{0};
+        std::atomic<quint64> processed{0};
+        std::atomic<quint64> rejected{0};
+        std::atomic<quint64> totalLatencyNs{0};
+        std::atomic<quint64> maxLatencyNs{0};
+    };
+
+    friend class LaneTask;
+    void drainLane(Stage stage, Lane *lane);
+    void runJob(Stage stage, Job &job);
 
-private:
     QThreadPool m_threadPool;
+    StageState m_stages[StageCount];
 };
 
 #endif // THREADPOOL_H
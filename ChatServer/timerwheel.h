@@ -0,0 +1,88 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QtGlobal>
+#include <array>
+#include <utility>
+#include <vector>
+
+// 分层时间轮：4 层，每层 64 个槽，时间以 tick 为单位。
+// 第 0 层每槽 1 tick，第 1 层每槽 64 tick，依此类推，最远约 1677 万 tick，超出时按最远处理。
+// 插入是 O(1) 的追加；tick 推进到第 0 层回绕时，把上一层当前槽里的条目按剩余时间重新分配到下层。
+// 不支持取消：到期时由调用方确认条目是否仍然有效，失效的条目只在轮中停留到它的截止时间，
+// 所以占用与同时登记的条目数成正比。
+// 不是线程安全的，只在所属线程中访问。
+template <typename T>
+class TimerWheel
+{
+public:
+    static constexpr int LevelBits = 6;
+    static constexpr int Levels = 4;
+    static constexpr quint64 SlotsPerLevel = quint64(1) << LevelBits;
+    static constexpr quint64 MaxDelay = (quint64(1) << (LevelBits * Levels)) - 1;
+
+    explicit TimerWheel(quint64 now = 0) : m_now(now) {}
+
+    quint64 now() const { return m_now; }
+    size_t size() const { return m_size; }
+
+    // 在第 deadline 个 tick 到期；不晚于当前 tick 的在下一个 tick 到期
+    void schedule(quint64 deadline, T value)
+    {
+        deadline = qBound(m_now + 1, deadline, m_now + MaxDelay);
+        insert(Entry{deadline, std::move(value)});
+        ++m_size;
+    }
+
+    // 推进到 now，对每个到期的条目调用 expired(deadline, value)。回调中可以再次 schedule
+    template <typename Callback>
+    void advance(quint64 now, Callback &&expired)
+    {
+        while (m_now < now) {
+            ++m_now;
+            cascade();
+
+            // 先取出整个槽，回调中新登记的条目不会落回正在处理的槽
+            std::vector<Entry> due;
+            due.swap(m_slots[0][m_now & (SlotsPerLevel - 1)]);
+            m_size -= due.size();
+            for (Entry &entry : due)
+                expired(entry.deadline, std::move(entry.value));
+        }
+    }
+
+private:
+    struct Entry {
+        quint64 deadline;
+        T value;
+    };
+
+    void insert(Entry &&entry)
+    {
+        const quint64 delay = entry.deadline - m_now;
+        int level = 0;
+        while (level < Levels - 1 && delay >= (quint64(1) << (LevelBits * (level + 1))))
+            ++level;
+        const quint64 slot = (entry.deadline >> (LevelBits * level)) & (SlotsPerLevel - 1);
+        m_slots[level][slot].push_back(std::move(entry));
+    }
+
+    // 第 level 层的下标回绕到 0 时，上一层前进一个槽，把该槽的条目分配到下层
+    void cascade()
+    {
+        for (int level = 1; level < Levels; ++level) {
+            if ((m_now >> (LevelBits * (level - 1))) & (SlotsPerLevel - 1))
+                return;
+            std::vector<Entry> entries;
+            entries.swap(m_slots[level][(m_now >> (LevelBits * level)) & (SlotsPerLevel - 1)]);
+            for (Entry &entry : entries)
+                insert(std::move(entry));
+        }
+    }
+
+    quint64 m_now;
+    size_t m_size = 0;
+    std::array<std::array<std::vector<Entry>, SlotsPerLevel>, Levels> m_slots;
+};
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,298 @@
+#include "tracer.h"
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#if defined(Q_PROCESSOR_X86)
+#  if defined(Q_CC_MSVC)
+#    include <intrin.h>
+#  else
+#    include <x86intrin.h>
+#  endif
+#endif
+
+std::atomic<bool> Tracer::s_enabled{false};
+
+namespace {
+
+qint64 steadyNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// x86 上是 TSC 计数，其他平台直接用纳秒
+inline quint64 ticks()
+{
+#if defined(Q_PROCESSOR_X86)
+    return __rdtsc();
+#else
+    return quint64(steadyNs());
+#endif
+}
+
+// 每个字段单独原子存取：导出线程可能与写入线程同时访问同一个槽，读到的旧值在导出时丢弃
+struct Event {
+    std::atomic<const char *> name{nullptr};
+    std::atomic<quint64> start{0};
+    std::atomic<quint64> duration{0};
+    std::atomic<quint64> id{0};
+};
+
+struct Ring {
+    std::unique_ptr<Event[]> events;
+    quint64 mask = 0;
+    std::atomic<quint64> head{0};     // 已写入的区间总数，写入方 release，导出方 acquire
+    int tid = 0;
+    QByteArray threadName;
+};
+
+struct Registry {
+    QMutex mutex;
+    std::vector<Ring*> all;       // 环形缓冲从不释放
+    std::vector<Ring*> idle;      // 所属线程已退出，等待新线程领取
+    int nextTid = 1;
+    int bufferEvents = 16384;
+    // 换算基准：第一次开启追踪时的 TSC 和纳秒
+    quint64 baseTicks = 0;
+    qint64 baseNs = 0;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+struct RingOwner {
+    Ring *ring = nullptr;
+
+    ~RingOwner()
+    {
+        if (!ring)
+            return;
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        r.idle.push_back(ring);
+    }
+};
+
+thread_local RingOwner t_owner;
+thread_local quint64 t_currentId = 0;
+std::atomic<quint64> g_nextId{0};
+
+Ring &localRing()
+{
+    if (Q_LIKELY(t_owner.ring))
+        return *t_owner.ring;
+
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    Ring *ring = nullptr;
+    if (!r.idle.empty()) {
+        // 复用已退出线程的缓冲，其中旧的区间一并丢弃
+        ring = r.idle.back();
+        r.idle.pop_back();
+        ring->head.store(0, std::memory_order_relaxed);
+    } else {
+        quint64 capacity = 1;
+        while (capacity < quint64(r.bufferEvents))
+            capacity <<= 1;
+        ring = new Ring;
+        ring->events.reset(new Event[capacity]);
+        ring->mask = capacity - 1;
+        r.all.push_back(ring);
+    }
+    ring->tid = r.nextTid++;
+    const QString name = QThread::currentThread() ? QThread::currentThread()->objectName() : QString();
+    ring->threadName = name.isEmpty() ? QByteArray("thread-") + QByteArray::number(ring->tid) : name.toUtf8();
+    t_owner.ring = ring;
+    return *ring;
+}
+
+void record(const char *name, quint64 start, quint64 end, quint64 id)
+{
+    Ring &ring = localRing();
+    const quint64 head = ring.head.load(std::memory_order_relaxed);
+    Event &event = ring.events[head & ring.mask];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(end - start, std::memory_order_relaxed);
+    event.id.store(id, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+// 每微秒的计数。TSC 频率由两次墙上时钟之间的计数推算
+double ticksPerUs(const Registry &r, quint64 nowTicks, qint64 nowNs)
+{
+#if defined(Q_PROCESSOR_X86)
+    if (nowNs - r.baseNs < 1000000) {
+        // 开启不到 1ms，自己再测一段
+        const quint64 t0 = ticks();
+        const qint64 n0 = steadyNs();
+        while (steadyNs() - n0 < 2000000) {
+        }
+        return double(ticks() - t0) / (double(steadyNs() - n0) / 1000.0);
+    }
+    return double(nowTicks - r.baseTicks) / (double(nowNs - r.baseNs) / 1000.0);
+#else
+    Q_UNUSED(r);
+    Q_UNUSED(nowTicks);
+    Q_UNUSED(nowNs);
+    return 1000.0;
+#endif
+}
+
+void appendEscaped(QByteArray &out, const QByteArray &text)
+{
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (uchar(c) >= 0x20)
+            out += c;
+    }
+}
+
+} // namespace
+
+void Tracer::setEnabled(bool enabled)
+{
+    if (enabled) {
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        if (r.baseNs == 0) {
+            r.baseTicks = ticks();
+            r.baseNs = steadyNs();
+        }
+    }
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::setBufferEvents(int events)
+{
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    r.bufferEvents = qBound(1024, events, 1 << 24);
+}
+
+quint64 Tracer::newId()
+{
+    if (!enabled())
+        return 0;
+    return g_nextId.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+quint64 Tracer::currentId()
+{
+    return t_currentId;
+}
+
+Tracer::Span::Span(const char *name, quint64 id)
+{
+    if (!enabled())
+        return;
+    m_name = name;
+    m_id = id;
+    m_previousId = t_currentId;
+    t_currentId = id;
+    m_start = ticks();
+}
+
+Tracer::Span::~Span()
+{
+    if (!m_name)
+        return;
+    record(m_name, m_start, ticks(), m_id);
+    t_currentId = m_previousId;
+}
+
+QByteArray Tracer::toJson()
+{
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    const quint64 nowTicks = ticks();
+    const qint64 nowNs = steadyNs();
+    const double perUs = r.baseNs == 0 ? 1.0 : ticksPerUs(r, nowTicks, nowNs);
+
+    QByteArray out;
+    out.reserve(1024 * 1024);
+    out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first)
+            out += ",\n";
+        first = false;
+    };
+
+    for (Ring *ring : r.all) {
+        const quint64 capacity = ring->mask + 1;
+        const quint64 head = ring->head.load(std::memory_order_acquire);
+        if (head == 0)
+            continue;
+
+        separator();
+        out += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":";
+        out += QByteArray::number(ring->tid);
+        out += ",\"args\":{\"name\":\"";
+        appendEscaped(out, ring->threadName);
+        out += "\"}}";
+
+        struct Copy {
+            const char *name;
+            quint64 start;
+            quint64 duration;
+            quint64 id;
+        };
+        std::vector<Copy> copies;
+        const quint64 begin = head > capacity ? head - capacity : 0;
+        copies.reserve(size_t(head - begin));
+        for (quint64 i = begin; i < head; ++i) {
+            const Event &event = ring->events[i & ring->mask];
+            copies.push_back({event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+                              event.duration.load(std::memory_order_relaxed), event.id.load(std::memory_order_relaxed)});
+        }
+        // 复制期间被写入方覆盖的槽不可信，只保留之后仍然有效的部分
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const quint64 after = ring->head.load(std::memory_order_relaxed);
+        const quint64 valid = after >= capacity ? after - capacity + 1 : 0;
+
+        for (quint64 i = qMax(begin, valid); i < head; ++i) {
+            const Copy &event = copies[size_t(i - begin)];
+            if (!event.name || event.start < r.baseTicks)
+                continue;
+            separator();
+            out += "{\"ph\":\"X\",\"cat\":\"chat\",\"pid\":1,\"tid\":";
+            out += QByteArray::number(ring->tid);
+            out += ",\"name\":\"";
+            out += event.name;
+            out += "\",\"ts\":";
+            out += QByteArray::number(double(event.start - r.baseTicks) / perUs, 'f', 3);
+            out += ",\"dur\":";
+            out += QByteArray::number(double(event.duration) / perUs, 'f', 3);
+            if (event.id) {
+                // 同一编号的区间按时间顺序连成一条 flow
+                out += ",\"bind_id\":\"0x";
+                out += QByteArray::number(event.id, 16);
+                out += "\",\"flow_in\":true,\"flow_out\":true,\"args\":{\"message\":";
+                out += QByteArray::number(event.id);
+                out += '}';
+            }
+            out += '}';
+        }
+    }
+    out += "]}\n";
+    return out;
+}
+
+bool Tracer::dump(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write(toJson()) >= 0;
+}
@@ -0,0 +1,91 @@
+#include "userindex.h"
+
+UserIndex::Shard &UserIndex::shardFor(const QString &name)
+{
+    return m_shards[qHash(name) % kShardCount];
+}
+
+const UserIndex::Shard &UserIndex::shardFor(const QString &name) const
+{
+    return m_shards[qHash(name) % kShardCount];
+}
+
+bool UserIndex::insert(const QString &name, ServerWorker *worker)
+{
+    Shard &shard = shardFor(name);
+    QWriteLocker locker(&shard.lock);
+
+    auto it = shard.workers.find(name);
+    if (it != shard.workers.end())
+        return it.value() == worker;
+
+    shard.workers.insert(name, worker);
+    return true;
+}
+
+bool UserIndex::rename(const QString &oldName, const QString &newName, ServerWorker *worker)
+{
+    if (oldName == newName)
+        return insert(newName, worker);
+
+    Shard &oldShard = shardFor(oldName);
+    Shard &newShard = shardFor(newName);
+
+    if (&oldShard == &newShard) {
+        QWriteLocker locker(&newShard.lock);
+        if (newShard.workers.contains(newName))
+            return false;
+        if (newShard.workers.value(oldName) == worker)
+            newShard.workers.remove(oldName);
+        newShard.workers.insert(newName, worker);
+        return true;
+    }
+
+    // 按地址顺序加锁，避免两个方向的改名互相死锁
+    Shard *first = &oldShard < &newShard ? &oldShard : &newShard;
+    Shard *second = &oldShard < &newShard ? &newShard : &oldShard;
+    QWriteLocker firstLocker(&first->lock);
+    QWriteLocker secondLocker(&second->lock);
+
+    if (newShard.workers.contains(newName))
+        return false;
+    if (oldShard.workers.value(oldName) == worker)
+        oldShard.workers.remove(oldName);
+    newShard.workers.insert(newName, worker);
+    return true;
+}
+
+bool UserIndex::remove(const QString &name, ServerWorker *worker)
+{
+    Shard &shard = shardFor(name);
+    QWriteLocker locker(&shard.lock);
+
+    auto it = shard.workers.find(name);
+    if (it == shard.workers.end() || it.value() != worker)
+        return false;
+
+    shard.workers.erase(it);
+    return true;
+}
+
+ServerWorker *UserIndex::find(const QString &name) const
+{
+    const Shard &shard = shardFor(name);
+    QReadLocker locker(&shard.lock);
+    return shard.workers.value(name, nullptr);
+}
+
+bool UserIndex::contains(const QString &name) const
+{
+    return find(name) != nullptr;
+}
+
+int UserIndex::size() const
+{
+    int total = 0;
+    for (const Shard &shard : m_shards) {
+        QReadLocker locker(&shard.lock);
+        total += shard.workers.size();
+    }
+    return total;
+}
@@ -0,0 +1,44 @@
+#ifndef USERINDEX_H
+#define USERINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QReadWriteLock>
+
+class ServerWorker;
+
+// 用户名 -> ServerWorker 的并发哈希索引。
+// 按用户名哈希分片，每个分片一把读写锁，查找只需读锁，不同分片互不阻塞。
+class UserIndex
+{
+public:
+    UserIndex() = default;
+    UserIndex(const UserIndex &) = delete;
+    UserIndex &operator=(const UserIndex &) = delete;
+
+    // 名字已被其他 worker 占用时返回 false
+    bool insert(const QString &name, ServerWorker *worker);
+    // 原子地把 worker 从 oldName 改为 newName，newName 被占用时返回 false 且不做修改
+    bool rename(const QString &oldName, const QString &newName, ServerWorker *worker);
+    // 只有当 name 仍指向该 worker 时才删除
+    bool remove(const QString &name, ServerWorker *worker);
+
+    ServerWorker *find(const QString &name) const;
+    bool contains(const QString &name) const;
+    int size() const;
+
+private:
+    static const int kShardCount = 16;
+
+    struct Shard {
+        mutable QReadWriteLock lock;
+        QHash<QString, ServerWorker*> workers;
+    };
+
+    Shard &shardFor(const QString &name);
+    const Shard &shardFor(const QString &name) const;
+
+    Shard m_shards[kShardCount];
+};
+
+#endif // USERINDEX_H
@@ -0,0 +1,436 @@
+#include "chatserver.h"
+#include "serverlog.h"
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHostAddress>
+#include <QSettings>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <QSocketNotifier>
+#include <csignal>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+int g_signalFd[2] = {-1, -1};
+
+void handleTerminationSignal(int)
+{
+    const char byte = 1;
+    ssize_t ignored = ::write(g_signalFd[0], &byte, 1);
+    Q_UNUSED(ignored);
+}
+
+// 信号处理函数里只能写管道，真正的退出放到事件循环中执行
+void installSignalHandlers(QCoreApplication *app)
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, g_signalFd) != 0)
+        return;
+
+    QSocketNotifier *notifier = new QSocketNotifier(g_signalFd[1], QSocketNotifier::Read, app);
+    QObject::connect(notifier, &QSocketNotifier::activated, app, [notifier]() {
+        notifier->setEnabled(false);
+        char byte = 0;
+        ssize_t ignored = ::read(g_signalFd[1], &byte, 1);
+        Q_UNUSED(ignored);
+        qInfo() << "收到退出信号，正在关闭服务器";
+        QCoreApplication::quit();
+    });
+
+    struct sigaction action = {};
+    action.sa_handler = handleTerminationSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+}
+
+} // namespace
+#endif
+
+namespace {
+
+struct ServerLogStopper
+{
+    ~ServerLogStopper() { ServerLog::instance()->stop(); }
+};
+
+// 命令行优先，其次是配置文件，最后是默认值
+QString optionValue(const QCommandLineParser &parser, const QSettings *settings,
+                    const QString &name, const QString &defaultValue)
+{
+    if (parser.isSet(name))
+        return parser.value(name);
+    if (settings && settings->contains(name))
+        return settings->value(name).toString();
+    return defaultValue;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("chatserverd");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("无界面聊天服务器");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"config", "INI 配置文件，键名与命令行选项相同", "file"},
+        {"address", "监听地址（默认所有地址）", "address"},
+        {"port", "监听端口（默认 1967）", "port"},
+        {"io-threads", "I/O 线程数，0 表示 CPU 核心数", "count"},
+        {"storage", "聊天日志目录", "path"},
+        {"storage-format", "聊天日志格式: text, binary", "format"},
+        {"durability", "日志耐久性: none, flush, fsync", "mode"},
+        {"history-cache", "缓存的历史记录分页数（默认 256，0 表示不缓存）", "pages"},
+        {"recent-messages", "每个会话在内存中缓存的最近消息条数（默认 500，不小于单页上限 500，0 表示关闭）", "count"},
+        {"recent-cache-mb", "最近消息缓存的总内存上限（MiB，默认 32）", "mib"},
+        {"offline-max", "每个用户最多保留的离线私聊条数（默认 1000）", "count"},
+        {"offline-days", "离线私聊最多保留的天数（默认 7）", "days"},
+        {"offline-users", "最多保留多少个用户的离线队列（默认 10000）", "count"},
+        {"outbound-high", "单连接发送积压高水位（KiB，默认 4096）", "kib"},
+        {"outbound-low", "单连接写缓冲低水位（KiB，默认 256）", "kib"},
+        {"slow-consumer", "积压超过高水位时: drop-oldest, coalesce, disconnect（默认 coalesce）", "policy"},
+        {"coalesce-us", "同一连接合并写出的时间窗口（微秒，0 表示本轮事件循环结束时写出）", "us"},
+        {"presence-window", "上下线增量的合并窗口（毫秒，默认 50）", "ms"},
+        {"max-connections", "最多同时保持的客户端连接数，0 表示不限（默认 10000）", "count"},
+        {"ip-rate", "每个 IP 每秒允许的新连接数，0 表示不限（默认 20）", "rate"},
+        {"ip-burst", "每个 IP 允许的新连接突发数（默认 40）", "count"},
+        {"ip-max-connections", "每个 IP 最多同时保持的连接数，0 表示不限（默认 0）", "count"},
+        {"handshake-timeout", "连接后多久未登录即断开（毫秒，0 表示不检查，默认 10000）", "ms"},
+        {"accept-batch", "每轮事件循环最多接入的连接数（默认 64）", "count"},
+        {"heartbeat-interval", "空闲连接的心跳间隔（秒，0 表示关闭，默认 30）", "seconds"},
+        {"heartbeat-misses", "连续多少次心跳没有回应后断开（默认 3）", "count"},
+        {"listen-backlog", "监听队列长度（默认 50，需要 Qt 6.3 及以上）", "count"},
+        {"log-level", "日志级别: debug, info, warning, error（默认 info）", "level"},
+        {"log-file", "日志文件（默认写标准输出）", "file"},
+        {"log-rate", "每秒最多输出的非错误日志条数，0 表示不限（默认 1000）", "count"},
+        {"export-segment", "把二进制段文件导出为文本后退出", "segment"},
+        {"export-output", "导出的文本文件（默认与段文件同名 .log）", "file"},
+        {"metrics-port", "Prometheus 指标的 HTTP 端口，0 表示关闭（默认 0）", "port"},
+        {"metrics-address", "指标端口的监听地址（默认 127.0.0.1）", "address"},
+        {"trace", "启动时开启热路径追踪（也可通过指标端口的 /trace/start 开启）"},
+        {"trace-buffer", "每个线程保留的追踪区间数（默认 16384）", "events"},
+        {"trace-file", "退出时把追踪数据写入该文件（Chrome trace_event JSON）", "file"},
+        {"search-index", "新消息是否写入全文索引: on, off（默认 on）", "mode"},
+        {"rebuild-index", "从全部聊天日志重建全文索引后退出"},
+        {"search", "在全文索引中搜索并输出最新的结果后退出", "query"},
+        {"search-limit", "--search 输出的结果条数（默认 50）", "count"},
+    });
+    parser.process(a);
+
+    QSettings *settings = nullptr;
+    if (parser.isSet("config")) {
+        const QString configPath = parser.value("config");
+        if (!QFileInfo::exists(configPath)) {
+            qCritical() << "配置文件不存在:" << configPath;
+            return 1;
+        }
+        settings = new QSettings(configPath, QSettings::IniFormat, &a);
+    }
+
+    bool ok = false;
+    ServerLog *log = ServerLog::instance();
+    const QString logLevel = optionValue(parser, settings, "log-level", "info");
+    ServerLog::Level level = ServerLog::Info;
+    if (!ServerLog::parseLevel(logLevel, &level)) {
+        qCritical() << "未知的日志级别:" << logLevel;
+        return 1;
+    }
+    log->setLevel(level);
+    const int logRate = optionValue(parser, settings, "log-rate", "1000").toInt(&ok);
+    if (!ok) {
+        qCritical() << "无效的日志限流值";
+        return 1;
+    }
+    log->setRateLimit(logRate);
+    const QString logFile = optionValue(parser, settings, "log-file", QString());
+    if (logFile.isEmpty()) {
+        log->setStdoutEnabled(true);
+    } else if (!log->setOutputFile(logFile)) {
+        qCritical() << "无法打开日志文件:" << logFile;
+        return 1;
+    }
+
+    const QString addressText = optionValue(parser, settings, "address", QString());
+    const QHostAddress address = addressText.isEmpty() ? QHostAddress(QHostAddress::Any) : QHostAddress(addressText);
+    if (address.isNull()) {
+        qCritical() << "无效的监听地址:" << addressText;
+        return 1;
+    }
+    const quint16 port = optionValue(parser, settings, "port", "1967").toUShort(&ok);
+    if (!ok) {
+        qCritical() << "无效的端口";
+        return 1;
+    }
+    const int ioThreads = optionValue(parser, settings, "io-threads", "0").toInt(&ok);
+    if (!ok) {
+        qCritical() << "无效的 I/O 线程数";
+        return 1;
+    }
+
+    // 之后的 qDebug/qInfo 等都经过 ServerLog 异步输出
+    log->installMessageHandler();
+    log->start();
+    // 在 server 之后析构，任何返回路径上都先输出完剩余日志
+    ServerLogStopper logStopper;
+
+    ChatServer server;
+    server.setIoThreadCount(ioThreads);
+
+    ServerWorker::OutboundLimits limits;
+    limits.highWatermark = optionValue(parser, settings, "outbound-high", "4096").toLongLong(&ok) * 1024;
+    if (!ok || limits.highWatermark <= 0) {
+        qCritical() << "无效的发送积压高水位";
+        return 1;
+    }
+    limits.lowWatermark = optionValue(parser, settings, "outbound-low", "256").toLongLong(&ok) * 1024;
+    if (!ok || limits.lowWatermark <= 0 || limits.lowWatermark > limits.highWatermark) {
+        qCritical() << "无效的写缓冲低水位";
+        return 1;
+    }
+    const QString slowConsumer = optionValue(parser, settings, "slow-consumer", "coalesce");
+    if (!ServerWorker::parseOverflowPolicy(slowConsumer, &limits.policy)) {
+        qCritical() << "未知的慢客户端策略:" << slowConsumer;
+        return 1;
+    }
+    limits.coalesceWindowUs = optionValue(parser, settings, "coalesce-us", "0").toInt(&ok);
+    if (!ok || limits.coalesceWindowUs < 0) {
+        qCritical() << "无效的合并窗口";
+        return 1;
+    }
+    server.setOutboundLimits(limits);
+
+    const int presenceWindow = optionValue(parser, settings, "presence-window", "50").toInt(&ok);
+    if (!ok || presenceWindow < 0) {
+        qCritical() << "无效的在线状态合并窗口";
+        return 1;
+    }
+    server.setPresenceWindow(presenceWindow);
+
+    AdmissionControl::Limits admission;
+    admission.maxConnections = optionValue(parser, settings, "max-connections", "10000").toInt(&ok);
+    if (!ok || admission.maxConnections < 0) {
+        qCritical() << "无效的最大连接数";
+        return 1;
+    }
+    admission.perIpRate = optionValue(parser, settings, "ip-rate", "20").toDouble(&ok);
+    if (!ok || admission.perIpRate < 0) {
+        qCritical() << "无效的单 IP 新连接速率";
+        return 1;
+    }
+    admission.perIpBurst = optionValue(parser, settings, "ip-burst", "40").toInt(&ok);
+    if (!ok || admission.perIpBurst <= 0) {
+        qCritical() << "无效的单 IP 突发数";
+        return 1;
+    }
+    admission.maxPerIp = optionValue(parser, settings, "ip-max-connections", "0").toInt(&ok);
+    if (!ok || admission.maxPerIp < 0) {
+        qCritical() << "无效的单 IP 最大连接数";
+        return 1;
+    }
+    admission.handshakeTimeoutMs = optionValue(parser, settings, "handshake-timeout", "10000").toInt(&ok);
+    if (!ok || admission.handshakeTimeoutMs < 0) {
+        qCritical() << "无效的登录超时";
+        return 1;
+    }
+    admission.acceptBatch = optionValue(parser, settings, "accept-batch", "64").toInt(&ok);
+    if (!ok || admission.acceptBatch <= 0) {
+        qCritical() << "无效的接入批量";
+        return 1;
+    }
+    server.setAdmissionLimits(admission);
+
+    const int heartbeatInterval = optionValue(parser, settings, "heartbeat-interval", "30").toInt(&ok);
+    if (!ok || heartbeatInterval < 0) {
+        qCritical() << "无效的心跳间隔";
+        return 1;
+    }
+    const int heartbeatMisses = optionValue(parser, settings, "heartbeat-misses", "3").toInt(&ok);
+    if (!ok || heartbeatMisses <= 0) {
+        qCritical() << "无效的心跳次数";
+        return 1;
+    }
+    server.setHeartbeat(heartbeatInterval * 1000, heartbeatMisses);
+
+    MessageStorage *storage = server.messageStorage();
+    const QString storagePath = optionValue(parser, settings, "storage", QString());
+    if (!storagePath.isEmpty())
+        storage->initStorage(storagePath);
+
+    const QString format = optionValue(parser, settings, "storage-format", "text");
+    if (format == "binary") {
+        storage->setStorageFormat(MessageStorage::BinaryFormat);
+    } else if (format != "text") {
+        qCritical() << "未知的存储格式:" << format;
+        return 1;
+    }
+
+    const QString durability = optionValue(parser, settings, "durability", "flush");
+    if (durability == "none") {
+        storage->setDurability(LogWriter::NoSync);
+    } else if (durability == "fsync") {
+        storage->setDurability(LogWriter::FsyncPerBatch);
+    } else if (durability != "flush") {
+        qCritical() << "未知的耐久性模式:" << durability;
+        return 1;
+    }
+
+    const int historyCache = optionValue(parser, settings, "history-cache", "256").toInt(&ok);
+    if (!ok || historyCache < 0) {
+        qCritical() << "无效的历史分页缓存大小";
+        return 1;
+    }
+    storage->setHistoryCacheSize(historyCache);
+
+    const int recentMessages = optionValue(parser, settings, "recent-messages", "500").toInt(&ok);
+    if (!ok || recentMessages < 0) {
+        qCritical() << "无效的最近消息缓存条数";
+        return 1;
+    }
+    const qint64 recentCacheMb = optionValue(parser, settings, "recent-cache-mb", "32").toLongLong(&ok);
+    if (!ok || recentCacheMb < 0) {
+        qCritical() << "无效的最近消息缓存大小";
+        return 1;
+    }
+    storage->setRecentCacheLimits(recentMessages, recentCacheMb * 1024 * 1024);
+
+    const int offlineMax = optionValue(parser, settings, "offline-max", "1000").toInt(&ok);
+    if (!ok || offlineMax <= 0) {
+        qCritical() << "无效的离线消息条数上限";
+        return 1;
+    }
+    const int offlineDays = optionValue(parser, settings, "offline-days", "7").toInt(&ok);
+    if (!ok || offlineDays <= 0) {
+        qCritical() << "无效的离线消息保留天数";
+        return 1;
+    }
+    const int offlineUsers = optionValue(parser, settings, "offline-users", "10000").toInt(&ok);
+    if (!ok || offlineUsers <= 0) {
+        qCritical() << "无效的离线队列数量上限";
+        return 1;
+    }
+    storage->setOfflineLimits(offlineMax, offlineDays, offlineUsers);
+
+    const QString searchIndex = optionValue(parser, settings, "search-index", "on");
+    if (searchIndex != "on" && searchIndex != "off") {
+        qCritical() << "无效的全文索引开关:" << searchIndex;
+        return 1;
+    }
+    storage->setSearchIndexEnabled(searchIndex == "on");
+
+    if (parser.isSet("rebuild-index")) {
+        const qint64 documents = storage->rebuildSearchIndex();
+        if (documents < 0) {
+            qCritical() << "重建全文索引失败";
+            return 1;
+        }
+        qInfo().noquote() << QString("全文索引已重建: %1 条消息, %2 个段文件")
+                                 .arg(documents)
+                                 .arg(storage->searchIndex().segmentCount());
+        return 0;
+    }
+
+    if (parser.isSet("search")) {
+        const int limit = optionValue(parser, settings, "search-limit", "50").toInt(&ok);
+        if (!ok || limit <= 0) {
+            qCritical() << "无效的搜索结果条数";
+            return 1;
+        }
+        // 运维工具，不按用户过滤；最新的在前
+        const QVector<SearchIndex::Hit> hits = storage->searchMessages(parser.value("search"), limit);
+        for (const SearchIndex::Hit &hit : hits) {
+            const SearchIndex::Document &document = hit.document;
+            const QString time = QDateTime::fromMSecsSinceEpoch(document.timestampMs).toString("yyyy-MM-dd hh:mm:ss");
+            QString where;
+            if (document.kind == BinaryLog::PrivateRecord)
+                where = QString("PRIVATE][%1->%2").arg(document.sender, document.target);
+            else if (document.kind == BinaryLog::RoomRecord)
+                where = QString("ROOM][%1][%2").arg(document.target, document.sender);
+            else
+                where = QString("PUBLIC][%1").arg(document.sender);
+            qInfo().noquote() << QString("#%1 [%2][%3] %4").arg(hit.docId).arg(time, where, document.text);
+        }
+        return 0;
+    }
+
+    if (parser.isSet("export-segment")) {
+        const QString segment = parser.value("export-segment");
+        // 名字字典和段文件在同一目录
+        if (storagePath.isEmpty())
+            storage->initStorage(QFileInfo(segment).absolutePath());
+        QString output = parser.value("export-output");
+        if (output.isEmpty()) {
+            const QFileInfo info(segment);
+            output = info.dir().filePath(info.completeBaseName() + ".log");
+        }
+        return storage->exportSegmentToText(segment, output) ? 0 : 1;
+    }
+
+    const int listenBacklog = optionValue(parser, settings, "listen-backlog", "50").toInt(&ok);
+    if (!ok || listenBacklog <= 0) {
+        qCritical() << "无效的监听队列长度";
+        return 1;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
+    server.setListenBacklogSize(listenBacklog);
+#else
+    if (listenBacklog != 50)
+        qWarning() << "当前 Qt 版本不支持设置监听队列长度，忽略 --listen-backlog";
+#endif
+    if (!server.listen(address, port)) {
+        qCritical() << "无法启动服务器:" << server.errorString();
+        return 1;
+    }
+    const int traceBuffer = optionValue(parser, settings, "trace-buffer", "16384").toInt(&ok);
+    if (!ok || traceBuffer <= 0) {
+        qCritical() << "无效的追踪缓冲大小";
+        return 1;
+    }
+    Tracer::setBufferEvents(traceBuffer);
+    if (parser.isSet("trace") || optionValue(parser, settings, "trace", "false") == "true")
+        Tracer::setEnabled(true);
+    const QString traceFile = optionValue(parser, settings, "trace-file", QString());
+
+    const uint metricsPort = optionValue(parser, settings, "metrics-port", "0").toUInt(&ok);
+    if (!ok || metricsPort > 65535) {
+        qCritical() << "无效的指标端口";
+        return 1;
+    }
+    const QHostAddress metricsAddress(optionValue(parser, settings, "metrics-address", "127.0.0.1"));
+    if (metricsAddress.isNull()) {
+        qCritical() << "无效的指标监听地址";
+        return 1;
+    }
+    if (!server.startMetrics(metricsAddress, quint16(metricsPort)))
+        return 1;
+    if (metricsPort > 0)
+        qInfo().noquote() << QString("指标地址 http://%1:%2/metrics").arg(metricsAddress.toString()).arg(metricsPort);
+
+    qInfo().noquote() << QString("服务器已经启动 %1:%2, I/O 线程 %3")
+                             .arg(address.toString())
+                             .arg(port)
+                             .arg(server.ioThreadCount());
+
+#ifdef Q_OS_UNIX
+    installSignalHandlers(&a);
+#endif
+
+    const int result = a.exec();
+    server.stopServer();
+    if (!traceFile.isEmpty()) {
+        if (Tracer::dump(traceFile))
+            qInfo().noquote() << "追踪数据已写入" << traceFile;
+        else
+            qWarning().noquote() << "无法写入追踪数据:" << traceFile;
+    }
+    return result;
+}
@@ -0,0 +1,11 @@
+# 客户端和服务器共用的代码（分帧和线协议编解码）
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/framedecoder.cpp \
+    $$PWD/wireprotocol.cpp
+
+HEADERS += \
+    $$PWD/framedecoder.h \
+    $$PWD/wireprotocol.h
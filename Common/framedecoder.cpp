@@ -0,0 +1,102 @@
+#include "framedecoder.h"
+#include <QIODevice>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+constexpr int PrefixSize = 4;
+// QDataStream 用 0xFFFFFFFF 表示空 QByteArray
+constexpr quint32 NullFrameLength = 0xFFFFFFFFu;
+
+} // namespace
+
+FrameDecoder::FrameDecoder(int maxFrameSize)
+    : m_maxFrameSize(maxFrameSize)
+{
+    m_buffer.resize(InitialCapacity);
+}
+
+void FrameDecoder::reset()
+{
+    m_head = 0;
+    m_tail = 0;
+    m_error = false;
+    if (m_buffer.size() != InitialCapacity)
+        m_buffer.resize(InitialCapacity);
+}
+
+void FrameDecoder::makeRoom()
+{
+    if (m_head == m_tail) {
+        // 全部消费完：大帧之后把缓冲区缩回初始大小
+        m_head = 0;
+        m_tail = 0;
+        if (m_buffer.size() > InitialCapacity * 4) {
+            m_buffer.resize(InitialCapacity);
+            m_buffer.squeeze();
+        }
+        return;
+    }
+
+    if (m_head > 0) {
+        // 只移动尚未完成的那一帧
+        std::memmove(m_buffer.data(), m_buffer.constData() + m_head, size_t(m_tail - m_head));
+        m_tail -= m_head;
+        m_head = 0;
+    }
+
+    // 当前帧比缓冲区大时按帧长扩容，上限由 nextFrame 检查
+    int needed = m_buffer.size();
+    if (m_tail >= PrefixSize) {
+        const quint32 length = qFromBigEndian<quint32>(m_buffer.constData());
+        if (length != NullFrameLength && int(length) <= m_maxFrameSize)
+            needed = qMax(needed, PrefixSize + int(length));
+    }
+    if (m_tail == m_buffer.size())
+        needed = qMax(needed, m_buffer.size() * 2);
+    if (needed > m_buffer.size())
+        m_buffer.resize(needed);
+}
+
+qint64 FrameDecoder::readFrom(QIODevice *device)
+{
+    if (m_error)
+        return 0;
+
+    makeRoom();
+
+    qint64 total = 0;
+    while (m_tail < m_buffer.size()) {
+        const qint64 bytes = device->read(m_buffer.data() + m_tail, m_buffer.size() - m_tail);
+        if (bytes < 0)
+            return -1;
+        if (bytes == 0)
+            break;
+        m_tail += int(bytes);
+        total += bytes;
+    }
+    return total;
+}
+
+bool FrameDecoder::nextFrame(QByteArrayView *frame)
+{
+    while (!m_error && m_tail - m_head >= PrefixSize) {
+        const quint32 length = qFromBigEndian<quint32>(m_buffer.constData() + m_head);
+        if (length == NullFrameLength) {
+            m_head += PrefixSize;
+            continue;
+        }
+        if (length > quint32(m_maxFrameSize)) {
+            m_error = true;
+            return false;
+        }
+        if (m_tail - m_head - PrefixSize < int(length))
+            return false;
+
+        *frame = QByteArrayView(m_buffer.constData() + m_head + PrefixSize, qsizetype(length));
+        m_head += PrefixSize + int(length);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,45 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+class QIODevice;
+
+// 按 4 字节大端长度前缀切分帧，与 QDataStream << QByteArray 的格式兼容。
+//
+// 每个连接一个实例：套接字数据直接读进可复用的缓冲区，长度前缀就地解析，
+// 完整的帧以视图形式交出，不经过 QDataStream 事务，也不为每帧分配 QByteArray。
+// 已消费的空间在下一次读取前整体前移回收，只有当前未完成的帧才会被移动。
+// 帧长度超过上限时进入错误状态，调用方应断开连接。
+class FrameDecoder
+{
+public:
+    static constexpr int DefaultMaxFrameSize = 1 << 20;
+    static constexpr int InitialCapacity = 16 * 1024;
+
+    explicit FrameDecoder(int maxFrameSize = DefaultMaxFrameSize);
+
+    // 读取设备中当前可读的数据，缓冲区满时提前返回，调用方取完帧后再次调用。
+    // 返回读取的字节数，设备出错返回 -1。之前交出的帧视图在此之后失效
+    qint64 readFrom(QIODevice *device);
+
+    // 取下一个完整帧，数据不足或出错时返回 false
+    bool nextFrame(QByteArrayView *frame);
+
+    bool hasError() const { return m_error; }
+    int maxFrameSize() const { return m_maxFrameSize; }
+    int bufferedBytes() const { return m_tail - m_head; }
+    void reset();
+
+private:
+    void makeRoom();
+
+    QByteArray m_buffer;
+    int m_head = 0;          // 下一帧长度前缀的位置
+    int m_tail = 0;          // 已读入数据的末尾
+    int m_maxFrameSize;
+    bool m_error = false;
+};
+
+#endif // FRAMEDECODER_H
@@ -0,0 +1,239 @@
+#include "wireprotocol.h"
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QtEndian>
+
+namespace {
+
+const char *const OpcodeNames[] = {
+    nullptr,
+    "login",
+    "message",
+    "private",
+    "newuser",
+    "userdisconnected",
+    "userlist",
+    "error",
+    "shutdown"
+};
+constexpr int OpcodeCount = int(sizeof(OpcodeNames) / sizeof(OpcodeNames[0]));
+
+enum FieldKind { StringKind, ListKind, IntegerKind };
+
+struct FieldSpec {
+    quint8 bit;
+    const char *key;
+    FieldKind kind;
+};
+
+// 写入顺序即位图从低到高的顺序
+const FieldSpec Fields[] = {
+    {WireProtocol::TextField, "text", StringKind},
+    {WireProtocol::SenderField, "sender", StringKind},
+    {WireProtocol::ReceiverField, "receiver", StringKind},
+    {WireProtocol::TimestampField, "timestamp", StringKind},
+    {WireProtocol::UserNameField, "username", StringKind},
+    {WireProtocol::UserListField, "userlist", ListKind},
+    {WireProtocol::WireField, "wire", IntegerKind}
+};
+constexpr quint8 KnownFields = 0x7F;
+
+const FieldSpec *fieldForKey(const QString &key)
+{
+    for (const FieldSpec &spec : Fields) {
+        if (key == QLatin1String(spec.key))
+            return &spec;
+    }
+    return nullptr;
+}
+
+int opcodeForType(const QString &type)
+{
+    for (int i = 1; i < OpcodeCount; ++i) {
+        if (type.compare(QLatin1String(OpcodeNames[i]), Qt::CaseInsensitive) == 0)
+            return i;
+    }
+    return 0;
+}
+
+void writeString(QByteArray &out, const QString &text)
+{
+    const QByteArray utf8 = text.toUtf8();
+    WireProtocol::writeVarint(out, quint64(utf8.size()));
+    out.append(utf8);
+}
+
+bool readString(const char *&cursor, const char *end, QString *text)
+{
+    quint64 size = 0;
+    if (!WireProtocol::readVarint(cursor, end, &size) || size > quint64(end - cursor))
+        return false;
+    *text = QString::fromUtf8(cursor, int(size));
+    cursor += size;
+    return true;
+}
+
+} // namespace
+
+bool WireProtocol::isBinary(const QByteArray &payload)
+{
+    return !payload.isEmpty() && quint8(payload.at(0)) == Magic;
+}
+
+QByteArray WireProtocol::encode(const QJsonObject &json)
+{
+    const int opcode = opcodeForType(json.value("type").toString());
+    if (opcode == 0)
+        return QByteArray();
+
+    // 先检查所有字段都能表示，避免编码到一半才发现要回退
+    quint8 flags = 0;
+    for (auto it = json.constBegin(); it != json.constEnd(); ++it) {
+        if (it.key() == QLatin1String("type"))
+            continue;
+        const FieldSpec *spec = fieldForKey(it.key());
+        if (!spec)
+            return QByteArray();
+        const QJsonValue value = it.value();
+        switch (spec->kind) {
+        case StringKind:
+            if (!value.isString())
+                return QByteArray();
+            break;
+        case ListKind:
+            if (!value.isArray())
+                return QByteArray();
+            for (const QJsonValue item : value.toArray()) {
+                if (!item.isString())
+                    return QByteArray();
+            }
+            break;
+        case IntegerKind:
+            if (!value.isDouble() || value.toDouble() < 0)
+                return QByteArray();
+            break;
+        }
+        flags |= spec->bit;
+    }
+
+    QByteArray out;
+    out.reserve(64);
+    out.append(char(Magic));
+    out.append(char(Version));
+    out.append(char(opcode));
+    out.append(char(flags));
+
+    for (const FieldSpec &spec : Fields) {
+        if (!(flags & spec.bit))
+            continue;
+        const QJsonValue value = json.value(QLatin1String(spec.key));
+        switch (spec.kind) {
+        case StringKind:
+            writeString(out, value.toString());
+            break;
+        case ListKind: {
+            const QJsonArray list = value.toArray();
+            writeVarint(out, quint64(list.size()));
+            for (const QJsonValue item : list)
+                writeString(out, item.toString());
+            break;
+        }
+        case IntegerKind:
+            writeVarint(out, quint64(value.toInteger()));
+            break;
+        }
+    }
+    return out;
+}
+
+bool WireProtocol::decode(const QByteArray &payload, QJsonObject *json)
+{
+    if (payload.size() < HeaderSize || quint8(payload.at(0)) != Magic)
+        return false;
+    // 更高版本可能改变字段布局，交给上层按不支持处理
+    if (quint8(payload.at(1)) != Version)
+        return false;
+
+    const int opcode = quint8(payload.at(2));
+    const quint8 flags = quint8(payload.at(3));
+    if (opcode <= 0 || opcode >= OpcodeCount || (flags & ~KnownFields))
+        return false;
+
+    QJsonObject result;
+    result.insert(QLatin1String("type"), QLatin1String(OpcodeNames[opcode]));
+
+    const char *cursor = payload.constData() + HeaderSize;
+    const char *end = payload.constData() + payload.size();
+    for (const FieldSpec &spec : Fields) {
+        if (!(flags & spec.bit))
+            continue;
+        switch (spec.kind) {
+        case StringKind: {
+            QString text;
+            if (!readString(cursor, end, &text))
+                return false;
+            result.insert(QLatin1String(spec.key), text);
+            break;
+        }
+        case ListKind: {
+            quint64 count = 0;
+            // 每个元素至少 1 字节，据此拒绝伪造的超大计数
+            if (!readVarint(cursor, end, &count) || count > quint64(end - cursor))
+                return false;
+            QJsonArray list;
+            for (quint64 i = 0; i < count; ++i) {
+                QString item;
+                if (!readString(cursor, end, &item))
+                    return false;
+                list.append(item);
+            }
+            result.insert(QLatin1String(spec.key), list);
+            break;
+        }
+        case IntegerKind: {
+            quint64 value = 0;
+            if (!readVarint(cursor, end, &value))
+                return false;
+            result.insert(QLatin1String(spec.key), qint64(value));
+            break;
+        }
+        }
+    }
+
+    if (cursor != end)
+        return false;
+    *json = result;
+    return true;
+}
+
+QByteArray WireProtocol::frame(const QByteArray &payload)
+{
+    QByteArray out;
+    out.resize(4);
+    qToBigEndian<quint32>(quint32(payload.size()), out.data());
+    out.append(payload);
+    return out;
+}
+
+void WireProtocol::writeVarint(QByteArray &out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+bool WireProtocol::readVarint(const char *&cursor, const char *end, quint64 *value)
+{
+    quint64 result = 0;
+    for (int shift = 0; shift < 64 && cursor < end; shift += 7) {
+        const quint8 byte = quint8(*cursor++);
+        result |= quint64(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,61 @@
+#ifndef WIREPROTOCOL_H
+#define WIREPROTOCOL_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+
+// 紧凑二进制线协议，客户端和服务器共用。
+//
+// 外层分帧不变：4 字节大端长度 + 负载（与 QDataStream << QByteArray 相同）。
+// 二进制负载的固定头为
+//   u8 魔数 0xC5 | u8 版本 | u8 操作码 | u8 字段位图
+// 之后按位图从低位到高位依次写入出现的字段：
+//   字符串 = varint 字节数 + UTF-8；列表 = varint 元素个数 + 字符串；整数 = varint
+// JSON 负载总是以 '{' 或空白开头，和魔数不会冲突，所以两种格式可以混在同一连接上。
+//
+// 协商：客户端在 JSON 登录请求中带上 "wire": 支持的最高版本，服务器记下后
+// 对该连接改发二进制帧；客户端收到第一个二进制帧后也改发二进制。旧的对端始终使用 JSON。
+class WireProtocol
+{
+public:
+    static constexpr quint8 Magic = 0xC5;
+    static constexpr int Version = 1;
+    static constexpr int HeaderSize = 4;
+
+    enum Opcode : quint8 {
+        Login = 1,
+        Message,
+        Private,
+        NewUser,
+        UserDisconnected,
+        UserList,
+        Error,
+        Shutdown
+    };
+
+    enum Field : quint8 {
+        TextField = 0x01,
+        SenderField = 0x02,
+        ReceiverField = 0x04,
+        TimestampField = 0x08,
+        UserNameField = 0x10,
+        UserListField = 0x20,
+        WireField = 0x40
+    };
+
+    static bool isBinary(const QByteArray &payload);
+
+    // 编码为二进制负载（不含长度前缀）。类型或字段超出协议范围时返回空，调用方改用 JSON
+    static QByteArray encode(const QJsonObject &json);
+    // 解码为与 JSON 消息相同结构的对象，格式错误或版本不支持时返回 false
+    static bool decode(const QByteArray &payload, QJsonObject *json);
+
+    // 加上 4 字节大端长度前缀
+    static QByteArray frame(const QByteArray &payload);
+
+    static void writeVarint(QByteArray &out, quint64 value);
+    static bool readVarint(const char *&cursor, const char *end, quint64 *value);
+};
+
+#endif // WIREPROTOCOL_H
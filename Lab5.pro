@@ -1,5 +1,7 @@
 TEMPLATE = subdirs
 
 SUBDIRS += \
+    ChatBench \
     ChatClient \
-    ChatServer
+    ChatServer \
+    ChatServerDaemon